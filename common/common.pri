@@ -1,3 +1,9 @@
 INCLUDEPATH += $$PWD
-SOURCES += $$PWD/mlsdbserialisation.cpp
-HEADERS += $$PWD/mlsdbserialisation.h
+SOURCES += $$PWD/mlsdbserialisation.cpp \
+           $$PWD/mlsdbcellindex.cpp \
+           $$PWD/mlsdbwlanindex.cpp \
+           $$PWD/mlsdbbloomfilter.cpp
+HEADERS += $$PWD/mlsdbserialisation.h \
+           $$PWD/mlsdbcellindex.h \
+           $$PWD/mlsdbwlanindex.h \
+           $$PWD/mlsdbbloomfilter.h
@@ -0,0 +1,182 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include "mlsdbbloomfilter.h"
+
+#include <QtCore/QtEndian>
+#include <QtCore/QDebug>
+#include <QtCore/QFileInfo>
+
+#include <cmath>
+#include <string.h>
+
+namespace {
+    const quint32 BitsPerKey = 10;     // before rounding up to a power of two, about 1% false positives
+    const quint32 MaximumHashCount = 16;
+    const quint64 AccessPointKeyTag = Q_UINT64_C(0x5741) << 48; // "WA", keeps BSSIDs apart from cells
+
+    // the splitmix64 finaliser, every input bit affects every output bit.
+    inline quint64 mix(quint64 value)
+    {
+        value ^= value >> 30;
+        value *= Q_UINT64_C(0xbf58476d1ce4e5b9);
+        value ^= value >> 27;
+        value *= Q_UINT64_C(0x94d049bb133111eb);
+        value ^= value >> 31;
+        return value;
+    }
+}
+
+MlsdbBloomFilter::MlsdbBloomFilter()
+    : m_data(0)
+    , m_bits(0)
+    , m_bitMask(0)
+    , m_hashCount(0)
+    , m_keyCount(0)
+    , m_sourceSize(0)
+{
+}
+
+MlsdbBloomFilter::~MlsdbBloomFilter()
+{
+    close();
+}
+
+quint64 MlsdbBloomFilter::cellKey(const MlsdbUniqueCellId &uniqueCellId)
+{
+    return mix((quint64(uniqueCellId.m_cellId) << 32 | uniqueCellId.m_locationCode)
+               ^ mix(quint64(uniqueCellId.m_mcc) << 16 | uniqueCellId.m_mnc));
+}
+
+quint64 MlsdbBloomFilter::accessPointKey(quint64 bssid)
+{
+    return mix(AccessPointKeyTag | (bssid & Q_UINT64_C(0xFFFFFFFFFFFF)));
+}
+
+quint32 MlsdbBloomFilter::sourceSize(const QStringList &fileNames)
+{
+    quint64 size = 0;
+    Q_FOREACH (const QString &fileName, fileNames) {
+        size += quint64(QFileInfo(fileName).size());
+    }
+    return quint32(size);
+}
+
+QByteArray MlsdbBloomFilter::build(const QVector<quint64> &keys, quint32 sourceSize)
+{
+    quint32 bitCount = 64;
+    while (bitCount < quint32(keys.size()) * BitsPerKey && bitCount < 0x80000000u) {
+        bitCount *= 2;
+    }
+    const quint32 hashCount = keys.isEmpty() ? 1 : qBound<quint32>(1, quint32(std::floor(0.693 * bitCount / keys.size() + 0.5)), MaximumHashCount);
+
+    MlsdbBloomFilterHeader header;
+    header.magic = qToLittleEndian<quint32>(MLSDB_BLOOM_MAGIC);
+    header.version = qToLittleEndian<qint32>(MLSDB_BLOOM_VERSION);
+    header.bitCount = qToLittleEndian(bitCount);
+    header.hashCount = qToLittleEndian(hashCount);
+    header.keyCount = qToLittleEndian(quint32(keys.size()));
+    header.sourceSize = qToLittleEndian(sourceSize);
+
+    QByteArray result(int(sizeof(header) + bitCount / 8), '\0');
+    memcpy(result.data(), &header, sizeof(header));
+    uchar *bits = reinterpret_cast<uchar *>(result.data()) + sizeof(header);
+    Q_FOREACH (quint64 key, keys) {
+        const quint32 h1 = quint32(key);
+        const quint32 h2 = quint32(key >> 32) | 1;
+        for (quint32 i = 0; i < hashCount; ++i) {
+            const quint32 bit = (h1 + i * h2) & (bitCount - 1);
+            bits[bit >> 3] |= uchar(1 << (bit & 7));
+        }
+    }
+    return result;
+}
+
+bool MlsdbBloomFilter::open(const QString &fileName)
+{
+    close();
+
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        qDebug() << "geoclue-mlsdb bloom filter" << fileName << "cannot be opened:" << m_file.errorString();
+        return false;
+    }
+
+    const qint64 size = m_file.size();
+    if (size < qint64(sizeof(MlsdbBloomFilterHeader))) {
+        qDebug() << "geoclue-mlsdb bloom filter" << fileName << "is truncated";
+        m_file.close();
+        return false;
+    }
+
+    uchar *data = m_file.map(0, size);
+    if (!data) {
+        qDebug() << "geoclue-mlsdb bloom filter" << fileName << "cannot be mapped:" << m_file.errorString();
+        m_file.close();
+        return false;
+    }
+
+    const MlsdbBloomFilterHeader *header = reinterpret_cast<const MlsdbBloomFilterHeader *>(data);
+    const quint32 magic = qFromLittleEndian(header->magic);
+    const qint32 version = qFromLittleEndian(header->version);
+    const quint32 bitCount = qFromLittleEndian(header->bitCount);
+    const quint32 hashCount = qFromLittleEndian(header->hashCount);
+    if (magic != MLSDB_BLOOM_MAGIC) {
+        qDebug() << "geoclue-mlsdb bloom filter" << fileName << "format unknown:" << magic << "expected:" << MLSDB_BLOOM_MAGIC;
+    } else if (version != MLSDB_BLOOM_VERSION) {
+        qDebug() << "geoclue-mlsdb bloom filter" << fileName << "version unknown:" << version;
+    } else if (bitCount < 64 || (bitCount & (bitCount - 1)) != 0
+               || hashCount == 0 || hashCount > MaximumHashCount
+               || size != qint64(sizeof(MlsdbBloomFilterHeader)) + bitCount / 8) {
+        qDebug() << "geoclue-mlsdb bloom filter" << fileName << "size" << size << "does not match bit count" << bitCount;
+    } else {
+        m_data = data;
+        m_bits = data + sizeof(MlsdbBloomFilterHeader);
+        m_bitMask = bitCount - 1;
+        m_hashCount = hashCount;
+        m_keyCount = qFromLittleEndian(header->keyCount);
+        m_sourceSize = qFromLittleEndian(header->sourceSize);
+        return true;
+    }
+
+    m_file.unmap(data);
+    m_file.close();
+    return false;
+}
+
+void MlsdbBloomFilter::close()
+{
+    if (m_data) {
+        m_file.unmap(m_data);
+    }
+    m_file.close();
+    m_data = 0;
+    m_bits = 0;
+    m_bitMask = 0;
+    m_hashCount = 0;
+    m_keyCount = 0;
+    m_sourceSize = 0;
+}
+
+bool MlsdbBloomFilter::mayContain(quint64 key) const
+{
+    if (!m_bits) {
+        return true; // without a filter, anything may be there.
+    }
+
+    const quint32 h1 = quint32(key);
+    const quint32 h2 = quint32(key >> 32) | 1;
+    for (quint32 i = 0; i < m_hashCount; ++i) {
+        const quint32 bit = (h1 + i * h2) & m_bitMask;
+        if (!(m_bits[bit >> 3] & (1 << (bit & 7)))) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,86 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#ifndef GEOCLUE_MLSDB_BLOOMFILTER_H
+#define GEOCLUE_MLSDB_BLOOMFILTER_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QFile>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+
+#include "mlsdbserialisation.h"
+
+#define MLSDB_BLOOM_MAGIC 0xb1001cdb
+#define MLSDB_BLOOM_VERSION 2
+
+/*
+ * An mlsdb.bloom file holds a Bloom filter over the keys (cells and
+ * WLAN access points) of the data files in the same directory, so that
+ * a key which is not in them can be rejected without reading them.
+ * False positives only cost the lookup which would have happened
+ * anyway, and there are no false negatives.
+ *
+ * There are only no false negatives while the data files are those the
+ * filter was built over, so the header records their total size, and a
+ * filter whose size does not match the files next to it is stale.
+ *
+ * The file is mapped into memory.  The bit count is a power of two, and
+ * the bits of a key are chosen by double hashing its 64-bit mixed hash.
+ * All fields are little-endian.
+ */
+
+struct MlsdbBloomFilterHeader {
+    quint32 magic;     // MLSDB_BLOOM_MAGIC
+    qint32 version;    // MLSDB_BLOOM_VERSION
+    quint32 bitCount;  // a power of two, a multiple of 64
+    quint32 hashCount;
+    quint32 keyCount;
+    quint32 sourceSize; // total size of the files the keys were read from, truncated to 32 bits
+};
+Q_DECLARE_TYPEINFO(MlsdbBloomFilterHeader, Q_PRIMITIVE_TYPE);
+Q_STATIC_ASSERT(sizeof(MlsdbBloomFilterHeader) == 24);
+
+class MlsdbBloomFilter
+{
+public:
+    MlsdbBloomFilter();
+    ~MlsdbBloomFilter();
+
+    bool open(const QString &fileName);
+    void close();
+    bool isOpen() const { return m_bits != 0; }
+
+    QString fileName() const { return m_file.fileName(); }
+    quint32 keyCount() const { return m_keyCount; }
+    quint32 sourceSize() const { return m_sourceSize; }
+
+    bool mayContain(quint64 key) const;
+
+    static quint64 cellKey(const MlsdbUniqueCellId &uniqueCellId);
+    static quint64 accessPointKey(quint64 bssid);
+
+    // the contents of a filter file over the given keys, at about 1% false positives.
+    static QByteArray build(const QVector<quint64> &keys, quint32 sourceSize);
+    static quint32 sourceSize(const QStringList &fileNames);
+
+private:
+    Q_DISABLE_COPY(MlsdbBloomFilter)
+
+    QFile m_file;
+    uchar *m_data;
+    const uchar *m_bits;
+    quint32 m_bitMask;
+    quint32 m_hashCount;
+    quint32 m_keyCount;
+    quint32 m_sourceSize;
+};
+
+#endif // GEOCLUE_MLSDB_BLOOMFILTER_H
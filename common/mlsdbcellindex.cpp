@@ -0,0 +1,177 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include "mlsdbcellindex.h"
+
+#include <QtCore/QtEndian>
+#include <QtCore/QDebug>
+
+namespace {
+    const double CoordinateScale = 10000000.0; // coordinates are stored as degrees * 1e7
+
+    // returns <0, 0, >0 if the record sorts before, equal to, or after the key.
+    inline int compareRecord(const MlsdbCellIndexRecord &record, const MlsdbUniqueCellId &key)
+    {
+        const quint32 cellId = qFromLittleEndian(record.cellId);
+        if (cellId != key.m_cellId) return cellId < key.m_cellId ? -1 : 1;
+        const quint32 locationCode = qFromLittleEndian(record.locationCode);
+        if (locationCode != key.m_locationCode) return locationCode < key.m_locationCode ? -1 : 1;
+        const quint16 mcc = qFromLittleEndian(record.mcc);
+        if (mcc != key.m_mcc) return mcc < key.m_mcc ? -1 : 1;
+        const quint16 mnc = qFromLittleEndian(record.mnc);
+        if (mnc != key.m_mnc) return mnc < key.m_mnc ? -1 : 1;
+        return 0;
+    }
+}
+
+MlsdbCellIndexHeader mlsdbCellIndexHeader(quint32 recordCount, quint16 minimumMcc, quint16 maximumMcc)
+{
+    MlsdbCellIndexHeader header;
+    header.magic = qToLittleEndian<quint32>(MLSDB_DATA_MAGIC);
+    header.version = qToLittleEndian<qint32>(MLSDB_INDEX_VERSION);
+    header.recordCount = qToLittleEndian(recordCount);
+    header.minimumMcc = qToLittleEndian(minimumMcc);
+    header.maximumMcc = qToLittleEndian(maximumMcc);
+    return header;
+}
+
+MlsdbCellIndexRecord mlsdbCellIndexRecord(const MlsdbUniqueCellId &uniqueCellId, const MlsdbCoords &coords)
+{
+    MlsdbCellIndexRecord record;
+    record.cellId = qToLittleEndian(uniqueCellId.m_cellId);
+    record.locationCode = qToLittleEndian(uniqueCellId.m_locationCode);
+    record.mcc = qToLittleEndian(uniqueCellId.m_mcc);
+    record.mnc = qToLittleEndian(uniqueCellId.m_mnc);
+    record.lat = qToLittleEndian<qint32>(qRound(coords.lat * CoordinateScale));
+    record.lon = qToLittleEndian<qint32>(qRound(coords.lon * CoordinateScale));
+    return record;
+}
+
+MlsdbUniqueCellId mlsdbCellIndexRecordCellId(const MlsdbCellIndexRecord &record)
+{
+    MlsdbUniqueCellId uniqueCellId;
+    uniqueCellId.m_cellId = qFromLittleEndian(record.cellId);
+    uniqueCellId.m_locationCode = qFromLittleEndian(record.locationCode);
+    uniqueCellId.m_mcc = qFromLittleEndian(record.mcc);
+    uniqueCellId.m_mnc = qFromLittleEndian(record.mnc);
+    return uniqueCellId;
+}
+
+MlsdbCoords mlsdbCellIndexRecordCoords(const MlsdbCellIndexRecord &record)
+{
+    MlsdbCoords coords;
+    coords.lat = qFromLittleEndian(record.lat) / CoordinateScale;
+    coords.lon = qFromLittleEndian(record.lon) / CoordinateScale;
+    return coords;
+}
+
+bool mlsdbCellIndexRecordLessThan(const MlsdbCellIndexRecord &lhs, const MlsdbCellIndexRecord &rhs)
+{
+    return compareRecord(lhs, mlsdbCellIndexRecordCellId(rhs)) < 0;
+}
+
+MlsdbCellIndex::MlsdbCellIndex()
+    : m_data(0)
+    , m_records(0)
+    , m_recordCount(0)
+    , m_minimumMcc(0)
+    , m_maximumMcc(0)
+{
+}
+
+MlsdbCellIndex::~MlsdbCellIndex()
+{
+    close();
+}
+
+bool MlsdbCellIndex::open(const QString &fileName)
+{
+    close();
+
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        qDebug() << "geoclue-mlsdb index file" << fileName << "cannot be opened:" << m_file.errorString();
+        return false;
+    }
+
+    const qint64 size = m_file.size();
+    if (size < qint64(sizeof(MlsdbCellIndexHeader))) {
+        qDebug() << "geoclue-mlsdb index file" << fileName << "is truncated";
+        m_file.close();
+        return false;
+    }
+
+    uchar *data = m_file.map(0, size);
+    if (!data) {
+        qDebug() << "geoclue-mlsdb index file" << fileName << "cannot be mapped:" << m_file.errorString();
+        m_file.close();
+        return false;
+    }
+
+    const MlsdbCellIndexHeader *header = reinterpret_cast<const MlsdbCellIndexHeader *>(data);
+    const quint32 magic = qFromLittleEndian(header->magic);
+    const qint32 version = qFromLittleEndian(header->version);
+    const quint32 recordCount = qFromLittleEndian(header->recordCount);
+    if (magic != MLSDB_DATA_MAGIC) {
+        qDebug() << "geoclue-mlsdb index file" << fileName << "format unknown:" << magic << "expected:" << MLSDB_DATA_MAGIC;
+    } else if (version != MLSDB_INDEX_VERSION) {
+        qDebug() << "geoclue-mlsdb index file" << fileName << "version unknown:" << version;
+    } else if (size != qint64(sizeof(MlsdbCellIndexHeader)) + qint64(recordCount) * qint64(sizeof(MlsdbCellIndexRecord))) {
+        qDebug() << "geoclue-mlsdb index file" << fileName << "size" << size << "does not match record count" << recordCount;
+    } else {
+        m_data = data;
+        m_records = reinterpret_cast<const MlsdbCellIndexRecord *>(data + sizeof(MlsdbCellIndexHeader));
+        m_recordCount = recordCount;
+        m_minimumMcc = qFromLittleEndian(header->minimumMcc);
+        m_maximumMcc = qFromLittleEndian(header->maximumMcc);
+        return true;
+    }
+
+    m_file.unmap(data);
+    m_file.close();
+    return false;
+}
+
+void MlsdbCellIndex::close()
+{
+    if (m_data) {
+        m_file.unmap(m_data);
+    }
+    m_file.close();
+    m_data = 0;
+    m_records = 0;
+    m_recordCount = 0;
+    m_minimumMcc = 0;
+    m_maximumMcc = 0;
+}
+
+bool MlsdbCellIndex::find(const MlsdbUniqueCellId &uniqueCellId, MlsdbCoords *coords) const
+{
+    if (!m_records || uniqueCellId.m_mcc < m_minimumMcc || uniqueCellId.m_mcc > m_maximumMcc) {
+        return false;
+    }
+
+    // binary search the sorted records in place.
+    quint32 lower = 0;
+    quint32 upper = m_recordCount;
+    while (lower < upper) {
+        const quint32 middle = lower + (upper - lower) / 2;
+        const int cmp = compareRecord(m_records[middle], uniqueCellId);
+        if (cmp < 0) {
+            lower = middle + 1;
+        } else if (cmp > 0) {
+            upper = middle;
+        } else {
+            *coords = mlsdbCellIndexRecordCoords(m_records[middle]);
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,88 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#ifndef GEOCLUE_MLSDB_CELLINDEX_H
+#define GEOCLUE_MLSDB_CELLINDEX_H
+
+#include <QtCore/QFile>
+#include <QtCore/QString>
+
+#include "mlsdbserialisation.h"
+
+#define MLSDB_DATA_MAGIC 0xc710cdb
+#define MLSDB_DATA_VERSION 3
+#define MLSDB_INDEX_VERSION 4
+
+/*
+ * The version 4 "index" format stores the same data as the version 3
+ * mlsdb.data buckets, but as an array of fixed-size records sorted by
+ * MlsdbUniqueCellId::operator<(), so that it can be mapped into memory
+ * and binary-searched in place without deserialising anything.
+ *
+ * All fields are little-endian.  Coordinates are stored as degrees * 1e7.
+ */
+
+struct MlsdbCellIndexHeader {
+    quint32 magic;       // MLSDB_DATA_MAGIC
+    qint32 version;      // MLSDB_INDEX_VERSION
+    quint32 recordCount;
+    quint16 minimumMcc;  // smallest mcc of any record in the file
+    quint16 maximumMcc;  // largest mcc of any record in the file
+};
+Q_DECLARE_TYPEINFO(MlsdbCellIndexHeader, Q_PRIMITIVE_TYPE);
+
+struct MlsdbCellIndexRecord {
+    quint32 cellId;       // MlsdbUniqueCellId::m_cellId, low 4 bits encode the MlsdbCellType
+    quint32 locationCode;
+    quint16 mcc;
+    quint16 mnc;
+    qint32 lat;
+    qint32 lon;
+};
+Q_DECLARE_TYPEINFO(MlsdbCellIndexRecord, Q_PRIMITIVE_TYPE);
+
+Q_STATIC_ASSERT(sizeof(MlsdbCellIndexHeader) == 16);
+Q_STATIC_ASSERT(sizeof(MlsdbCellIndexRecord) == 20);
+
+MlsdbCellIndexHeader mlsdbCellIndexHeader(quint32 recordCount, quint16 minimumMcc, quint16 maximumMcc);
+MlsdbCellIndexRecord mlsdbCellIndexRecord(const MlsdbUniqueCellId &uniqueCellId, const MlsdbCoords &coords);
+MlsdbUniqueCellId mlsdbCellIndexRecordCellId(const MlsdbCellIndexRecord &record);
+MlsdbCoords mlsdbCellIndexRecordCoords(const MlsdbCellIndexRecord &record);
+bool mlsdbCellIndexRecordLessThan(const MlsdbCellIndexRecord &lhs, const MlsdbCellIndexRecord &rhs);
+
+class MlsdbCellIndex
+{
+public:
+    MlsdbCellIndex();
+    ~MlsdbCellIndex();
+
+    bool open(const QString &fileName);
+    void close();
+    bool isOpen() const { return m_records != 0; }
+
+    QString fileName() const { return m_file.fileName(); }
+    quint32 recordCount() const { return m_recordCount; }
+    const MlsdbCellIndexRecord *records() const { return m_records; }
+    quint16 minimumMcc() const { return m_minimumMcc; }
+    quint16 maximumMcc() const { return m_maximumMcc; }
+
+    bool find(const MlsdbUniqueCellId &uniqueCellId, MlsdbCoords *coords) const;
+
+private:
+    Q_DISABLE_COPY(MlsdbCellIndex)
+
+    QFile m_file;
+    uchar *m_data;
+    const MlsdbCellIndexRecord *m_records;
+    quint32 m_recordCount;
+    quint16 m_minimumMcc;
+    quint16 m_maximumMcc;
+};
+
+#endif // GEOCLUE_MLSDB_CELLINDEX_H
@@ -36,9 +36,27 @@ QDataStream &operator>>(QDataStream &in, MlsdbUniqueCellId &cellId)
     return in;
 }
 
-uint qHash(const MlsdbUniqueCellId &key)
+namespace {
+    // the finalizer of MurmurHash3, every input bit affects every output bit.
+    inline quint64 mix64(quint64 h)
+    {
+        h ^= h >> 33;
+        h *= Q_UINT64_C(0xff51afd7ed558ccd);
+        h ^= h >> 33;
+        h *= Q_UINT64_C(0xc4ceb9fe1a85ec53);
+        h ^= h >> 33;
+        return h;
+    }
+}
+
+uint qHash(const MlsdbUniqueCellId &key, uint seed)
 {
-    return key.m_cellId;
+    // the same cell id is commonly reused across location codes and networks,
+    // and its low bits only encode the cell type, so mix all twelve bytes of the key.
+    const quint64 high = (quint64(key.m_cellId) << 32) | key.m_locationCode;
+    const quint64 low = (quint64(key.m_mcc) << 16) | key.m_mnc;
+    const quint64 h = mix64(high ^ mix64(low ^ (quint64(seed) << 32) ^ Q_UINT64_C(0x9e3779b97f4a7c15)));
+    return uint(h ^ (h >> 32));
 }
 
 QString stringForMlsdbCellType(MlsdbCellType type)
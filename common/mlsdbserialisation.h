@@ -14,12 +14,14 @@
 #define GEOCLUE_MLSDB_SERIALISATION_H
 
 #include <QDataStream>
+#include <QMetaType>
 
 struct MlsdbCoords {
     double lat;
     double lon;
 };
 Q_DECLARE_TYPEINFO(MlsdbCoords, Q_PRIMITIVE_TYPE);
+Q_DECLARE_METATYPE(MlsdbCoords)
 
 QDataStream &operator<<(QDataStream &out, const MlsdbCoords &coords);
 QDataStream &operator>>(QDataStream &in, MlsdbCoords &coords);
@@ -80,9 +82,10 @@ struct MlsdbUniqueCellId {
     quint16 m_mnc;          // 8 or 12 bits
 };
 Q_DECLARE_TYPEINFO(MlsdbUniqueCellId, Q_PRIMITIVE_TYPE);
+Q_DECLARE_METATYPE(MlsdbUniqueCellId)
 
 QDataStream &operator<<(QDataStream &out, const MlsdbUniqueCellId &cellId);
 QDataStream &operator>>(QDataStream &in, MlsdbUniqueCellId &cellId);
-uint qHash(const MlsdbUniqueCellId &key);
+uint qHash(const MlsdbUniqueCellId &key, uint seed = 0);
 
 #endif // GEOCLUE_MLSDB_SERIALISATION_H
@@ -0,0 +1,150 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include "mlsdbwlanindex.h"
+
+#include <QtCore/QtEndian>
+#include <QtCore/QDebug>
+
+namespace {
+    const double CoordinateScale = 10000000.0; // coordinates are stored as degrees * 1e7
+}
+
+MlsdbWlanIndexHeader mlsdbWlanIndexHeader(quint32 recordCount)
+{
+    MlsdbWlanIndexHeader header;
+    header.magic = qToLittleEndian<quint32>(MLSDB_WLAN_MAGIC);
+    header.version = qToLittleEndian<qint32>(MLSDB_WLAN_VERSION);
+    header.recordCount = qToLittleEndian(recordCount);
+    header.reserved = 0;
+    return header;
+}
+
+MlsdbWlanIndexRecord mlsdbWlanIndexRecord(quint64 bssid, const MlsdbCoords &coords)
+{
+    MlsdbWlanIndexRecord record;
+    record.bssidLow = qToLittleEndian(quint32(bssid));
+    record.bssidHigh = qToLittleEndian(quint16(bssid >> 32));
+    record.reserved = 0;
+    record.lat = qToLittleEndian<qint32>(qRound(coords.lat * CoordinateScale));
+    record.lon = qToLittleEndian<qint32>(qRound(coords.lon * CoordinateScale));
+    return record;
+}
+
+quint64 mlsdbWlanIndexRecordBssid(const MlsdbWlanIndexRecord &record)
+{
+    return quint64(qFromLittleEndian(record.bssidHigh)) << 32 | qFromLittleEndian(record.bssidLow);
+}
+
+MlsdbCoords mlsdbWlanIndexRecordCoords(const MlsdbWlanIndexRecord &record)
+{
+    MlsdbCoords coords;
+    coords.lat = qFromLittleEndian(record.lat) / CoordinateScale;
+    coords.lon = qFromLittleEndian(record.lon) / CoordinateScale;
+    return coords;
+}
+
+bool mlsdbWlanIndexRecordLessThan(const MlsdbWlanIndexRecord &lhs, const MlsdbWlanIndexRecord &rhs)
+{
+    return mlsdbWlanIndexRecordBssid(lhs) < mlsdbWlanIndexRecordBssid(rhs);
+}
+
+MlsdbWlanIndex::MlsdbWlanIndex()
+    : m_data(0)
+    , m_records(0)
+    , m_recordCount(0)
+{
+}
+
+MlsdbWlanIndex::~MlsdbWlanIndex()
+{
+    close();
+}
+
+bool MlsdbWlanIndex::open(const QString &fileName)
+{
+    close();
+
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        qDebug() << "geoclue-mlsdb wlan index file" << fileName << "cannot be opened:" << m_file.errorString();
+        return false;
+    }
+
+    const qint64 size = m_file.size();
+    if (size < qint64(sizeof(MlsdbWlanIndexHeader))) {
+        qDebug() << "geoclue-mlsdb wlan index file" << fileName << "is truncated";
+        m_file.close();
+        return false;
+    }
+
+    uchar *data = m_file.map(0, size);
+    if (!data) {
+        qDebug() << "geoclue-mlsdb wlan index file" << fileName << "cannot be mapped:" << m_file.errorString();
+        m_file.close();
+        return false;
+    }
+
+    const MlsdbWlanIndexHeader *header = reinterpret_cast<const MlsdbWlanIndexHeader *>(data);
+    const quint32 magic = qFromLittleEndian(header->magic);
+    const qint32 version = qFromLittleEndian(header->version);
+    const quint32 recordCount = qFromLittleEndian(header->recordCount);
+    if (magic != MLSDB_WLAN_MAGIC) {
+        qDebug() << "geoclue-mlsdb wlan index file" << fileName << "format unknown:" << magic << "expected:" << MLSDB_WLAN_MAGIC;
+    } else if (version != MLSDB_WLAN_VERSION) {
+        qDebug() << "geoclue-mlsdb wlan index file" << fileName << "version unknown:" << version;
+    } else if (size != qint64(sizeof(MlsdbWlanIndexHeader)) + qint64(recordCount) * qint64(sizeof(MlsdbWlanIndexRecord))) {
+        qDebug() << "geoclue-mlsdb wlan index file" << fileName << "size" << size << "does not match record count" << recordCount;
+    } else {
+        m_data = data;
+        m_records = reinterpret_cast<const MlsdbWlanIndexRecord *>(data + sizeof(MlsdbWlanIndexHeader));
+        m_recordCount = recordCount;
+        return true;
+    }
+
+    m_file.unmap(data);
+    m_file.close();
+    return false;
+}
+
+void MlsdbWlanIndex::close()
+{
+    if (m_data) {
+        m_file.unmap(m_data);
+    }
+    m_file.close();
+    m_data = 0;
+    m_records = 0;
+    m_recordCount = 0;
+}
+
+bool MlsdbWlanIndex::find(quint64 bssid, MlsdbCoords *coords) const
+{
+    if (!m_records) {
+        return false;
+    }
+
+    // binary search the sorted records in place.
+    quint32 lower = 0;
+    quint32 upper = m_recordCount;
+    while (lower < upper) {
+        const quint32 middle = lower + (upper - lower) / 2;
+        const quint64 key = mlsdbWlanIndexRecordBssid(m_records[middle]);
+        if (key < bssid) {
+            lower = middle + 1;
+        } else if (key > bssid) {
+            upper = middle;
+        } else {
+            *coords = mlsdbWlanIndexRecordCoords(m_records[middle]);
+            return true;
+        }
+    }
+
+    return false;
+}
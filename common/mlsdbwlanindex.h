@@ -0,0 +1,81 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#ifndef GEOCLUE_MLSDB_WLANINDEX_H
+#define GEOCLUE_MLSDB_WLANINDEX_H
+
+#include <QtCore/QFile>
+#include <QtCore/QString>
+
+#include "mlsdbserialisation.h"
+
+#define MLSDB_WLAN_MAGIC 0x3ac0cdb
+#define MLSDB_WLAN_VERSION 1
+
+/*
+ * The "wlan" index format stores the locations of WLAN access points,
+ * keyed by their 48-bit BSSID, as an array of fixed-size records sorted
+ * by BSSID, so that like the version 4 cell index it can be mapped into
+ * memory and binary-searched in place.
+ *
+ * All fields are little-endian.  Coordinates are stored as degrees * 1e7.
+ */
+
+struct MlsdbWlanIndexHeader {
+    quint32 magic;       // MLSDB_WLAN_MAGIC
+    qint32 version;      // MLSDB_WLAN_VERSION
+    quint32 recordCount;
+    quint32 reserved;
+};
+Q_DECLARE_TYPEINFO(MlsdbWlanIndexHeader, Q_PRIMITIVE_TYPE);
+
+struct MlsdbWlanIndexRecord {
+    quint32 bssidLow;     // the low 32 bits of the BSSID
+    quint16 bssidHigh;    // the high 16 bits of the BSSID
+    quint16 reserved;
+    qint32 lat;
+    qint32 lon;
+};
+Q_DECLARE_TYPEINFO(MlsdbWlanIndexRecord, Q_PRIMITIVE_TYPE);
+
+Q_STATIC_ASSERT(sizeof(MlsdbWlanIndexHeader) == 16);
+Q_STATIC_ASSERT(sizeof(MlsdbWlanIndexRecord) == 16);
+
+MlsdbWlanIndexHeader mlsdbWlanIndexHeader(quint32 recordCount);
+MlsdbWlanIndexRecord mlsdbWlanIndexRecord(quint64 bssid, const MlsdbCoords &coords);
+quint64 mlsdbWlanIndexRecordBssid(const MlsdbWlanIndexRecord &record);
+MlsdbCoords mlsdbWlanIndexRecordCoords(const MlsdbWlanIndexRecord &record);
+bool mlsdbWlanIndexRecordLessThan(const MlsdbWlanIndexRecord &lhs, const MlsdbWlanIndexRecord &rhs);
+
+class MlsdbWlanIndex
+{
+public:
+    MlsdbWlanIndex();
+    ~MlsdbWlanIndex();
+
+    bool open(const QString &fileName);
+    void close();
+    bool isOpen() const { return m_records != 0; }
+
+    QString fileName() const { return m_file.fileName(); }
+    quint32 recordCount() const { return m_recordCount; }
+    const MlsdbWlanIndexRecord *records() const { return m_records; }
+
+    bool find(quint64 bssid, MlsdbCoords *coords) const;
+
+private:
+    Q_DISABLE_COPY(MlsdbWlanIndex)
+
+    QFile m_file;
+    uchar *m_data;
+    const MlsdbWlanIndexRecord *m_records;
+    quint32 m_recordCount;
+};
+
+#endif // GEOCLUE_MLSDB_WLANINDEX_H
@@ -0,0 +1,166 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include "cellestimate.h"
+#include "providerclock.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QMap>
+
+#include <cmath>
+
+namespace {
+    const int MinimumCalculatedAccuracy = 2500; // 2500 metres - arbitrary but large, manual cell-based triangulation is error-prone.
+    const int MinimumAccessPoints = 2;
+    const double MinimumAccessPointAccuracy = 50.0; // metres, about the range of an access point indoors
+    const double MaximumAccessPointDistance = 500.0; // metres from the others, beyond which an access point has probably moved
+    const double MetresPerDegree = 6371000.0 * M_PI / 180.0;
+
+    struct LocatedAccessPoint {
+        MlsdbCoords coords;
+        double weight;
+    };
+
+    MlsdbCoords weightedCentroid(const QVector<LocatedAccessPoint> &located)
+    {
+        MlsdbCoords centroid;
+        centroid.lat = 0.0;
+        centroid.lon = 0.0;
+        double totalWeight = 0.0;
+        Q_FOREACH (const LocatedAccessPoint &accessPoint, located) {
+            centroid.lat += accessPoint.weight * accessPoint.coords.lat;
+            centroid.lon += accessPoint.weight * accessPoint.coords.lon;
+            totalWeight += accessPoint.weight;
+        }
+        centroid.lat /= totalWeight;
+        centroid.lon /= totalWeight;
+        return centroid;
+    }
+
+    double distance(const MlsdbCoords &from, const MlsdbCoords &to)
+    {
+        // flat earth, good enough over the range of a few access points.
+        const double north = (to.lat - from.lat) * MetresPerDegree;
+        const double east = (to.lon - from.lon) * MetresPerDegree * std::cos(from.lat * M_PI / 180.0);
+        return std::sqrt(north * north + east * east);
+    }
+}
+
+Location estimateLocationFromCells(const QVector<ObservedCell> &cells, const CellLocationCache &cache)
+{
+    // determine which cells we have an accurate location for, from MLSDB data.
+    double totalSignalStrength = 0.0;
+    QMap<MlsdbUniqueCellId, MlsdbCoords> cellLocations;
+    Q_FOREACH (const ObservedCell &cell, cells) {
+        MlsdbCoords cellCoords;
+        if (cache.peek(cell.uniqueCellId, &cellCoords) != CellLocationCache::Located) {
+            // we know that we don't know the location of this cellId.  Skip it.
+            continue;
+        }
+        // we have a known location for this cell.  Update our locations list.
+        cellLocations.insert(cell.uniqueCellId, cellCoords);
+        totalSignalStrength += (1.0 * cell.signalStrength);
+    }
+
+    if (cellLocations.size() == 0) {
+        qDebug() << "no cell id data to calculate position from";
+        return Location();
+    } else if (cellLocations.size() == 1) {
+        qDebug() << "only one cell id datum to calculate position from, position will be extremely inaccurate";
+    } else if (cellLocations.size() == 2) {
+        qDebug() << "only two cell id data to calculate position from, position will be highly inaccurate";
+    } else {
+        qDebug() << "calculating position from" << cellLocations.size() << "cell id data";
+    }
+
+    // now use the current cell and neighboringcell information to triangulate our position.
+    double deviceLatitude = 0.0;
+    double deviceLongitude = 0.0;
+    Q_FOREACH (const ObservedCell &cell, cells) {
+        if (cellLocations.contains(cell.uniqueCellId)) {
+            const MlsdbCoords &cellCoords(cellLocations.value(cell.uniqueCellId));
+            double weight = (((double)cell.signalStrength) / totalSignalStrength);
+            deviceLatitude += (weight * cellCoords.lat);
+            deviceLongitude += (weight * cellCoords.lon);
+            qDebug() << "have cell:" << cell.uniqueCellId.toString()
+                                            << "with position:" << cellCoords.lat << "," << cellCoords.lon
+                                            << "with strength:" << ((double)cell.signalStrength / totalSignalStrength);
+        } else {
+            qDebug() << "do not know position of cell with id:" << cell.uniqueCellId.toString();
+        }
+    }
+
+    // estimate accuracy based on how many cells we have.
+    Accuracy positionAccuracy;
+    positionAccuracy.setHorizontal(qMax(MinimumCalculatedAccuracy,
+                                        10000 - (1000 * cellLocations.size())));
+
+    Location deviceLocation;
+    deviceLocation.setTimestamp(ProviderClock::currentMSecsSinceEpoch());
+    deviceLocation.setLatitude(deviceLatitude);
+    deviceLocation.setLongitude(deviceLongitude);
+    deviceLocation.setAccuracy(positionAccuracy);
+    return deviceLocation;
+
+}
+
+Location estimateLocationFromAccessPoints(const QVector<ObservedAccessPoint> &accessPoints,
+                                          const QHash<quint64, MlsdbCoords> &locations)
+{
+    QVector<LocatedAccessPoint> located;
+    Q_FOREACH (const ObservedAccessPoint &accessPoint, accessPoints) {
+        QHash<quint64, MlsdbCoords>::const_iterator it = locations.constFind(accessPoint.bssid);
+        if (it != locations.constEnd()) {
+            LocatedAccessPoint entry;
+            entry.coords = it.value();
+            entry.weight = qMax<quint16>(accessPoint.strength, 1);
+            located.append(entry);
+        }
+    }
+    if (located.size() < MinimumAccessPoints) {
+        qDebug() << "only" << located.size() << "located access points, not calculating position from them";
+        return Location();
+    }
+
+    // drop the access points which are far from the rest, then locate the device from what is left.
+    MlsdbCoords centroid = weightedCentroid(located);
+    if (located.size() > MinimumAccessPoints) {
+        QVector<LocatedAccessPoint> consistent;
+        Q_FOREACH (const LocatedAccessPoint &accessPoint, located) {
+            if (distance(centroid, accessPoint.coords) <= MaximumAccessPointDistance) {
+                consistent.append(accessPoint);
+            }
+        }
+        if (consistent.size() >= MinimumAccessPoints && consistent.size() < located.size()) {
+            qDebug() << "ignoring" << located.size() - consistent.size() << "access points far from the others";
+            located = consistent;
+            centroid = weightedCentroid(located);
+        }
+    }
+
+    // the accuracy is the weighted spread of the access points around the estimate.
+    double spread = 0.0;
+    double totalWeight = 0.0;
+    Q_FOREACH (const LocatedAccessPoint &accessPoint, located) {
+        const double d = distance(centroid, accessPoint.coords);
+        spread += accessPoint.weight * d * d;
+        totalWeight += accessPoint.weight;
+    }
+    qDebug() << "calculating position from" << located.size() << "access points";
+
+    Accuracy positionAccuracy;
+    positionAccuracy.setHorizontal(qMax(MinimumAccessPointAccuracy, std::sqrt(spread / totalWeight)));
+
+    Location deviceLocation;
+    deviceLocation.setTimestamp(ProviderClock::currentMSecsSinceEpoch());
+    deviceLocation.setLatitude(centroid.lat);
+    deviceLocation.setLongitude(centroid.lon);
+    deviceLocation.setAccuracy(positionAccuracy);
+    return deviceLocation;
+}
@@ -0,0 +1,42 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#ifndef CELLESTIMATE_H
+#define CELLESTIMATE_H
+
+#include <QtCore/QHash>
+#include <QtCore/QVector>
+
+#include "locationtypes.h"
+#include "observation.h"
+#include "celllocationcache.h"
+
+/*
+ * Estimates the device location from the cells it observes, as the
+ * signal strength weighted centroid of the cells whose location is in
+ * the cache, which is only peeked at: the lookups were already counted
+ * when the cells were searched for.  The accuracy is a rough guess from the number of located
+ * cells.  Returns a location with a zero timestamp if none of the cells
+ * is located.
+ */
+
+Location estimateLocationFromCells(const QVector<ObservedCell> &cells, const CellLocationCache &cache);
+
+/*
+ * Estimates the device location from the WLAN access points it observes,
+ * as the signal strength weighted centroid of those whose location is
+ * known, after dropping any which are far from the others (moved access
+ * points are common).  Needs at least two located access points, and
+ * returns a location with a zero timestamp otherwise.
+ */
+
+Location estimateLocationFromAccessPoints(const QVector<ObservedAccessPoint> &accessPoints,
+                                          const QHash<quint64, MlsdbCoords> &locations);
+
+#endif // CELLESTIMATE_H
@@ -0,0 +1,315 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include "celllocationcache.h"
+
+#include <QtCore/QDataStream>
+#include <QtCore/QDateTime>
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSaveFile>
+#include <QtCore/QStandardPaths>
+
+namespace {
+    const quint32 CacheFileMagic = 0x79636c63;            // "yclc"
+    const qint32 CacheFileVersion = 1;
+    const qint64 OnlineEntryLifetime = 30LL * 24 * 60 * 60 * 1000; // 30 days, online results may change as the service learns
+    const qint64 UnlocatableEntryLifetime = 24LL * 60 * 60 * 1000; // 24 hours, the cell may become locatable from learned data
+
+    inline int slotCountFor(int maximumEntries)
+    {
+        // keep the load factor at or below one half, to keep probe sequences short.
+        int count = 16;
+        while (count < 2 * maximumEntries) {
+            count *= 2;
+        }
+        return count;
+    }
+}
+
+CellLocationCache::CellLocationCache(int maximumEntries)
+    : m_mask(0)
+    , m_size(0)
+    , m_maximumEntries(qMax(1, maximumEntries))
+    , m_clockHand(0)
+    , m_dirty(false)
+{
+}
+
+int CellLocationCache::findSlot(const MlsdbUniqueCellId &uniqueCellId) const
+{
+    if (m_slots.isEmpty()) {
+        return -1;
+    }
+
+    const Slot *slots = m_slots.constData();
+    int index = qHash(uniqueCellId) & m_mask;
+    while (slots[index].state != EmptySlot) {
+        if (slots[index].key == uniqueCellId) {
+            return index;
+        }
+        index = (index + 1) & m_mask;
+    }
+    return -1;
+}
+
+void CellLocationCache::insert(const MlsdbUniqueCellId &uniqueCellId, const MlsdbCoords &coords, qint64 expiry, SlotState state)
+{
+    if (m_slots.isEmpty()) {
+        const int count = slotCountFor(m_maximumEntries);
+        Slot empty;
+        empty.coords.lat = 0.0;
+        empty.coords.lon = 0.0;
+        empty.expiry = 0;
+        empty.state = EmptySlot;
+        empty.referenced = 0;
+        m_slots.fill(empty, count);
+        m_mask = count - 1;
+        m_clockHand = 0;
+    }
+
+    int index = findSlot(uniqueCellId);
+    if (index < 0) {
+        if (m_size >= m_maximumEntries) {
+            evictOne();
+        }
+        index = qHash(uniqueCellId) & m_mask;
+        while (m_slots.at(index).state != EmptySlot) {
+            index = (index + 1) & m_mask;
+        }
+        ++m_size;
+    }
+
+    Slot &slot(m_slots[index]);
+    slot.key = uniqueCellId;
+    slot.coords = coords;
+    slot.expiry = expiry;
+    slot.state = state;
+    slot.referenced = 1;
+    m_dirty = true;
+}
+
+void CellLocationCache::removeSlot(int index)
+{
+    // backward-shift deletion: move later entries of the probe sequence
+    // into the hole, so that no tombstones are needed.
+    Slot *slots = m_slots.data();
+    slots[index].state = EmptySlot;
+    --m_size;
+
+    int hole = index;
+    int next = (hole + 1) & m_mask;
+    while (slots[next].state != EmptySlot) {
+        const int home = qHash(slots[next].key) & m_mask;
+        const bool reachable = hole <= next
+                             ? (home > hole && home <= next)
+                             : (home > hole || home <= next);
+        if (!reachable) {
+            slots[hole] = slots[next];
+            slots[next].state = EmptySlot;
+            hole = next;
+        }
+        next = (next + 1) & m_mask;
+    }
+}
+
+void CellLocationCache::evictOne()
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for (int steps = 0; steps < 2 * m_slots.size(); ++steps) {
+        Slot &slot(m_slots[m_clockHand]);
+        if (slot.state != EmptySlot) {
+            if (slot.expiry != 0 && slot.expiry < now) {
+                removeSlot(m_clockHand);
+                m_statistics.expirations += 1;
+                return;
+            }
+            if (!slot.referenced) {
+                removeSlot(m_clockHand);
+                m_statistics.evictions += 1;
+                return;
+            }
+            slot.referenced = 0; // second chance.
+        }
+        m_clockHand = (m_clockHand + 1) & m_mask;
+    }
+}
+
+CellLocationCache::LookupResult CellLocationCache::lookup(const MlsdbUniqueCellId &uniqueCellId, MlsdbCoords *coords)
+{
+    const int index = findSlot(uniqueCellId);
+    if (index < 0) {
+        m_statistics.misses += 1;
+        return Unknown;
+    }
+
+    Slot &slot(m_slots[index]);
+    if (slot.expiry != 0 && slot.expiry < QDateTime::currentMSecsSinceEpoch()) {
+        removeSlot(index);
+        m_statistics.expirations += 1;
+        m_statistics.misses += 1;
+        m_dirty = true;
+        return Unknown;
+    }
+
+    m_statistics.hits += 1;
+    slot.referenced = 1;
+    if (slot.state == UnlocatableSlot) {
+        return Unlocatable;
+    }
+    *coords = slot.coords;
+    return Located;
+}
+
+CellLocationCache::LookupResult CellLocationCache::peek(const MlsdbUniqueCellId &uniqueCellId, MlsdbCoords *coords) const
+{
+    const int index = findSlot(uniqueCellId);
+    if (index < 0) {
+        return Unknown;
+    }
+
+    const Slot &slot(m_slots.at(index));
+    if (slot.expiry != 0 && slot.expiry < QDateTime::currentMSecsSinceEpoch()) {
+        return Unknown; // removed by the next lookup().
+    }
+    if (slot.state == UnlocatableSlot) {
+        return Unlocatable;
+    }
+    *coords = slot.coords;
+    return Located;
+}
+
+void CellLocationCache::insertLocation(const MlsdbUniqueCellId &uniqueCellId, const MlsdbCoords &coords, Source source)
+{
+    const qint64 expiry = source == OnlineSource ? QDateTime::currentMSecsSinceEpoch() + OnlineEntryLifetime : 0;
+    insert(uniqueCellId, coords, expiry, LocatedSlot);
+}
+
+void CellLocationCache::insertUnlocatable(const MlsdbUniqueCellId &uniqueCellId)
+{
+    MlsdbCoords coords;
+    coords.lat = 0.0;
+    coords.lon = 0.0;
+    insert(uniqueCellId, coords, QDateTime::currentMSecsSinceEpoch() + UnlocatableEntryLifetime, UnlocatableSlot);
+}
+
+void CellLocationCache::clear()
+{
+    m_dirty = m_size != 0;
+    m_slots.clear();
+    m_mask = 0;
+    m_size = 0;
+    m_clockHand = 0;
+}
+
+void CellLocationCache::setMaximumEntries(int maximumEntries)
+{
+    maximumEntries = qMax(1, maximumEntries);
+    if (maximumEntries == m_maximumEntries) {
+        return;
+    }
+
+    const QVector<Slot> slots = m_slots;
+    clear();
+    m_maximumEntries = maximumEntries;
+    Q_FOREACH (const Slot &slot, slots) {
+        if (slot.state != EmptySlot) {
+            insert(slot.key, slot.coords, slot.expiry, static_cast<SlotState>(slot.state));
+        }
+    }
+}
+
+QString CellLocationCache::defaultFileName()
+{
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).filePath(QStringLiteral("cells.cache"));
+}
+
+bool CellLocationCache::load(const QString &fileName, quint32 dataVersion)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+    quint32 magic = 0, fileDataVersion = 0;
+    qint32 version = 0;
+    in >> magic >> version >> fileDataVersion;
+    if (magic != CacheFileMagic || version != CacheFileVersion) {
+        qDebug() << "cell location cache" << fileName << "format unknown, ignoring";
+        return false;
+    }
+    if (fileDataVersion != dataVersion) {
+        qDebug() << "cell location cache" << fileName << "was built for different mlsdb data, ignoring";
+        return false;
+    }
+
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    quint32 count = 0;
+    in >> count;
+    QVector<Slot> entries;
+    entries.reserve(qMin<quint32>(count, m_maximumEntries));
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        Slot entry;
+        bool located = false;
+        in >> entry.key >> entry.coords >> entry.expiry >> located;
+        entry.state = located ? LocatedSlot : UnlocatableSlot;
+        if (entry.expiry == 0 || entry.expiry >= now) {
+            entries.append(entry);
+        }
+    }
+    if (in.status() != QDataStream::Ok) {
+        qDebug() << "cell location cache" << fileName << "is truncated, ignoring";
+        return false;
+    }
+
+    // entries looked up in this process so far are newer than the saved ones.
+    const bool dirty = m_dirty;
+    Q_FOREACH (const Slot &entry, entries) {
+        if (m_size >= m_maximumEntries) {
+            break;
+        }
+        if (findSlot(entry.key) < 0) {
+            insert(entry.key, entry.coords, entry.expiry, static_cast<SlotState>(entry.state));
+        }
+    }
+    m_dirty = dirty;
+
+    qDebug() << "loaded" << m_size << "cell location cache entries from" << fileName;
+    return true;
+}
+
+bool CellLocationCache::save(const QString &fileName, quint32 dataVersion)
+{
+    QDir().mkpath(QFileInfo(fileName).path());
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "cannot write cell location cache" << fileName << ":" << file.errorString();
+        return false;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << CacheFileMagic << CacheFileVersion << dataVersion << quint32(m_size);
+    Q_FOREACH (const Slot &slot, m_slots) {
+        if (slot.state != EmptySlot) {
+            out << slot.key << slot.coords << slot.expiry << bool(slot.state == LocatedSlot);
+        }
+    }
+
+    if (!file.commit()) {
+        qDebug() << "cannot write cell location cache" << fileName << ":" << file.errorString();
+        return false;
+    }
+    m_dirty = false;
+    return true;
+}
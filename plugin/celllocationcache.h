@@ -0,0 +1,108 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#ifndef CELLLOCATIONCACHE_H
+#define CELLLOCATIONCACHE_H
+
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+#include "mlsdbserialisation.h"
+
+/*
+ * The CellLocationCache class remembers the results of cell location
+ * lookups, both the cells whose location is known and those which are
+ * known to have no location data.
+ *
+ * Entries are kept in a flat, open-addressed hash table holding at most
+ * maximumEntries() entries.  When it is full, entries which have not
+ * been used recently are evicted (CLOCK replacement).  This class is not
+ * thread-safe.
+ *
+ * The cache can be saved to and loaded from a file, so that it survives
+ * the provider process idling out.  The file is tagged with the version
+ * of the mlsdb data the lookups were made against, and is discarded if
+ * that data has since changed.  Locations which did not come from the
+ * mlsdb data, and cells found to have no location, expire after a while.
+ */
+
+class CellLocationCache
+{
+public:
+    enum Source {
+        OfflineSource,
+        OnlineSource
+    };
+
+    enum LookupResult {
+        Unknown,     // never looked up, evicted, or expired
+        Located,
+        Unlocatable  // looked up, but no location data exists
+    };
+
+    struct Statistics {
+        Statistics() : hits(0), misses(0), evictions(0), expirations(0) {}
+        quint64 hits;
+        quint64 misses;
+        quint64 evictions;
+        quint64 expirations;
+    };
+
+    explicit CellLocationCache(int maximumEntries = DefaultMaximumEntries);
+
+    LookupResult lookup(const MlsdbUniqueCellId &uniqueCellId, MlsdbCoords *coords);
+    // as lookup(), but neither counted in the statistics nor marking the entry as used.
+    LookupResult peek(const MlsdbUniqueCellId &uniqueCellId, MlsdbCoords *coords) const;
+    void insertLocation(const MlsdbUniqueCellId &uniqueCellId, const MlsdbCoords &coords, Source source);
+    void insertUnlocatable(const MlsdbUniqueCellId &uniqueCellId);
+    void clear();
+
+    int size() const { return m_size; }
+    int maximumEntries() const { return m_maximumEntries; }
+    void setMaximumEntries(int maximumEntries);
+    bool isDirty() const { return m_dirty; }
+    Statistics statistics() const { return m_statistics; }
+
+    bool load(const QString &fileName, quint32 dataVersion);
+    bool save(const QString &fileName, quint32 dataVersion);
+
+    static QString defaultFileName();
+
+    static const int DefaultMaximumEntries = 2048;
+
+private:
+    enum SlotState {
+        EmptySlot = 0,
+        LocatedSlot,
+        UnlocatableSlot
+    };
+
+    struct Slot {
+        MlsdbUniqueCellId key;
+        MlsdbCoords coords;
+        qint64 expiry;   // msecs since epoch, or 0 if the entry never expires
+        quint8 state;    // SlotState
+        quint8 referenced;
+    };
+
+    int findSlot(const MlsdbUniqueCellId &uniqueCellId) const;
+    void insert(const MlsdbUniqueCellId &uniqueCellId, const MlsdbCoords &coords, qint64 expiry, SlotState state);
+    void removeSlot(int index);
+    void evictOne();
+
+    QVector<Slot> m_slots;
+    int m_mask;
+    int m_size;
+    int m_maximumEntries;
+    int m_clockHand;
+    Statistics m_statistics;
+    bool m_dirty;
+};
+
+#endif // CELLLOCATIONCACHE_H
@@ -0,0 +1,274 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include "learnedcellstore.h"
+
+#include <QtCore/QDataStream>
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QPair>
+#include <QtCore/QSaveFile>
+#include <QtCore/QStandardPaths>
+#include <QtCore/QtNumeric>
+
+#include <algorithm>
+
+namespace {
+    const quint32 IndexFileMagic = 0x796c6369;   // "ylci"
+    const quint32 LogFileMagic = 0x796c636c;     // "ylcl"
+    const qint32 FileVersion = 1;
+    const QString IndexFileName = QStringLiteral("learned-cells.index");
+    const QString LogFileName = QStringLiteral("learned-cells.log");
+
+    const double MaximumLearningAccuracy = 1000.0; // metres, coarser fixes say too little about where a cell is
+    const double ReferenceAccuracy = 100.0;        // metres, a fix this accurate has weight one
+    const double MaximumWeight = 100.0;            // so that a cell which moves is relearned eventually
+    const quint32 MinimumObservations = 2;         // a single fix may be far from the cell
+    const int CompactionThreshold = 1024;          // log records, before they are folded into the index
+}
+
+LearnedCellStore::LearnedCellStore(int maximumCells)
+    : m_generation(0)
+    , m_logRecords(0)
+    , m_maximumCells(qMax(0, maximumCells))
+{
+}
+
+QString LearnedCellStore::defaultDirectory()
+{
+    // learned locations are not a cache, they cannot be looked up again.
+    return QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation);
+}
+
+void LearnedCellStore::setMaximumCells(int maximumCells)
+{
+    maximumCells = qMax(0, maximumCells);
+    if (maximumCells == m_maximumCells) {
+        return;
+    }
+    m_maximumCells = maximumCells;
+    if (m_cells.size() > m_maximumCells) {
+        compact();
+    }
+}
+
+bool LearnedCellStore::open(const QString &directory)
+{
+    m_cells.clear();
+    m_generation = 0;
+    m_logRecords = 0;
+    m_indexFileName = QDir(directory).filePath(IndexFileName);
+    m_logFileName = QDir(directory).filePath(LogFileName);
+
+    const bool indexLoaded = loadIndex();
+    loadLog();
+    if (m_cells.size() > m_maximumCells) {
+        compact();
+    }
+    qDebug() << "loaded" << m_cells.size() << "learned cells," << m_logRecords << "fixes not yet compacted";
+    return indexLoaded || m_logRecords > 0;
+}
+
+bool LearnedCellStore::loadIndex()
+{
+    QFile file(m_indexFileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+    quint32 magic = 0, generation = 0, count = 0;
+    qint32 version = 0;
+    in >> magic >> version >> generation >> count;
+    if (magic != IndexFileMagic || version != FileVersion) {
+        qDebug() << "learned cell index" << m_indexFileName << "format unknown, ignoring";
+        return false;
+    }
+
+    QHash<MlsdbUniqueCellId, Entry> cells;
+    cells.reserve(qMin<quint32>(count, m_maximumCells));
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        MlsdbUniqueCellId uniqueCellId;
+        Entry entry;
+        in >> uniqueCellId >> entry.weight >> entry.latitude >> entry.longitude
+           >> entry.observations >> entry.lastSeen;
+        cells.insert(uniqueCellId, entry);
+    }
+    if (in.status() != QDataStream::Ok) {
+        qDebug() << "learned cell index" << m_indexFileName << "is truncated, ignoring";
+        return false;
+    }
+
+    m_cells = cells;
+    m_generation = generation;
+    return true;
+}
+
+void LearnedCellStore::loadLog()
+{
+    QFile file(m_logFileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+    quint32 magic = 0, generation = 0;
+    qint32 version = 0;
+    in >> magic >> version >> generation;
+    if (magic != LogFileMagic || version != FileVersion || generation != m_generation) {
+        // the fixes are already in the index, or cannot be read.
+        qDebug() << "learned cell log" << m_logFileName << "is stale, discarding";
+        file.close();
+        QFile::remove(m_logFileName);
+        return;
+    }
+
+    qint64 end = file.pos();
+    Q_FOREVER {
+        MlsdbUniqueCellId uniqueCellId;
+        double latitude = 0, longitude = 0, weight = 0;
+        qint64 timestamp = 0;
+        in >> uniqueCellId >> latitude >> longitude >> weight >> timestamp;
+        if (in.status() != QDataStream::Ok) {
+            break;
+        }
+        apply(uniqueCellId, latitude, longitude, weight, timestamp);
+        ++m_logRecords;
+        end = file.pos();
+    }
+
+    if (end < file.size()) {
+        // the last record was cut short, drop it so that new records can be read back.
+        qDebug() << "learned cell log" << m_logFileName << "ends in a partial record, truncating";
+        file.close();
+        QFile::resize(m_logFileName, end);
+    }
+}
+
+bool LearnedCellStore::lookup(const MlsdbUniqueCellId &uniqueCellId, MlsdbCoords *coords) const
+{
+    QHash<MlsdbUniqueCellId, Entry>::const_iterator it = m_cells.constFind(uniqueCellId);
+    if (it == m_cells.constEnd() || it->observations < MinimumObservations) {
+        return false;
+    }
+    coords->lat = it->latitude;
+    coords->lon = it->longitude;
+    return true;
+}
+
+void LearnedCellStore::apply(const MlsdbUniqueCellId &uniqueCellId, double latitude, double longitude,
+                             double weight, qint64 timestamp)
+{
+    QHash<MlsdbUniqueCellId, Entry>::iterator it = m_cells.find(uniqueCellId);
+    if (it == m_cells.end()) {
+        Entry entry;
+        entry.weight = qMin(weight, MaximumWeight);
+        entry.latitude = latitude;
+        entry.longitude = longitude;
+        entry.observations = 1;
+        entry.lastSeen = timestamp;
+        m_cells.insert(uniqueCellId, entry);
+        return;
+    }
+
+    // an incremental weighted mean, which becomes a moving average once the weight is capped.
+    Entry &entry(it.value());
+    const double total = entry.weight + weight;
+    entry.latitude += (latitude - entry.latitude) * weight / total;
+    entry.longitude += (longitude - entry.longitude) * weight / total;
+    entry.weight = qMin(total, MaximumWeight);
+    entry.observations += 1;
+    entry.lastSeen = qMax(entry.lastSeen, timestamp);
+}
+
+void LearnedCellStore::learn(const QVector<ObservedCell> &cells, double latitude, double longitude,
+                             double accuracy, qint64 timestamp)
+{
+    if (m_maximumCells == 0 || cells.isEmpty() || qIsNaN(accuracy) || accuracy <= 0
+            || accuracy > MaximumLearningAccuracy) {
+        return;
+    }
+
+    const double weight = ReferenceAccuracy * ReferenceAccuracy / qMax(1.0, accuracy * accuracy);
+    Q_FOREACH (const ObservedCell &cell, cells) {
+        apply(cell.uniqueCellId, latitude, longitude, weight, timestamp);
+    }
+
+    if (!m_logFileName.isEmpty()) {
+        QDir().mkpath(QFileInfo(m_logFileName).path());
+        QFile file(m_logFileName);
+        if (file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+            QDataStream out(&file);
+            out.setVersion(QDataStream::Qt_5_0);
+            if (file.size() == 0) {
+                out << LogFileMagic << FileVersion << m_generation;
+            }
+            Q_FOREACH (const ObservedCell &cell, cells) {
+                out << cell.uniqueCellId << latitude << longitude << weight << timestamp;
+            }
+            m_logRecords += cells.size();
+        } else {
+            qDebug() << "cannot append to learned cell log" << m_logFileName << ":" << file.errorString();
+        }
+    }
+
+    if (m_logRecords >= CompactionThreshold || m_cells.size() > 2 * m_maximumCells) {
+        compact();
+    }
+}
+
+bool LearnedCellStore::compact()
+{
+    if (m_cells.size() > m_maximumCells) {
+        // forget the cells which have not been seen for the longest.
+        QVector<QPair<qint64, MlsdbUniqueCellId> > byLastSeen;
+        byLastSeen.reserve(m_cells.size());
+        for (QHash<MlsdbUniqueCellId, Entry>::const_iterator it = m_cells.constBegin(); it != m_cells.constEnd(); ++it) {
+            byLastSeen.append(qMakePair(it->lastSeen, it.key()));
+        }
+        const int excess = m_cells.size() - m_maximumCells;
+        std::nth_element(byLastSeen.begin(), byLastSeen.begin() + excess, byLastSeen.end());
+        for (int i = 0; i < excess; ++i) {
+            m_cells.remove(byLastSeen.at(i).second);
+        }
+    }
+
+    if (m_indexFileName.isEmpty()) {
+        m_logRecords = 0;
+        return true;
+    }
+
+    QDir().mkpath(QFileInfo(m_indexFileName).path());
+    QSaveFile index(m_indexFileName);
+    if (!index.open(QIODevice::WriteOnly)) {
+        qDebug() << "cannot write learned cell index" << m_indexFileName << ":" << index.errorString();
+        return false;
+    }
+    QDataStream out(&index);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << IndexFileMagic << FileVersion << quint32(m_generation + 1) << quint32(m_cells.size());
+    for (QHash<MlsdbUniqueCellId, Entry>::const_iterator it = m_cells.constBegin(); it != m_cells.constEnd(); ++it) {
+        out << it.key() << it->weight << it->latitude << it->longitude << it->observations << it->lastSeen;
+    }
+    if (!index.commit()) {
+        qDebug() << "cannot write learned cell index" << m_indexFileName << ":" << index.errorString();
+        return false;
+    }
+
+    // the log of the previous generation is now stale, even if removing it fails.
+    m_generation += 1;
+    m_logRecords = 0;
+    QFile::remove(m_logFileName);
+    qDebug() << "compacted" << m_cells.size() << "learned cells into" << m_indexFileName;
+    return true;
+}
@@ -0,0 +1,77 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#ifndef LEARNEDCELLSTORE_H
+#define LEARNEDCELLSTORE_H
+
+#include <QtCore/QHash>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+#include "mlsdbserialisation.h"
+#include "observation.h"
+
+/*
+ * The LearnedCellStore class estimates the locations of cells from the
+ * online fixes made while they were visible, so that cells which are
+ * missing from the installed mlsdb data can be located offline.  A
+ * cell's location is the mean of those fixes, weighted by accuracy, and
+ * is only used once it has been seen in a few of them.
+ *
+ * The store is a compacted index of every learned cell, plus an
+ * append-only log of the fixes learned since the index was written.
+ * Each fix only appends to the log.  Once the log grows long enough it
+ * is folded into a new index, dropping the cells which have not been
+ * seen for the longest if the store is full.  A store which was never
+ * opened is kept in memory only.  This class is not thread-safe.
+ */
+
+class LearnedCellStore
+{
+public:
+    explicit LearnedCellStore(int maximumCells = DefaultMaximumCells);
+
+    bool open(const QString &directory);
+
+    bool lookup(const MlsdbUniqueCellId &uniqueCellId, MlsdbCoords *coords) const;
+    void learn(const QVector<ObservedCell> &cells, double latitude, double longitude,
+               double accuracy, qint64 timestamp);
+    bool compact();
+
+    int size() const { return m_cells.size(); }
+    int maximumCells() const { return m_maximumCells; }
+    void setMaximumCells(int maximumCells);
+
+    static QString defaultDirectory();
+
+    static const int DefaultMaximumCells = 4096;
+
+private:
+    struct Entry {
+        double weight;
+        double latitude;
+        double longitude;
+        quint32 observations;
+        qint64 lastSeen; // msecs since epoch
+    };
+
+    void apply(const MlsdbUniqueCellId &uniqueCellId, double latitude, double longitude,
+               double weight, qint64 timestamp);
+    bool loadIndex();
+    void loadLog();
+
+    QHash<MlsdbUniqueCellId, Entry> m_cells;
+    QString m_indexFileName; // empty if the store is in memory only
+    QString m_logFileName;
+    quint32 m_generation; // of the index, the log records which fixes it does not yet hold
+    int m_logRecords;
+    int m_maximumCells;
+};
+
+#endif // LEARNEDCELLSTORE_H
@@ -0,0 +1,100 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include "locationsettings.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QFile>
+#include <QtCore/QSettings>
+#include <QtCore/QStringList>
+
+namespace {
+    const int DebounceInterval = 250; // 250ms, settings writes settle well within this
+    const QString LocationSettingsDir = QStringLiteral("/etc/location/");
+    const QString LocationSettingsFile = QStringLiteral("/etc/location/location.conf");
+    const QString LocationSettingsEnabledKey = QStringLiteral("location/enabled");
+    const QString LocationSettingsMlsEnabledKey = QStringLiteral("location/mls/enabled");
+    const QString LocationSettingsMlsOnlineEnabledKey = QStringLiteral("location/mls/online_enabled");
+    const QString LocationSettingsOldMlsEnabledKey = QStringLiteral("location/cell_id_positioning_enabled"); // deprecated key
+    const QString LocationSettingsDataSourceOnlineAllowedKey = QStringLiteral("location/allowed_data_sources/online");
+    const QString LocationSettingsDataSourceCellDataAllowedKey = QStringLiteral("location/allowed_data_sources/cell_data");
+    const QString LocationSettingsDataSourceWlanDataAllowedKey = QStringLiteral("location/allowed_data_sources/wlan_data");
+}
+
+LocationSettings::LocationSettings(QObject *parent)
+    : QObject(parent)
+{
+    m_debounceTimer.setSingleShot(true);
+    m_debounceTimer.setInterval(DebounceInterval);
+    connect(&m_debounceTimer, &QTimer::timeout,
+            this, &LocationSettings::reload);
+    connect(&m_watcher, &QFileSystemWatcher::fileChanged,
+            this, &LocationSettings::scheduleReload);
+    connect(&m_watcher, &QFileSystemWatcher::directoryChanged,
+            this, &LocationSettings::scheduleReload);
+}
+
+LocationSettings::~LocationSettings()
+{
+}
+
+void LocationSettings::start()
+{
+    // the first snapshot is read right away, the caller acts on it directly.
+    m_watcher.addPath(LocationSettingsDir);
+    m_watcher.addPath(LocationSettingsFile);
+    m_snapshot = read();
+}
+
+LocationSettingsSnapshot LocationSettings::snapshot() const
+{
+    return m_snapshot;
+}
+
+void LocationSettings::scheduleReload()
+{
+    m_debounceTimer.start();
+}
+
+void LocationSettings::reload()
+{
+    // the file is dropped from the watcher if it was replaced rather than written.
+    if (!m_watcher.files().contains(LocationSettingsFile) && QFile::exists(LocationSettingsFile)) {
+        m_watcher.addPath(LocationSettingsFile);
+    }
+
+    const LocationSettingsSnapshot snapshot = read();
+    if (snapshot == m_snapshot) {
+        qDebug() << "location settings file changed, but no relevant settings did";
+        return;
+    }
+
+    m_snapshot = snapshot;
+    emit changed();
+}
+
+LocationSettingsSnapshot LocationSettings::read()
+{
+    QSettings settings(LocationSettingsFile, QSettings::IniFormat);
+    LocationSettingsSnapshot snapshot;
+
+    snapshot.positioningEnabled = settings.value(LocationSettingsEnabledKey, false).toBool();
+
+    snapshot.cellPositioningEnabled = snapshot.positioningEnabled
+                            && (settings.value(LocationSettingsMlsEnabledKey, false).toBool()
+                             || settings.value(LocationSettingsOldMlsEnabledKey, false).toBool());
+
+    snapshot.onlinePositioningEnabled = snapshot.cellPositioningEnabled
+                            && settings.value(LocationSettingsMlsOnlineEnabledKey, false).toBool();
+
+    snapshot.onlineDataAllowed = settings.value(LocationSettingsDataSourceOnlineAllowedKey, true).toBool();
+    snapshot.cellDataAllowed = settings.value(LocationSettingsDataSourceCellDataAllowedKey, true).toBool();
+    snapshot.wlanDataAllowed = settings.value(LocationSettingsDataSourceWlanDataAllowedKey, true).toBool();
+    return snapshot;
+}
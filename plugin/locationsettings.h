@@ -0,0 +1,84 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#ifndef LOCATIONSETTINGS_H
+#define LOCATIONSETTINGS_H
+
+#include <QtCore/QFileSystemWatcher>
+#include <QtCore/QObject>
+#include <QtCore/QTimer>
+
+/*
+ * The values of /etc/location/location.conf which concern this provider,
+ * as parsed at one moment.
+ */
+
+struct LocationSettingsSnapshot
+{
+    LocationSettingsSnapshot()
+        : positioningEnabled(false), cellPositioningEnabled(false), onlinePositioningEnabled(false)
+        , onlineDataAllowed(false), cellDataAllowed(false), wlanDataAllowed(false)
+    {
+    }
+
+    bool operator==(const LocationSettingsSnapshot &other) const
+    {
+        return positioningEnabled == other.positioningEnabled
+                && cellPositioningEnabled == other.cellPositioningEnabled
+                && onlinePositioningEnabled == other.onlinePositioningEnabled
+                && onlineDataAllowed == other.onlineDataAllowed
+                && cellDataAllowed == other.cellDataAllowed
+                && wlanDataAllowed == other.wlanDataAllowed;
+    }
+    bool operator!=(const LocationSettingsSnapshot &other) const { return !(*this == other); }
+
+    bool positioningEnabled;
+    bool cellPositioningEnabled;   // implies positioningEnabled
+    bool onlinePositioningEnabled; // implies cellPositioningEnabled
+    bool onlineDataAllowed;
+    bool cellDataAllowed;
+    bool wlanDataAllowed;
+};
+
+/*
+ * The LocationSettings class watches the location settings file.
+ *
+ * A settings write usually shows up as a burst of file and directory
+ * change events, so the events only (re)start a short timer, and the
+ * file is parsed once the burst is over.  changed() is emitted only if
+ * the parsed snapshot differs from the previous one.
+ */
+
+class LocationSettings : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit LocationSettings(QObject *parent = 0);
+    ~LocationSettings();
+
+    void start();
+    LocationSettingsSnapshot snapshot() const;
+
+signals:
+    void changed();
+
+private Q_SLOTS:
+    void scheduleReload();
+    void reload();
+
+private:
+    static LocationSettingsSnapshot read();
+
+    QFileSystemWatcher m_watcher;
+    QTimer m_debounceTimer;
+    LocationSettingsSnapshot m_snapshot;
+};
+
+#endif // LOCATIONSETTINGS_H
@@ -0,0 +1,37 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include "locationtypes.h"
+
+#include <QtDBus/QDBusArgument>
+
+QDBusArgument &operator<<(QDBusArgument &argument, const Accuracy &accuracy)
+{
+    const qint32 GeoclueAccuracyLevelPostalcode = 4;
+
+    argument.beginStructure();
+    argument << GeoclueAccuracyLevelPostalcode << accuracy.horizontal() << accuracy.vertical();
+    argument.endStructure();
+    return argument;
+}
+
+const QDBusArgument &operator>>(const QDBusArgument &argument, Accuracy &accuracy)
+{
+    qint32 level;
+    double a;
+
+    argument.beginStructure();
+    argument >> level;
+    argument >> a;
+    accuracy.setHorizontal(a);
+    argument >> a;
+    accuracy.setVertical(a);
+    argument.endStructure();
+    return argument;
+}
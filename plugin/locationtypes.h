@@ -14,89 +14,76 @@
 #define LOCATIONTYPES_H
 
 #include <QtCore/QtNumeric>
-#include <QtCore/QSharedDataPointer>
 #include <QtCore/QMetaType>
 
-class AccuracyData : public QSharedData
-{
-public:
-    AccuracyData() : horizontal(qQNaN()), vertical(qQNaN()) { }
-    AccuracyData(const AccuracyData &other)
-    :   QSharedData(other), horizontal(other.horizontal), vertical(other.vertical)
-    { }
-    ~AccuracyData() { }
+QT_FORWARD_DECLARE_CLASS(QDBusArgument)
 
-    double horizontal;
-    double vertical;
-};
+/*
+ * Accuracy and Location are plain values: a fix is built, filtered,
+ * stored and marshalled on every position update, so copying one must
+ * not allocate.  Unknown fields are NaN.
+ */
 
 class Accuracy
 {
 public:
-    Accuracy() : d(new AccuracyData) { }
-    Accuracy(const Accuracy &other) : d(other.d) { }
+    Accuracy() : m_horizontal(qQNaN()), m_vertical(qQNaN()) { }
 
-    inline double horizontal() const { return d->horizontal; }
-    inline void setHorizontal(double accuracy) { d->horizontal = accuracy; }
-    inline double vertical() const { return d->vertical; }
-    inline void setVertical(double accuracy) { d->vertical = accuracy; }
+    inline double horizontal() const { return m_horizontal; }
+    inline void setHorizontal(double accuracy) { m_horizontal = accuracy; }
+    inline double vertical() const { return m_vertical; }
+    inline void setVertical(double accuracy) { m_vertical = accuracy; }
 
 private:
-    QSharedDataPointer<AccuracyData> d;
+    double m_horizontal;
+    double m_vertical;
 };
 
-class LocationData : public QSharedData
+class Location
 {
 public:
-    LocationData()
-    :   timestamp(0), latitude(qQNaN()), longitude(qQNaN()), altitude(qQNaN()), speed(qQNaN()),
-        direction(qQNaN()), climb(qQNaN())
-    { }
-    LocationData(const LocationData &other)
-    :   QSharedData(other), timestamp(other.timestamp), latitude(other.latitude),
-        longitude(other.longitude), altitude(other.altitude), speed(other.speed),
-        direction(other.direction), climb(other.climb), accuracy(other.accuracy)
+    Location()
+    :   m_timestamp(0), m_latitude(qQNaN()), m_longitude(qQNaN()), m_altitude(qQNaN()),
+        m_speed(qQNaN()), m_direction(qQNaN()), m_climb(qQNaN())
     { }
-    ~LocationData() { }
 
-    qint64 timestamp;
-    double latitude;
-    double longitude;
-    double altitude;
+    inline qint64 timestamp() const { return m_timestamp; }
+    inline void setTimestamp(qint64 timestamp) { m_timestamp = timestamp; }
+    inline double latitude() const { return m_latitude; }
+    inline void setLatitude(double latitude) { m_latitude = latitude; }
+    inline double longitude() const { return m_longitude; }
+    inline void setLongitude(double longitude) { m_longitude = longitude; }
+    inline double altitude() const { return m_altitude; }
+    inline void setAltitude(double altitude) { m_altitude = altitude; }
+    inline double speed() const { return m_speed; }
+    inline void setSpeed(double speed) { m_speed = speed; }
+    inline double direction() const { return m_direction; }
+    inline void setDirection(double direction) { m_direction = direction; }
+    inline double climb() const { return m_climb; }
+    inline void setClimb(double climb) { m_climb = climb; }
+    inline Accuracy accuracy() const { return m_accuracy; }
+    inline void setAccuracy(const Accuracy &accuracy) { m_accuracy = accuracy; }
 
-    double speed;
-    double direction;
-    double climb;
+private:
+    qint64 m_timestamp;
+    double m_latitude;
+    double m_longitude;
+    double m_altitude;
+
+    double m_speed;
+    double m_direction;
+    double m_climb;
 
-    Accuracy accuracy;
+    Accuracy m_accuracy;
 };
 
-class Location
-{
-public:
-    Location() : d(new LocationData) { }
-    Location(const Location &other) : d(other.d) { }
-
-    inline qint64 timestamp() const { return d->timestamp; }
-    inline void setTimestamp(qint64 timestamp) { d->timestamp = timestamp; }
-    inline double latitude() const { return d->latitude; }
-    inline void setLatitude(double latitude) { d->latitude = latitude; }
-    inline double longitude() const { return d->longitude; }
-    inline void setLongitude(double longitude) { d->longitude = longitude; }
-    inline double altitude() const { return d->altitude; }
-    inline void setAltitude(double altitude) { d->altitude = altitude; }
-    inline double speed() const { return d->speed; }
-    inline void setSpeed(double speed) { d->speed = speed; }
-    inline double direction() const { return d->direction; }
-    inline void setDirection(double direction) { d->direction = direction; }
-    inline double climb() const { return d->climb; }
-    inline void setClimb(double climb) { d->climb = climb; }
-    inline Accuracy accuracy() const { return d->accuracy; }
-    inline void setAccuracy(const Accuracy &accuracy) { d->accuracy = accuracy; }
+// movable rather than primitive: a default constructed value is NaN, not zero.
+Q_DECLARE_TYPEINFO(Accuracy, Q_MOVABLE_TYPE);
+Q_DECLARE_TYPEINFO(Location, Q_MOVABLE_TYPE);
 
-private:
-    QSharedDataPointer<LocationData> d;
-};
+// the geoclue (idd) accuracy structure.
+QDBusArgument &operator<<(QDBusArgument &argument, const Accuracy &accuracy);
+const QDBusArgument &operator>>(const QDBusArgument &argument, Accuracy &accuracy);
 
 Q_DECLARE_METATYPE(Accuracy)
 Q_DECLARE_METATYPE(Location)
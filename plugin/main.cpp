@@ -11,20 +11,61 @@
     version 2.1 of the License.
 */
 
+#include <QtCore/QCommandLineParser>
 #include <QtCore/QCoreApplication>
 #include <QtCore/QLoggingCategory>
 #include <QtDBus/QDBusConnection>
 
 #include "yandexprovider.h"
+#include "startuptrace.h"
+#include "tracereplay.h"
 
 Q_DECL_EXPORT int main(int argc, char *argv[])
 {
+    StartupTrace::start();
     QCoreApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    const QCommandLineOption replayOption(QStringLiteral("replay"),
+            QStringLiteral("Replay a recorded observation trace instead of serving D-Bus clients."),
+            QStringLiteral("trace"));
+    const QCommandLineOption speedOption(QStringLiteral("speed"),
+            QStringLiteral("Replay the trace this many times faster than it was recorded."),
+            QStringLiteral("factor"), QStringLiteral("1"));
+    const QCommandLineOption dataOption(QStringLiteral("data"),
+            QStringLiteral("Look cells up from the mlsdb data in this directory during a replay."),
+            QStringLiteral("directory"));
+    const QCommandLineOption accuracyOption(QStringLiteral("accuracy"),
+            QStringLiteral("Replay as if the client required this accuracy, in metres."),
+            QStringLiteral("metres"));
+    parser.addOption(replayOption);
+    parser.addOption(speedOption);
+    parser.addOption(dataOption);
+    parser.addOption(accuracyOption);
+    parser.process(a);
+
     YandexProvider provider;
+    if (parser.isSet(replayOption)) {
+        TraceReplay replay(&provider);
+        if (!replay.open(parser.value(replayOption)))
+            qFatal("Failed to read the observation trace %s", qPrintable(parser.value(replayOption)));
+        replay.setSpeed(qMax(parser.value(speedOption).toDouble(), 0.01));
+        replay.setDataDirectory(parser.value(dataOption));
+        replay.setRequiredAccuracy(parser.value(accuracyOption).toDouble());
+        QObject::connect(&replay, &TraceReplay::finished, &a, &QCoreApplication::quit);
+        replay.start();
+        return a.exec();
+    }
+
+    StartupTrace::mark("provider constructed");
     QDBusConnection connection = QDBusConnection::sessionBus();
     if (!connection.registerObject(QStringLiteral("/org/freedesktop/Geoclue/Providers/Yandex"), &provider))
         qFatal("Failed to register object /org/freedesktop/Geoclue/Providers/Yandex - is another instance of the plugin already running?");
     if (!connection.registerService(QStringLiteral("org.freedesktop.Geoclue.Providers.Yandex")))
         qFatal("Failed to register service org.freedesktop.Geoclue.Providers.Yandex - is another instance of the plugin already running?");
+    StartupTrace::mark("service registered");
+
+    // the activating client is waiting for the name, set up the rest later.
+    QMetaObject::invokeMethod(&provider, "initialize", Qt::QueuedConnection);
     return a.exec();
 }
@@ -0,0 +1,435 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include "mlsdbcelldatabase.h"
+#include "providerstatistics.h"
+
+#include <QtCore/QDataStream>
+#include <QtCore/QDateTime>
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QDirIterator>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QFileSystemWatcher>
+
+namespace {
+    const QString MlsdbDataDirectory = QStringLiteral("/usr/share/geoclue-provider-mlsdb/");
+    const QString MlsdbDataFileName = QStringLiteral("mlsdb.data");
+    const QString MlsdbIndexFileName = QStringLiteral("mlsdb.index");
+    const QString MlsdbWlanIndexFileName = QStringLiteral("mlsdb.wlan");
+    const QString MlsdbBloomFileName = QStringLiteral("mlsdb.bloom");
+
+    QSharedPointer<MlsdbBloomFilter> openBloomFilter(const QHash<QString, QString> &bloomFiles, const QString &directory,
+                                                     const QStringList &sourceFiles)
+    {
+        QSharedPointer<MlsdbBloomFilter> bloom;
+        if (bloomFiles.contains(directory)) {
+            bloom = QSharedPointer<MlsdbBloomFilter>(new MlsdbBloomFilter);
+            if (!bloom->open(bloomFiles.value(directory))) {
+                bloom.clear(); // without the filter every key has to be looked for.
+            } else if (bloom->sourceSize() != MlsdbBloomFilter::sourceSize(sourceFiles)) {
+                // a data file was replaced without its filter, which would
+                // reject the keys added since.
+                qDebug() << "geoclue-mlsdb bloom filter" << bloom->fileName() << "is stale, ignoring";
+                bloom.clear();
+            }
+        }
+        return bloom;
+    }
+
+    QString existingDirectory(const QString &path)
+    {
+        // the path itself if it exists, otherwise the nearest parent which does.
+        QString directory = QDir::cleanPath(QFileInfo(path).absoluteFilePath());
+        while (!QFileInfo(directory).isDir()) {
+            const QString parent = QFileInfo(directory).path();
+            if (parent == directory) {
+                break;
+            }
+            directory = parent;
+        }
+        return directory;
+    }
+
+    quint32 fileVersion(const QString &fileName, quint32 dataVersion)
+    {
+        // the data version identifies the exact set of files in use.
+        const QFileInfo info(fileName);
+        dataVersion = qHash(fileName, dataVersion);
+        dataVersion = qHash(info.size(), dataVersion);
+        dataVersion = qHash(info.lastModified().toMSecsSinceEpoch(), dataVersion);
+        return dataVersion;
+    }
+}
+
+MlsdbCellDatabase::MlsdbCellDatabase(QObject *parent)
+    : QObject(parent)
+    , m_dataDirectory(MlsdbDataDirectory)
+    , m_dataWatcher(0)
+    , m_dataVersion(0)
+    , m_manifestValid(false)
+{
+}
+
+MlsdbCellDatabase::~MlsdbCellDatabase()
+{
+}
+
+void MlsdbCellDatabase::setDataDirectory(const QString &path)
+{
+    m_dataDirectory = path;
+    m_manifest.clear();
+    m_wlanFiles.clear();
+    m_manifestValid = false;
+}
+
+void MlsdbCellDatabase::dataDirectoryChanged(const QString &path)
+{
+    if (!m_watchedParent.isEmpty()) {
+        // the data directory did not exist, see whether it (or one of its parents) does now.
+        const QString directory = existingDirectory(m_dataDirectory);
+        if (directory == m_watchedParent) {
+            return; // something else changed next to where the data will be.
+        } else if (directory != QDir::cleanPath(QFileInfo(m_dataDirectory).absoluteFilePath())) {
+            m_watchedParent = directory;
+            watchDirectories(QStringList() << directory);
+            return;
+        }
+        qDebug() << "geoclue-mlsdb data directory" << m_dataDirectory << "created";
+        m_watchedParent.clear();
+        watchDirectories(QStringList() << m_dataDirectory);
+    }
+
+    qDebug() << "geoclue-mlsdb data directory" << path << "changed, invalidating manifest";
+    m_manifest.clear(); // also unmaps the indexes
+    m_wlanFiles.clear();
+    m_manifestValid = false;
+    emit dataChanged();
+}
+
+quint32 MlsdbCellDatabase::dataVersion()
+{
+    if (!m_manifestValid) {
+        buildManifest();
+    }
+    return m_dataVersion;
+}
+
+void MlsdbCellDatabase::buildManifest()
+{
+    m_manifest.clear();
+    m_wlanFiles.clear();
+    m_dataVersion = 0;
+    m_manifestValid = true;
+    m_watchedParent.clear();
+
+    if (!QFileInfo(m_dataDirectory).isDir()) {
+        // no data pack has been installed yet.  a directory which does not exist
+        // can't be watched, so watch its nearest parent to notice it being created.
+        m_watchedParent = existingDirectory(m_dataDirectory);
+        watchDirectories(QStringList() << m_watchedParent);
+        qDebug() << "geoclue-mlsdb data directory" << m_dataDirectory << "does not exist, watching" << m_watchedParent;
+        return;
+    }
+
+    // watch every directory of the data tree, so that we notice
+    // data packs (or buckets within them) being installed or removed.
+    QStringList directories;
+    directories.append(m_dataDirectory);
+
+    // each bucket directory contains a version 4 mlsdb.index file, a version 3 mlsdb.data file, or both.
+    QHash<QString, QString> dataFiles; // bucket directory -> data file
+    QHash<QString, QString> indexFiles; // bucket directory -> index file
+    QHash<QString, QString> wlanFiles; // data pack directory -> wlan index file
+    QHash<QString, QString> bloomFiles; // directory -> bloom filter over the keys of its files
+    QDirIterator it(m_dataDirectory, QDir::AllDirs | QDir::Files | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        const QString fname(it.next());
+        const QFileInfo info(it.fileInfo());
+        if (info.isDir()) {
+            directories.append(fname);
+        } else if (info.fileName() == MlsdbIndexFileName) {
+            indexFiles.insert(info.path(), fname);
+        } else if (info.fileName() == MlsdbDataFileName) {
+            dataFiles.insert(info.path(), fname);
+        } else if (info.fileName() == MlsdbWlanIndexFileName) {
+            wlanFiles.insert(info.path(), fname);
+        } else if (info.fileName() == MlsdbBloomFileName) {
+            bloomFiles.insert(info.path(), fname);
+        }
+    }
+    watchDirectories(directories);
+
+    // a filter is built over the keys of the cell index (or data file) and the wlan index of its directory.
+    const auto bloomSourceFiles = [&](const QString &directory) {
+        QStringList sourceFiles;
+        if (indexFiles.contains(directory)) {
+            sourceFiles.append(indexFiles.value(directory));
+        } else if (dataFiles.contains(directory)) {
+            sourceFiles.append(dataFiles.value(directory));
+        }
+        if (wlanFiles.contains(directory)) {
+            sourceFiles.append(wlanFiles.value(directory));
+        }
+        return sourceFiles;
+    };
+
+    QStringList bucketDirectories = dataFiles.keys() + indexFiles.keys();
+    bucketDirectories.removeDuplicates();
+    Q_FOREACH (const QString &bucketDirectory, bucketDirectories) {
+        const QString bucketName = QFileInfo(bucketDirectory).fileName();
+        if (bucketName.length() != 1 || !bucketName.at(0).isDigit()) {
+            qDebug() << "geoclue-mlsdb data directory" << bucketDirectory << "is not a location code bucket, ignoring";
+            continue;
+        }
+
+        BucketFile file;
+        file.minimumMcc = 0;
+        file.maximumMcc = 0xFFFF;
+        if (indexFiles.contains(bucketDirectory)) {
+            // prefer the index of this bucket, and only fall back to
+            // deserialising the version 3 data file if it is unusable.
+            QSharedPointer<MlsdbCellIndex> index(new MlsdbCellIndex);
+            if (index->open(indexFiles.value(bucketDirectory))) {
+                file.fileName = index->fileName();
+                file.index = index;
+                file.minimumMcc = index->minimumMcc();
+                file.maximumMcc = index->maximumMcc();
+            }
+        }
+        if (!file.index) {
+            if (!dataFiles.contains(bucketDirectory)) {
+                continue;
+            }
+            file.fileName = dataFiles.value(bucketDirectory);
+        }
+        file.bloom = openBloomFilter(bloomFiles, bucketDirectory, bloomSourceFiles(bucketDirectory));
+        m_manifest[bucketName.at(0)].append(file);
+
+        m_dataVersion = fileVersion(file.fileName, m_dataVersion);
+        if (file.bloom) {
+            m_dataVersion = fileVersion(file.bloom->fileName(), m_dataVersion);
+        }
+    }
+
+    for (QHash<QString, QString>::const_iterator it = wlanFiles.constBegin(); it != wlanFiles.constEnd(); ++it) {
+        WlanFile file;
+        file.index = QSharedPointer<MlsdbWlanIndex>(new MlsdbWlanIndex);
+        if (!file.index->open(it.value())) {
+            continue;
+        }
+        file.bloom = openBloomFilter(bloomFiles, it.key(), bloomSourceFiles(it.key()));
+        m_wlanFiles.append(file);
+
+        m_dataVersion = fileVersion(file.index->fileName(), m_dataVersion);
+        if (file.bloom) {
+            m_dataVersion = fileVersion(file.bloom->fileName(), m_dataVersion);
+        }
+    }
+
+    qDebug() << "geoclue-mlsdb manifest built with" << m_manifest.size() << "buckets from" << bucketDirectories.size() << "directories and"
+             << m_wlanFiles.size() << "wlan indexes";
+}
+
+void MlsdbCellDatabase::watchDirectories(const QStringList &directories)
+{
+    if (!m_dataWatcher) {
+        m_dataWatcher = new QFileSystemWatcher(this);
+        connect(m_dataWatcher, &QFileSystemWatcher::directoryChanged,
+                this, &MlsdbCellDatabase::dataDirectoryChanged);
+    }
+    const QStringList watched = m_dataWatcher->directories();
+    if (!watched.isEmpty()) {
+        m_dataWatcher->removePaths(watched);
+    }
+    m_dataWatcher->addPaths(directories);
+}
+
+void MlsdbCellDatabase::prepare()
+{
+    emit ready(dataVersion());
+}
+
+void MlsdbCellDatabase::requestLookup(const QVector<MlsdbUniqueCellId> &uniqueCellIds)
+{
+    QElapsedTimer timer;
+    timer.start();
+    MlsdbCellLocations found;
+    QVector<MlsdbUniqueCellId> unknown;
+    lookup(uniqueCellIds, &found, &unknown);
+    ProviderStatistics::increment(ProviderStatistics::OfflineLookups);
+    ProviderStatistics::record(ProviderStatistics::OfflineLookupMicroseconds, timer.nsecsElapsed() / 1000);
+    emit cellsLookedUp(found, unknown, m_dataVersion);
+}
+
+void MlsdbCellDatabase::requestAccessPointLookup(const QVector<quint64> &bssids)
+{
+    QElapsedTimer timer;
+    timer.start();
+    MlsdbAccessPointLocations found;
+    QVector<quint64> unknown;
+    lookupAccessPoints(bssids, &found, &unknown);
+    ProviderStatistics::increment(ProviderStatistics::OfflineLookups);
+    ProviderStatistics::record(ProviderStatistics::OfflineLookupMicroseconds, timer.nsecsElapsed() / 1000);
+    emit accessPointsLookedUp(found, unknown, m_dataVersion);
+}
+
+void MlsdbCellDatabase::lookupAccessPoints(const QVector<quint64> &bssids,
+                                           MlsdbAccessPointLocations *found,
+                                           QVector<quint64> *unknown)
+{
+    if (!m_manifestValid) {
+        buildManifest();
+    }
+
+    Q_FOREACH (quint64 bssid, bssids) {
+        const quint64 key = MlsdbBloomFilter::accessPointKey(bssid);
+        bool located = false;
+        Q_FOREACH (const WlanFile &file, m_wlanFiles) {
+            if (file.bloom && !file.bloom->mayContain(key)) {
+                ProviderStatistics::increment(ProviderStatistics::BloomFilterRejections);
+                continue;
+            }
+            MlsdbCoords coords;
+            ProviderStatistics::increment(ProviderStatistics::BucketBytesRead,
+                                          quint32(sizeof(MlsdbWlanIndexRecord)));
+            if (file.index->find(bssid, &coords)) {
+                found->insert(bssid, coords);
+                located = true;
+                break;
+            }
+        }
+        if (!located) {
+            unknown->append(bssid);
+        }
+    }
+}
+
+void MlsdbCellDatabase::lookup(const QVector<MlsdbUniqueCellId> &uniqueCellIds,
+                               MlsdbCellLocations *found,
+                               QVector<MlsdbUniqueCellId> *unknown)
+{
+    if (!m_manifestValid) {
+        buildManifest();
+    }
+
+    // group the cells by bucket, so that each bucket file is opened
+    // (and, if it is not indexed, deserialised) only once.
+    QMap<QChar, QVector<MlsdbUniqueCellId> > buckets;
+    Q_FOREACH (const MlsdbUniqueCellId &uniqueCellId, uniqueCellIds) {
+        QVector<MlsdbUniqueCellId> &bucket(buckets[QString::number(uniqueCellId.locationCode()).at(0)]);
+        if (!bucket.contains(uniqueCellId)) {
+            bucket.append(uniqueCellId);
+        }
+    }
+
+    for (QMap<QChar, QVector<MlsdbUniqueCellId> >::iterator bucket = buckets.begin(); bucket != buckets.end(); ++bucket) {
+        QVector<MlsdbUniqueCellId> &remaining(bucket.value());
+        const QVector<BucketFile> files = m_manifest.value(bucket.key());
+        Q_FOREACH (const BucketFile &file, files) {
+            if (remaining.isEmpty()) {
+                break;
+            }
+
+            if (!file.index) {
+                // this bucket is not indexed, deserialise its version 3 data file,
+                // but only if its filter says it may contain one of the cells.
+                QVector<MlsdbUniqueCellId> candidates;
+                QVector<MlsdbUniqueCellId> rejected;
+                Q_FOREACH (const MlsdbUniqueCellId &uniqueCellId, remaining) {
+                    if (!file.bloom || file.bloom->mayContain(MlsdbBloomFilter::cellKey(uniqueCellId))) {
+                        candidates.append(uniqueCellId);
+                    } else {
+                        rejected.append(uniqueCellId);
+                    }
+                }
+                ProviderStatistics::increment(ProviderStatistics::BloomFilterRejections, quint32(rejected.size()));
+                if (!candidates.isEmpty()) {
+                    searchDataFile(file.fileName, &candidates, found);
+                }
+                remaining = rejected + candidates;
+                continue;
+            }
+
+            // search the mapped index in place, each search probes about log2(n) records.
+            quint32 probes = 1;
+            for (quint32 n = file.index->recordCount(); n > 1; n >>= 1) {
+                ++probes;
+            }
+            QVector<MlsdbUniqueCellId>::iterator cell = remaining.begin();
+            while (cell != remaining.end()) {
+                MlsdbCoords coords;
+                bool searched = cell->mcc() >= file.minimumMcc && cell->mcc() <= file.maximumMcc;
+                if (searched && file.bloom && !file.bloom->mayContain(MlsdbBloomFilter::cellKey(*cell))) {
+                    ProviderStatistics::increment(ProviderStatistics::BloomFilterRejections);
+                    searched = false;
+                }
+                if (searched) {
+                    ProviderStatistics::increment(ProviderStatistics::BucketBytesRead,
+                                                  quint32(probes * sizeof(MlsdbCellIndexRecord)));
+                }
+                if (searched && file.index->find(*cell, &coords)) {
+                    qDebug() << "geoclue-mlsdb index file" << file.fileName << "contains the location of composed cell id:" << cell->toString() << "->" << coords.lat << "," << coords.lon;
+                    found->insert(*cell, coords);
+                    cell = remaining.erase(cell);
+                } else {
+                    ++cell;
+                }
+            }
+        }
+
+        Q_FOREACH (const MlsdbUniqueCellId &uniqueCellId, remaining) {
+            qDebug() << "no geoclue-mlsdb data files contain the location of composed cell id:" << uniqueCellId.toString();
+        }
+        *unknown += remaining;
+    }
+}
+
+void MlsdbCellDatabase::searchDataFile(const QString &fname, QVector<MlsdbUniqueCellId> *uniqueCellIds,
+                                       MlsdbCellLocations *found) const
+{
+    QFile file(fname);
+    file.open(QIODevice::ReadOnly);
+    ProviderStatistics::increment(ProviderStatistics::BucketBytesRead, quint32(file.size()));
+    QDataStream in(&file);
+    quint32 magic = 0, expectedMagic = (quint32)MLSDB_DATA_MAGIC;
+    in >> magic;
+    if (magic != expectedMagic) {
+        qDebug() << "geoclue-mlsdb data file" << fname << "format unknown:" << magic << "expected:" << expectedMagic;
+        return; // ignore this file
+    }
+    qint32 version;
+    in >> version;
+    if (version != MLSDB_DATA_VERSION) {
+        qDebug() << "geoclue-mlsdb data file" << fname << "version unknown:" << version;
+        return; // ignore this file
+    }
+
+    // deserialise the bucket once, and resolve every requested cell from it.
+    QMap<MlsdbUniqueCellId, MlsdbCoords> perLcCellIdToLocations;
+    in >> perLcCellIdToLocations;
+    if (perLcCellIdToLocations.isEmpty()) {
+        qDebug() << "geoclue-mlsdb data file" << fname << "contained no cell locations!";
+        return;
+    }
+
+    QVector<MlsdbUniqueCellId>::iterator it = uniqueCellIds->begin();
+    while (it != uniqueCellIds->end()) {
+        QMap<MlsdbUniqueCellId, MlsdbCoords>::const_iterator coords = perLcCellIdToLocations.constFind(*it);
+        if (coords != perLcCellIdToLocations.constEnd()) {
+            qDebug() << "geoclue-mlsdb data file" << fname << "contains the location of composed cell id:" << it->toString() << "->" << coords->lat << "," << coords->lon;
+            found->insert(*it, coords.value());
+            it = uniqueCellIds->erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
@@ -0,0 +1,114 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#ifndef MLSDBCELLDATABASE_H
+#define MLSDBCELLDATABASE_H
+
+#include <QtCore/QObject>
+#include <QtCore/QHash>
+#include <QtCore/QMap>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+
+#include "mlsdbserialisation.h"
+#include "mlsdbcellindex.h"
+#include "mlsdbwlanindex.h"
+#include "mlsdbbloomfilter.h"
+
+QT_FORWARD_DECLARE_CLASS(QFileSystemWatcher)
+
+typedef QMap<MlsdbUniqueCellId, MlsdbCoords> MlsdbCellLocations;
+typedef QMap<quint64, MlsdbCoords> MlsdbAccessPointLocations; // by BSSID
+
+/*
+ * The MlsdbCellDatabase class looks up cell locations from the mlsdb
+ * data packs installed on the device.
+ *
+ * The data files are separated into "first digit of location code"
+ * directories/buckets.  On first use a manifest of the files in each
+ * bucket is built, so that a lookup only touches the files which can
+ * actually contain the cell.  The manifest is invalidated whenever the
+ * installed data packs change.
+ *
+ * A data pack may also carry an mlsdb.wlan index of WLAN access point
+ * locations, and each directory an mlsdb.bloom filter over the keys of
+ * its files.  Keys which the filter rules out are not looked for in
+ * those files at all, so unknown cells and access points cost no I/O.
+ *
+ * Lookups do blocking file I/O, so the provider moves the database to a
+ * worker thread and talks to it only through queued calls: prepare(),
+ * requestLookup() and requestAccessPointLookup() are answered by the
+ * ready(), cellsLookedUp() and accessPointsLookedUp() signals.
+ */
+
+class MlsdbCellDatabase : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit MlsdbCellDatabase(QObject *parent = 0);
+    ~MlsdbCellDatabase();
+
+    void lookup(const QVector<MlsdbUniqueCellId> &uniqueCellIds,
+                MlsdbCellLocations *found,
+                QVector<MlsdbUniqueCellId> *unknown);
+    void lookupAccessPoints(const QVector<quint64> &bssids,
+                            MlsdbAccessPointLocations *found,
+                            QVector<quint64> *unknown);
+
+    quint32 dataVersion();
+
+    // defaults to the directory the data packs are installed in.
+    void setDataDirectory(const QString &path);
+
+public Q_SLOTS:
+    void prepare();
+    void requestLookup(const QVector<MlsdbUniqueCellId> &uniqueCellIds);
+    void requestAccessPointLookup(const QVector<quint64> &bssids);
+
+signals:
+    void ready(quint32 dataVersion);
+    void cellsLookedUp(const MlsdbCellLocations &found, const QVector<MlsdbUniqueCellId> &unknown, quint32 dataVersion);
+    void accessPointsLookedUp(const MlsdbAccessPointLocations &found, const QVector<quint64> &unknown, quint32 dataVersion);
+    void dataChanged();
+
+private Q_SLOTS:
+    void dataDirectoryChanged(const QString &path);
+
+private:
+    struct BucketFile {
+        QString fileName;
+        QSharedPointer<MlsdbCellIndex> index; // null if the bucket only has a version 3 data file
+        QSharedPointer<MlsdbBloomFilter> bloom; // null if the bucket has no filter
+        quint16 minimumMcc;
+        quint16 maximumMcc;
+    };
+
+    struct WlanFile {
+        QSharedPointer<MlsdbWlanIndex> index;
+        QSharedPointer<MlsdbBloomFilter> bloom; // null if the data pack has no filter
+    };
+
+    void buildManifest();
+    void watchDirectories(const QStringList &directories);
+    void searchDataFile(const QString &fname, QVector<MlsdbUniqueCellId> *uniqueCellIds,
+                        MlsdbCellLocations *found) const;
+
+    QString m_dataDirectory;
+    QFileSystemWatcher *m_dataWatcher; // created on first use, in the thread the database lives in
+    QString m_watchedParent; // watched instead of the data directory while that does not exist
+    QHash<QChar, QVector<BucketFile> > m_manifest;
+    QVector<WlanFile> m_wlanFiles;
+    quint32 m_dataVersion;
+    bool m_manifestValid;
+};
+
+#endif // MLSDBCELLDATABASE_H
@@ -0,0 +1,104 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include "observation.h"
+
+#include <QtCore/QDateTime>
+
+#include <algorithm>
+
+namespace {
+    // strength changes smaller than these do not change the fingerprint.
+    const quint32 CellStrengthBucketSize = 4;
+    const quint16 AccessPointStrengthBucketSize = 10;
+}
+
+Observation::Observation(const QVector<ObservedCell> &cells, const QVector<ObservedAccessPoint> &accessPoints)
+{
+    ObservationData *data = new ObservationData;
+    data->cells = cells;
+    data->accessPoints = accessPoints;
+    data->timestamp = QDateTime::currentMSecsSinceEpoch();
+
+    QVector<uint> hashes;
+    hashes.reserve(cells.size() + accessPoints.size());
+    Q_FOREACH (const ObservedCell &cell, cells) {
+        hashes.append(qHash(cell.uniqueCellId, cell.signalStrength / CellStrengthBucketSize));
+    }
+    Q_FOREACH (const ObservedAccessPoint &accessPoint, accessPoints) {
+        hashes.append(qHash(accessPoint.bssid, accessPoint.strength / AccessPointStrengthBucketSize));
+    }
+    std::sort(hashes.begin(), hashes.end());
+
+    uint fingerprint = qHash(cells.size(), qHash(accessPoints.size()));
+    Q_FOREACH (uint hash, hashes) {
+        fingerprint = qHash(hash, fingerprint);
+    }
+    data->fingerprint = fingerprint;
+
+    // the neighbours come and go with the signal, so only the serving cell
+    // counts, unless the modem does not say which one that is.
+    bool haveRegistered = false;
+    Q_FOREACH (const ObservedCell &cell, cells) {
+        haveRegistered = haveRegistered || cell.registered;
+    }
+    hashes.clear();
+    Q_FOREACH (const ObservedCell &cell, cells) {
+        if (cell.registered || !haveRegistered) {
+            hashes.append(qHash(cell.uniqueCellId));
+        }
+    }
+    Q_FOREACH (const ObservedAccessPoint &accessPoint, accessPoints) {
+        hashes.append(qHash(accessPoint.bssid));
+    }
+    std::sort(hashes.begin(), hashes.end());
+
+    uint placeFingerprint = qHash(hashes.size());
+    Q_FOREACH (uint hash, hashes) {
+        placeFingerprint = qHash(hash, placeFingerprint);
+    }
+    data->placeFingerprint = placeFingerprint;
+
+    d = data;
+}
+
+quint64 Observation::bssidFromString(const QString &bssid)
+{
+    // "aa:bb:cc:dd:ee:ff", returns 0 if the address is malformed.
+    if (bssid.size() != 17) {
+        return 0;
+    }
+
+    quint64 value = 0;
+    for (int i = 0; i < 6; ++i) {
+        if (i > 0 && bssid.at(3 * i - 1) != QLatin1Char(':')) {
+            return 0;
+        }
+        bool ok = false;
+        const uint octet = bssid.midRef(3 * i, 2).toUInt(&ok, 16);
+        if (!ok) {
+            return 0;
+        }
+        value = (value << 8) | octet;
+    }
+    return value;
+}
+
+QByteArray Observation::bssidToString(quint64 bssid)
+{
+    static const char hex[] = "0123456789abcdef";
+    QByteArray result(17, ':');
+    for (int i = 5; i >= 0; --i) {
+        const uint octet = bssid & 0xff;
+        result[3 * i] = hex[octet >> 4];
+        result[3 * i + 1] = hex[octet & 0xf];
+        bssid >>= 8;
+    }
+    return result;
+}
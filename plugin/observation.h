@@ -0,0 +1,86 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#ifndef OBSERVATION_H
+#define OBSERVATION_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QSharedData>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+#include "mlsdbserialisation.h"
+
+struct ObservedCell
+{
+    ObservedCell() : signalStrength(0), registered(false) { }
+
+    MlsdbUniqueCellId uniqueCellId;
+    quint32 signalStrength;
+    bool registered; // the serving cell, rather than a neighbour
+};
+
+struct ObservedAccessPoint
+{
+    quint64 bssid;      // 48-bit MAC address
+    quint16 frequency;  // MHz
+    quint16 strength;   // 0 - 100, as reported by connman
+};
+
+Q_DECLARE_TYPEINFO(ObservedCell, Q_MOVABLE_TYPE);
+Q_DECLARE_TYPEINFO(ObservedAccessPoint, Q_PRIMITIVE_TYPE);
+Q_DECLARE_METATYPE(ObservedCell)
+
+class ObservationData : public QSharedData
+{
+public:
+    ObservationData() : timestamp(0), fingerprint(0), placeFingerprint(0) { }
+
+    QVector<ObservedCell> cells;
+    QVector<ObservedAccessPoint> accessPoints;
+    qint64 timestamp;
+    uint fingerprint;
+    uint placeFingerprint;
+};
+
+/*
+ * The Observation class is an immutable snapshot of the cells and WLAN
+ * access points visible at one moment.  It is built once per positioning
+ * round and passed by value (implicitly shared) to everything which
+ * needs it.  Access points which must not be used for positioning are
+ * already filtered out.
+ */
+
+class Observation
+{
+public:
+    Observation() : d(new ObservationData) { }
+    Observation(const QVector<ObservedCell> &cells, const QVector<ObservedAccessPoint> &accessPoints);
+    Observation(const Observation &other) : d(other.d) { }
+    Observation &operator=(const Observation &other) { d = other.d; return *this; }
+
+    inline const QVector<ObservedCell> &cells() const { return d->cells; }
+    inline const QVector<ObservedAccessPoint> &accessPoints() const { return d->accessPoints; }
+    inline qint64 timestamp() const { return d->timestamp; }
+    inline bool isEmpty() const { return d->cells.isEmpty() && d->accessPoints.isEmpty(); }
+
+    // order-independent, and insensitive to small signal strength changes.
+    inline uint fingerprint() const { return d->fingerprint; }
+    // only the serving cell and which access points are seen, regardless of
+    // their strengths: it changes when the device moves, not when signals fade.
+    inline uint placeFingerprint() const { return d->placeFingerprint; }
+
+    static quint64 bssidFromString(const QString &bssid);
+    static QByteArray bssidToString(quint64 bssid);
+
+private:
+    QExplicitlySharedDataPointer<const ObservationData> d;
+};
+
+#endif // OBSERVATION_H
@@ -0,0 +1,162 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include "observationtrace.h"
+
+#include <QtCore/QDateTime>
+#include <QtCore/QDebug>
+
+#define TRACE_MAGIC 0x796f7472 /* "yotr" */
+#define TRACE_VERSION 3
+
+ObservationTraceWriter::ObservationTraceWriter()
+{
+}
+
+bool ObservationTraceWriter::open(const QString &fileName)
+{
+    close();
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Cannot write observation trace" << fileName << ":" << m_file.errorString();
+        return false;
+    }
+    m_stream.setDevice(&m_file);
+    m_stream.setVersion(QDataStream::Qt_5_0);
+    m_stream << quint32(TRACE_MAGIC) << qint32(TRACE_VERSION);
+    m_file.flush();
+    qDebug() << "Recording observation trace to" << fileName;
+    return true;
+}
+
+bool ObservationTraceWriter::isOpen() const
+{
+    return m_file.isOpen();
+}
+
+void ObservationTraceWriter::close()
+{
+    if (m_file.isOpen()) {
+        m_stream.setDevice(0);
+        m_file.close();
+    }
+}
+
+void ObservationTraceWriter::beginRecord(ObservationTraceRecord::Type type)
+{
+    m_stream << quint8(type) << QDateTime::currentMSecsSinceEpoch();
+}
+
+void ObservationTraceWriter::endRecord()
+{
+    m_file.flush();
+}
+
+void ObservationTraceWriter::writeCells(const QVector<ObservedCell> &cells)
+{
+    if (!isOpen()) {
+        return;
+    }
+    beginRecord(ObservationTraceRecord::CellsRecord);
+    m_stream << quint32(cells.size());
+    Q_FOREACH (const ObservedCell &cell, cells) {
+        m_stream << cell.uniqueCellId << cell.signalStrength << cell.registered;
+    }
+    endRecord();
+}
+
+void ObservationTraceWriter::writeAccessPoints(const QVector<ObservedAccessPoint> &accessPoints)
+{
+    if (!isOpen()) {
+        return;
+    }
+    beginRecord(ObservationTraceRecord::AccessPointsRecord);
+    m_stream << quint32(accessPoints.size());
+    Q_FOREACH (const ObservedAccessPoint &accessPoint, accessPoints) {
+        m_stream << accessPoint.bssid << accessPoint.frequency << accessPoint.strength;
+    }
+    endRecord();
+}
+
+void ObservationTraceWriter::writeOnlineReply(quint32 queryFingerprint, qint32 networkError, qint32 httpStatus, qint32 latency,
+                                              const QByteArray &body)
+{
+    if (!isOpen()) {
+        return;
+    }
+    beginRecord(ObservationTraceRecord::OnlineReplyRecord);
+    m_stream << queryFingerprint << networkError << httpStatus << latency << body;
+    endRecord();
+}
+
+ObservationTraceReader::ObservationTraceReader()
+{
+}
+
+bool ObservationTraceReader::open(const QString &fileName)
+{
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Cannot read observation trace" << fileName << ":" << m_file.errorString();
+        return false;
+    }
+    m_stream.setDevice(&m_file);
+    m_stream.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic = 0;
+    qint32 version = 0;
+    m_stream >> magic >> version;
+    if (magic != TRACE_MAGIC || version != TRACE_VERSION) {
+        qWarning() << "Observation trace" << fileName << "format unknown:" << magic << version;
+        m_file.close();
+        return false;
+    }
+    return true;
+}
+
+bool ObservationTraceReader::readNext(ObservationTraceRecord *record)
+{
+    if (!m_file.isOpen() || m_stream.atEnd()) {
+        return false;
+    }
+
+    *record = ObservationTraceRecord();
+    quint8 type = 0;
+    quint32 count = 0;
+    m_stream >> type >> record->timestamp;
+    switch (type) {
+    case ObservationTraceRecord::CellsRecord:
+        m_stream >> count;
+        for (quint32 i = 0; i < count && m_stream.status() == QDataStream::Ok; ++i) {
+            ObservedCell cell;
+            m_stream >> cell.uniqueCellId >> cell.signalStrength >> cell.registered;
+            record->cells.append(cell);
+        }
+        break;
+    case ObservationTraceRecord::AccessPointsRecord:
+        m_stream >> count;
+        for (quint32 i = 0; i < count && m_stream.status() == QDataStream::Ok; ++i) {
+            ObservedAccessPoint accessPoint;
+            m_stream >> accessPoint.bssid >> accessPoint.frequency >> accessPoint.strength;
+            record->accessPoints.append(accessPoint);
+        }
+        break;
+    case ObservationTraceRecord::OnlineReplyRecord:
+        m_stream >> record->queryFingerprint >> record->networkError >> record->httpStatus
+                 >> record->latency >> record->body;
+        break;
+    default:
+        qWarning() << "Observation trace record type unknown:" << type;
+        return false;
+    }
+    record->type = static_cast<ObservationTraceRecord::Type>(type);
+
+    // a record cut short by the provider being killed ends the trace.
+    return m_stream.status() == QDataStream::Ok;
+}
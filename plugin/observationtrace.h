@@ -0,0 +1,88 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#ifndef OBSERVATIONTRACE_H
+#define OBSERVATIONTRACE_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QDataStream>
+#include <QtCore/QFile>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+#include "observation.h"
+
+/*
+ * An observation trace records what the provider observed and what the
+ * online service answered, so that a field session can be replayed at a
+ * desk (see TraceReplay).
+ *
+ * The file starts with a magic number and version, followed by records
+ * of a type, a timestamp (msecs since epoch) and a type-specific body.
+ * Records are appended and flushed as they happen, so a trace is usable
+ * up to the last complete record even if the provider is killed.
+ */
+
+struct ObservationTraceRecord
+{
+    enum Type {
+        CellsRecord = 1,         // cells reported by the cell watcher
+        AccessPointsRecord = 2,  // usable wlan access points reported by connman
+        OnlineReplyRecord = 3    // a reply (or failure) of the online service
+    };
+
+    ObservationTraceRecord() : type(CellsRecord), timestamp(0), queryFingerprint(0), networkError(0), httpStatus(0), latency(0) {}
+
+    Type type;
+    qint64 timestamp;
+    QVector<ObservedCell> cells;
+    QVector<ObservedAccessPoint> accessPoints;
+    quint32 queryFingerprint; // YandexLocationQuery::fingerprint() of the query answered
+    qint32 networkError; // QNetworkReply::NetworkError
+    qint32 httpStatus;   // 0 if the server did not answer
+    qint32 latency;      // msecs from sending the query to the reply
+    QByteArray body;
+};
+
+class ObservationTraceWriter
+{
+public:
+    ObservationTraceWriter();
+
+    bool open(const QString &fileName);
+    bool isOpen() const;
+    void close();
+
+    void writeCells(const QVector<ObservedCell> &cells);
+    void writeAccessPoints(const QVector<ObservedAccessPoint> &accessPoints);
+    void writeOnlineReply(quint32 queryFingerprint, qint32 networkError, qint32 httpStatus, qint32 latency,
+                          const QByteArray &body);
+
+private:
+    void beginRecord(ObservationTraceRecord::Type type);
+    void endRecord();
+
+    QFile m_file;
+    QDataStream m_stream;
+};
+
+class ObservationTraceReader
+{
+public:
+    ObservationTraceReader();
+
+    bool open(const QString &fileName);
+    bool readNext(ObservationTraceRecord *record);
+
+private:
+    QFile m_file;
+    QDataStream m_stream;
+};
+
+#endif // OBSERVATIONTRACE_H
@@ -22,7 +22,8 @@ packagesExist(qt5-boostable) {
 # not installed
 dbus_geoclue.files = \
     org.freedesktop.Geoclue.xml \
-    org.freedesktop.Geoclue.Position.xml
+    org.freedesktop.Geoclue.Position.xml \
+    org.freedesktop.Geoclue.Providers.Yandex.Statistics.xml
 dbus_geoclue.header_flags = "-l YandexProvider -i yandexprovider.h"
 dbus_geoclue.source_flags = "-l YandexProvider"
 
@@ -38,11 +39,44 @@ geoclue_provider.path = /usr/share/geoclue-providers
 include (../common/common.pri)
 HEADERS += \
     yandexonlinelocator.h \
+    yandexlocationquery.h \
+    cellestimate.h \
+    observation.h \
+    observationtrace.h \
+    positionfilter.h \
+    tokenbucket.h \
+    providerclock.h \
+    providerconfig.h \
+    providerstatistics.h \
+    locationsettings.h \
+    startuptrace.h \
+    tracereplay.h \
+    wlanwatcher.h \
     locationtypes.h \
+    celllocationcache.h \
+    learnedcellstore.h \
+    mlsdbcelldatabase.h \
     yandexprovider.h
 
 SOURCES += \
     main.cpp \
+    cellestimate.cpp \
+    celllocationcache.cpp \
+    learnedcellstore.cpp \
+    locationtypes.cpp \
+    mlsdbcelldatabase.cpp \
+    observation.cpp \
+    observationtrace.cpp \
+    positionfilter.cpp \
+    locationsettings.cpp \
+    providerclock.cpp \
+    providerconfig.cpp \
+    providerstatistics.cpp \
+    startuptrace.cpp \
+    tokenbucket.cpp \
+    tracereplay.cpp \
+    wlanwatcher.cpp \
+    yandexlocationquery.cpp \
     yandexonlinelocator.cpp \
     yandexprovider.cpp
 
@@ -0,0 +1,203 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include "positionfilter.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QtNumeric>
+
+#include <cmath>
+
+namespace {
+    const double MetresPerDegreeLatitude = 6371000.0 * M_PI / 180.0;
+    const double KnotsPerMetrePerSecond = 1.0 / 0.514444; // geoclue reports speed in knots
+    const double AccelerationVariance = 1.0;       // (m/s^2)^2, how hard the device may change velocity
+    const double InitialVelocityVariance = 100.0;  // (m/s)^2, walking to urban driving speeds
+    const double MaximumSpeedDeviation = 5.0;      // m/s, speed is unknown until it is at least this certain
+    const double UnknownFixAccuracy = 10000.0;     // metres, for a fix which does not say
+    const double OutlierThreshold = 13.8;          // chi-square with two degrees of freedom, 99.9%
+    const double OriginRecentreDistance = 10000.0; // metres, keeps the flat frame accurate
+    const qint64 MaximumPredictionInterval = 120000; // 120s, after which the estimate is too old to be worth keeping
+
+    double fixAccuracy(const Location &fix)
+    {
+        const double accuracy = fix.accuracy().horizontal();
+        return qIsNaN(accuracy) || accuracy <= 0 ? UnknownFixAccuracy : qMax(accuracy, 1.0);
+    }
+}
+
+void PositionFilter::Axis::reset(double initialPosition, double variance)
+{
+    position = initialPosition;
+    velocity = 0;
+    p00 = variance;
+    p01 = 0;
+    p11 = InitialVelocityVariance;
+}
+
+void PositionFilter::Axis::predict(double dt)
+{
+    // x' = F x and P' = F P F^T + Q, with F = [1 dt; 0 1] and Q the
+    // covariance of a random acceleration over the interval.
+    position += velocity * dt;
+    p00 += dt * (2 * p01 + dt * p11) + AccelerationVariance * dt * dt * dt / 3;
+    p01 += dt * p11 + AccelerationVariance * dt * dt / 2;
+    p11 += AccelerationVariance * dt;
+}
+
+void PositionFilter::Axis::update(double measurement, double measurementVariance)
+{
+    const double innovation = measurement - position;
+    const double s = innovationVariance(measurementVariance);
+    const double k0 = p00 / s;
+    const double k1 = p01 / s;
+    position += k0 * innovation;
+    velocity += k1 * innovation;
+    p11 -= k1 * p01;
+    p01 -= k0 * p01;
+    p00 -= k0 * p00;
+}
+
+PositionFilter::PositionFilter()
+    : m_originLatitude(0)
+    , m_originLongitude(0)
+    , m_metresPerDegreeLongitude(MetresPerDegreeLatitude)
+    , m_bestAccuracy(qQNaN())
+    , m_timestamp(0)
+{
+    m_east.reset(0, 0);
+    m_north.reset(0, 0);
+}
+
+void PositionFilter::reset()
+{
+    m_timestamp = 0;
+}
+
+void PositionFilter::restart(const Location &fix)
+{
+    const double accuracy = fixAccuracy(fix);
+    m_originLatitude = fix.latitude();
+    m_originLongitude = fix.longitude();
+    m_metresPerDegreeLongitude = qMax(1.0, MetresPerDegreeLatitude * std::cos(m_originLatitude * M_PI / 180.0));
+    m_east.reset(0, accuracy * accuracy);
+    m_north.reset(0, accuracy * accuracy);
+    m_bestAccuracy = accuracy;
+    m_timestamp = fix.timestamp();
+}
+
+void PositionFilter::toLocal(double latitude, double longitude, double *x, double *y) const
+{
+    *x = (longitude - m_originLongitude) * m_metresPerDegreeLongitude;
+    *y = (latitude - m_originLatitude) * MetresPerDegreeLatitude;
+}
+
+void PositionFilter::moveOrigin()
+{
+    if (std::fabs(m_east.position) < OriginRecentreDistance
+            && std::fabs(m_north.position) < OriginRecentreDistance) {
+        return;
+    }
+    m_originLatitude += m_north.position / MetresPerDegreeLatitude;
+    m_originLongitude += m_east.position / m_metresPerDegreeLongitude;
+    m_metresPerDegreeLongitude = qMax(1.0, MetresPerDegreeLatitude * std::cos(m_originLatitude * M_PI / 180.0));
+    m_east.position = 0;
+    m_north.position = 0;
+}
+
+bool PositionFilter::update(const Location &fix)
+{
+    if (fix.timestamp() == 0 || qIsNaN(fix.latitude()) || qIsNaN(fix.longitude())) {
+        return false;
+    }
+
+    if (!isValid() || fix.timestamp() - m_timestamp > MaximumPredictionInterval) {
+        restart(fix);
+        return true;
+    }
+
+    // fixes which arrive out of order are treated as simultaneous.
+    const double dt = qMax<qint64>(0, fix.timestamp() - m_timestamp) / 1000.0;
+    Axis east(m_east);
+    Axis north(m_north);
+    east.predict(dt);
+    north.predict(dt);
+
+    const double accuracy = fixAccuracy(fix);
+    const double variance = accuracy * accuracy;
+    double x = 0, y = 0;
+    toLocal(fix.latitude(), fix.longitude(), &x, &y);
+    const double distance = (x - east.position) * (x - east.position) / east.innovationVariance(variance)
+                          + (y - north.position) * (y - north.position) / north.innovationVariance(variance);
+    if (distance > OutlierThreshold) {
+        const double predicted = qMax(std::sqrt(qMax(east.p00, north.p00)), m_bestAccuracy);
+        if (predicted < accuracy) {
+            qDebug() << "rejecting fix which contradicts a more accurate estimate:" << accuracy << "vs" << predicted;
+            return false;
+        }
+        qDebug() << "fix contradicts the estimate, restarting the position filter";
+        restart(fix);
+        return true;
+    }
+
+    east.update(x, variance);
+    north.update(y, variance);
+    m_east = east;
+    m_north = north;
+    m_bestAccuracy = qMin(m_bestAccuracy, accuracy);
+    m_timestamp = fix.timestamp();
+    moveOrigin();
+    return true;
+}
+
+Location PositionFilter::location() const
+{
+    Location location;
+    if (!isValid()) {
+        return location;
+    }
+
+    location.setTimestamp(m_timestamp);
+    location.setLatitude(m_originLatitude + m_north.position / MetresPerDegreeLatitude);
+    location.setLongitude(m_originLongitude + m_east.position / m_metresPerDegreeLongitude);
+
+    Accuracy accuracy;
+    accuracy.setHorizontal(qMax(std::sqrt(qMax(m_east.p00, m_north.p00)), m_bestAccuracy));
+    location.setAccuracy(accuracy);
+
+    const double speedDeviation = std::sqrt(qMax(m_east.p11, m_north.p11));
+    if (speedDeviation <= MaximumSpeedDeviation) {
+        const double speed = std::sqrt(m_east.velocity * m_east.velocity + m_north.velocity * m_north.velocity);
+        location.setSpeed(speed * KnotsPerMetrePerSecond);
+        if (speed > speedDeviation) {
+            // degrees clockwise from north.
+            double direction = std::atan2(m_east.velocity, m_north.velocity) * 180.0 / M_PI;
+            if (direction < 0) {
+                direction += 360.0;
+            }
+            location.setDirection(direction);
+        }
+    }
+
+    return location;
+}
+
+double PositionFilter::predictedAccuracy(qint64 timestamp) const
+{
+    if (!isValid() || timestamp - m_timestamp > MaximumPredictionInterval) {
+        return qQNaN();
+    }
+
+    Axis east(m_east);
+    Axis north(m_north);
+    const double dt = qMax<qint64>(0, timestamp - m_timestamp) / 1000.0;
+    east.predict(dt);
+    north.predict(dt);
+    return qMax(std::sqrt(qMax(east.p00, north.p00)), m_bestAccuracy);
+}
@@ -0,0 +1,75 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#ifndef POSITIONFILTER_H
+#define POSITIONFILTER_H
+
+#include <QtCore/QtGlobal>
+
+#include "locationtypes.h"
+
+/*
+ * The PositionFilter class fuses the online and offline fixes into one
+ * position with a constant velocity Kalman filter, weighting each fix by
+ * its horizontal accuracy (taken as the standard deviation, in metres).
+ *
+ * The filter works in a local east/north frame in metres around a
+ * nearby origin.  The constant velocity model is separable, so each axis
+ * is filtered on its own.  Speed and direction are only reported once
+ * the fixes have pinned down the velocity.
+ *
+ * A fix which contradicts the estimate restarts the filter from it,
+ * unless it is less accurate than a recent estimate, in which case it
+ * is rejected.  The reported accuracy never drops below that of the best
+ * fix used, as consecutive fixes from the same cells have correlated
+ * errors which the filter would otherwise average away.
+ */
+
+class PositionFilter
+{
+public:
+    PositionFilter();
+
+    void reset();
+    bool isValid() const { return m_timestamp != 0; }
+
+    // returns false if the fix was rejected and the estimate is unchanged.
+    bool update(const Location &fix);
+    Location location() const;
+
+    // the horizontal accuracy the estimate would have at the given time
+    // without another fix, NaN if there is no estimate.
+    double predictedAccuracy(qint64 timestamp) const;
+
+private:
+    struct Axis {
+        void reset(double initialPosition, double variance);
+        void predict(double dt);
+        double innovationVariance(double measurementVariance) const { return p00 + measurementVariance; }
+        void update(double measurement, double measurementVariance);
+
+        double position; // metres from the origin
+        double velocity; // metres per second
+        double p00, p01, p11; // covariance
+    };
+
+    void restart(const Location &fix);
+    void toLocal(double latitude, double longitude, double *x, double *y) const;
+    void moveOrigin();
+
+    Axis m_east;
+    Axis m_north;
+    double m_originLatitude;
+    double m_originLongitude;
+    double m_metresPerDegreeLongitude;
+    double m_bestAccuracy; // of the fixes used since the last restart
+    qint64 m_timestamp; // of the last fix used, 0 if there is no estimate
+};
+
+#endif // POSITIONFILTER_H
@@ -0,0 +1,41 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include "providerclock.h"
+
+#include <QtCore/QDateTime>
+#include <QtCore/QElapsedTimer>
+
+#include <limits.h>
+
+namespace {
+    double speed = 1.0;
+    qint64 startTime = 0;     // clock time when the replay started, 0 unless replaying
+    QElapsedTimer sinceStart; // real time since then
+}
+
+qint64 ProviderClock::currentMSecsSinceEpoch()
+{
+    if (startTime == 0) {
+        return QDateTime::currentMSecsSinceEpoch();
+    }
+    return startTime + qint64(sinceStart.elapsed() * speed);
+}
+
+int ProviderClock::timerInterval(qint64 msecs)
+{
+    return int(qBound<qint64>(0, qint64(msecs / speed), INT_MAX));
+}
+
+void ProviderClock::startReplay(qint64 time, double replaySpeed)
+{
+    speed = replaySpeed > 0 ? replaySpeed : 1.0;
+    startTime = time;
+    sinceStart.start();
+}
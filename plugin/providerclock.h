@@ -0,0 +1,37 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#ifndef PROVIDERCLOCK_H
+#define PROVIDERCLOCK_H
+
+#include <QtGlobal>
+
+/*
+ * The ProviderClock class is the time the provider positions by: fix
+ * timestamps, the query rate limit and the intervals of its timers.  It
+ * is the wall clock, except while a trace is replayed, when it starts at
+ * the time of the trace and runs as many times faster as the replay.
+ *
+ * Timer intervals are given in clock time and converted to the real
+ * time to wait with timerInterval().  Only used from the main thread.
+ */
+
+class ProviderClock
+{
+public:
+    static qint64 currentMSecsSinceEpoch();
+    static int timerInterval(qint64 msecs);
+
+    static void startReplay(qint64 startTime, double speed);
+
+private:
+    ProviderClock();
+};
+
+#endif // PROVIDERCLOCK_H
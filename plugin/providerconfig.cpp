@@ -0,0 +1,139 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include "providerconfig.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSettings>
+#include <QtCore/QStringList>
+
+namespace {
+    const QString MLSConfigFile = QStringLiteral("/etc/gps_xtra.ini");
+    const QString MLSConfigGroup = QStringLiteral("MLS");
+    const QString YandexKeyFile = QStringLiteral("/etc/yandex.key");
+}
+
+ProviderConfig::ProviderConfig(QObject *parent)
+    : QObject(parent)
+    , m_loaded(false)
+{
+    connect(&m_watcher, &QFileSystemWatcher::fileChanged,
+            this, &ProviderConfig::fileChanged);
+    connect(&m_watcher, &QFileSystemWatcher::directoryChanged,
+            this, &ProviderConfig::directoryChanged);
+}
+
+ProviderConfig::~ProviderConfig()
+{
+}
+
+void ProviderConfig::load()
+{
+    if (m_loaded) {
+        return;
+    }
+
+    m_loaded = true;
+    readMlsConfig();
+    readYandexKey();
+    watchFile(MLSConfigFile);
+    watchFile(YandexKeyFile);
+}
+
+bool ProviderConfig::isLoaded() const
+{
+    return m_loaded;
+}
+
+QVariant ProviderConfig::mlsValue(const QString &key, const QVariant &defaultValue) const
+{
+    return m_mlsValues.value(key, defaultValue);
+}
+
+QString ProviderConfig::yandexKey() const
+{
+    return m_yandexKey;
+}
+
+void ProviderConfig::fileChanged(const QString &path)
+{
+    // editors and package updates usually replace the file, which
+    // removes it from the watcher, so watch the new one again.
+    watchFile(path);
+
+    if (path == MLSConfigFile) {
+        qDebug() << "configuration file" << path << "changed, reloading";
+        readMlsConfig();
+        emit mlsConfigChanged();
+    } else if (path == YandexKeyFile) {
+        const QString oldKey = m_yandexKey;
+        readYandexKey();
+        if (m_yandexKey != oldKey) {
+            qDebug() << "key file" << path << "changed, reloading";
+            emit yandexKeyChanged();
+        }
+    }
+}
+
+void ProviderConfig::directoryChanged(const QString &)
+{
+    // a file which did not exist, or whose replacement the watcher missed,
+    // is not watched.  if it exists now, it is new.
+    Q_FOREACH (const QString &path, QStringList() << MLSConfigFile << YandexKeyFile) {
+        if (!m_watcher.files().contains(path) && QFile::exists(path)) {
+            fileChanged(path);
+        }
+    }
+}
+
+void ProviderConfig::readMlsConfig()
+{
+    m_mlsValues.clear();
+
+    QSettings settings(MLSConfigFile, QSettings::IniFormat);
+    settings.beginGroup(MLSConfigGroup);
+    Q_FOREACH (const QString &key, settings.childKeys()) {
+        m_mlsValues.insert(MLSConfigGroup + QLatin1Char('/') + key, settings.value(key));
+    }
+    settings.endGroup();
+}
+
+void ProviderConfig::readYandexKey()
+{
+    m_yandexKey.clear();
+
+    QFile keyFile(YandexKeyFile);
+    if (!keyFile.exists()) {
+        qWarning() << "Key file not exists. Read documentation";
+        return;
+    }
+
+    if (!keyFile.open(QIODevice::ReadOnly)) {
+        qWarning() << "Can't read key file";
+        return;
+    }
+
+    m_yandexKey = QString::fromUtf8(keyFile.readAll()).trimmed();
+    if (m_yandexKey.isEmpty()) {
+        qWarning() << "Key file is empty";
+    }
+}
+
+void ProviderConfig::watchFile(const QString &path)
+{
+    if (!m_watcher.files().contains(path) && QFile::exists(path)) {
+        m_watcher.addPath(path);
+    }
+    const QString directory = QFileInfo(path).absolutePath();
+    if (!m_watcher.directories().contains(directory)) {
+        m_watcher.addPath(directory);
+    }
+}
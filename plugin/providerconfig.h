@@ -0,0 +1,64 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#ifndef PROVIDERCONFIG_H
+#define PROVIDERCONFIG_H
+
+#include <QtCore/QFileSystemWatcher>
+#include <QtCore/QHash>
+#include <QtCore/QObject>
+#include <QtCore/QString>
+#include <QtCore/QVariant>
+
+/*
+ * The ProviderConfig class holds the contents of the provider's
+ * configuration files: the [MLS] section of /etc/gps_xtra.ini and the
+ * Yandex API key in /etc/yandex.key.
+ *
+ * Both files are read once by load() and served from memory after that.
+ * They are only read again when the file system watcher reports that
+ * they changed, in which case mlsConfigChanged() or yandexKeyChanged()
+ * is emitted.  Their directory is watched as well, so that a file which
+ * is only installed after startup is still picked up.
+ */
+
+class ProviderConfig : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ProviderConfig(QObject *parent = 0);
+    ~ProviderConfig();
+
+    void load();
+    bool isLoaded() const;
+
+    QVariant mlsValue(const QString &key, const QVariant &defaultValue = QVariant()) const;
+    QString yandexKey() const;
+
+signals:
+    void mlsConfigChanged();
+    void yandexKeyChanged();
+
+private Q_SLOTS:
+    void fileChanged(const QString &path);
+    void directoryChanged(const QString &path);
+
+private:
+    void readMlsConfig();
+    void readYandexKey();
+    void watchFile(const QString &path);
+
+    QFileSystemWatcher m_watcher;
+    QHash<QString, QVariant> m_mlsValues;
+    QString m_yandexKey;
+    bool m_loaded;
+};
+
+#endif // PROVIDERCONFIG_H
@@ -0,0 +1,118 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include "providerstatistics.h"
+
+#include <QtCore/QAtomicInteger>
+#include <QtCore/QDateTime>
+#include <QtCore/QVariantList>
+
+namespace {
+    const char *const CounterNames[ProviderStatistics::CounterCount] = {
+        "CellCacheHits",
+        "CellCacheMisses",
+        "LearnedCellHits",
+        "OfflineLookups",
+        "BucketBytesRead",
+        "BloomFilterRejections",
+        "OnlineQueriesSent",
+        "OnlineQueriesThrottled",
+        "OnlineQueriesSkipped",
+        "OnlineQueriesTimedOut",
+        "OnlineQueriesFailed",
+        "OnlineQueriesSuperseded",
+        "OnlineResultCacheHits",
+        "KeyFailureLockouts",
+        "FixesOffline",
+        "FixesOnline",
+        "FixesReused",
+        "FixesLost",
+        "RecalculationsTriggered",
+        "RecalculationsSkipped"
+    };
+
+    const char *const HistogramNames[ProviderStatistics::HistogramCount] = {
+        "OfflineLookupMicroseconds",
+        "OnlineRoundTripMilliseconds"
+    };
+
+    struct HistogramData {
+        QAtomicInteger<quint32> buckets[ProviderStatistics::HistogramBuckets];
+        QAtomicInteger<quint32> count;
+        QAtomicInteger<quint64> sum; // microsecond sums would wrap a 32 bit one within the hour
+    };
+
+    // zero-initialised statics, so nothing runs before main().
+    QAtomicInteger<quint32> counters[ProviderStatistics::CounterCount];
+    HistogramData histograms[ProviderStatistics::HistogramCount];
+    qint64 resetTime = 0; // only touched from the main thread
+
+    int bucketOf(qint64 value)
+    {
+        int bucket = 0;
+        while (value > 0 && bucket < ProviderStatistics::HistogramBuckets - 1) {
+            value >>= 1;
+            ++bucket;
+        }
+        return bucket;
+    }
+}
+
+void ProviderStatistics::increment(Counter counter, quint32 amount)
+{
+    counters[counter].fetchAndAddRelaxed(amount);
+}
+
+void ProviderStatistics::record(Histogram histogram, qint64 value)
+{
+    HistogramData &data(histograms[histogram]);
+    data.buckets[bucketOf(value)].fetchAndAddRelaxed(1);
+    data.count.fetchAndAddRelaxed(1);
+    data.sum.fetchAndAddRelaxed(quint64(qMax<qint64>(value, 0)));
+}
+
+QVariantMap ProviderStatistics::snapshot()
+{
+    QVariantMap result;
+    for (int i = 0; i < CounterCount; ++i) {
+        result.insert(QLatin1String(CounterNames[i]), counters[i].load());
+    }
+
+    for (int i = 0; i < HistogramCount; ++i) {
+        const HistogramData &data(histograms[i]);
+        QVariantList buckets;
+        buckets.reserve(HistogramBuckets);
+        for (int bucket = 0; bucket < HistogramBuckets; ++bucket) {
+            buckets.append(data.buckets[bucket].load());
+        }
+        const QString name = QLatin1String(HistogramNames[i]);
+        result.insert(name, buckets);
+        result.insert(name + QStringLiteral("Count"), data.count.load());
+        result.insert(name + QStringLiteral("Sum"), data.sum.load());
+    }
+
+    result.insert(QStringLiteral("ResetTime"), resetTime);
+    return result;
+}
+
+void ProviderStatistics::reset()
+{
+    for (int i = 0; i < CounterCount; ++i) {
+        counters[i].store(0);
+    }
+    for (int i = 0; i < HistogramCount; ++i) {
+        HistogramData &data(histograms[i]);
+        for (int bucket = 0; bucket < HistogramBuckets; ++bucket) {
+            data.buckets[bucket].store(0);
+        }
+        data.count.store(0);
+        data.sum.store(0);
+    }
+    resetTime = QDateTime::currentMSecsSinceEpoch();
+}
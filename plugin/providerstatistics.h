@@ -0,0 +1,73 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#ifndef PROVIDERSTATISTICS_H
+#define PROVIDERSTATISTICS_H
+
+#include <QtCore/QVariantMap>
+#include <QtGlobal>
+
+/*
+ * The ProviderStatistics class collects counters and latency histograms
+ * about how the provider behaves, which are read over D-Bus through the
+ * org.freedesktop.Geoclue.Providers.Yandex.Statistics interface.
+ *
+ * Every value is a relaxed atomic, so recording is cheap enough to stay
+ * enabled in production, and may be done from the cell lookup thread.
+ * Counters wrap around at 2^32.  A snapshot is not taken atomically as
+ * a whole, values recorded while it is taken may or may not be in it.
+ */
+
+class ProviderStatistics
+{
+public:
+    enum Counter {
+        CellCacheHits,          // cell location known (or known to be unknown) without file I/O
+        CellCacheMisses,        // cell location had to be looked up from the data files
+        LearnedCellHits,        // cells located from what online fixes taught us
+        OfflineLookups,         // lookup batches done by the cell database
+        BucketBytesRead,        // data file bytes deserialised, or index records probed
+        BloomFilterRejections,  // keys ruled out of a data file without reading it
+        OnlineQueriesSent,
+        OnlineQueriesThrottled, // not sent because the query rate limit was reached
+        OnlineQueriesSkipped,   // not sent because the filtered position met the clients' needs
+        OnlineQueriesTimedOut,
+        OnlineQueriesFailed,    // network or server errors, including timeouts
+        OnlineQueriesSuperseded, // aborted in flight because a newer query replaced them
+        OnlineResultCacheHits,  // answered from the cache of online results
+        KeyFailureLockouts,     // not sent because the API key was recently rejected
+        FixesOffline,           // positions emitted from the offline estimate
+        FixesOnline,            // positions emitted from the online answer
+        FixesReused,            // previous position emitted again
+        FixesLost,
+        RecalculationsTriggered, // the observation changed, lookups were done
+        RecalculationsSkipped,   // the observation was unchanged, nothing was looked up
+        CounterCount
+    };
+
+    enum Histogram {
+        OfflineLookupMicroseconds,
+        OnlineRoundTripMilliseconds,
+        HistogramCount
+    };
+
+    // bucket 0 holds zero, bucket i > 0 holds [2^(i-1), 2^i), the last bucket everything larger.
+    enum { HistogramBuckets = 24 };
+
+    static void increment(Counter counter, quint32 amount = 1);
+    static void record(Histogram histogram, qint64 value);
+
+    static QVariantMap snapshot();
+    static void reset();
+
+private:
+    ProviderStatistics();
+};
+
+#endif // PROVIDERSTATISTICS_H
@@ -0,0 +1,43 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include "startuptrace.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QElapsedTimer>
+
+namespace {
+    QElapsedTimer startupTimer;
+    qint64 previousPhase = 0;
+    bool finished = false;
+}
+
+void StartupTrace::start()
+{
+    startupTimer.start();
+    previousPhase = 0;
+    finished = false;
+}
+
+void StartupTrace::mark(const char *phase)
+{
+    if (finished || !startupTimer.isValid()) {
+        return;
+    }
+
+    const qint64 elapsed = startupTimer.elapsed();
+    qDebug() << "startup:" << phase << "at" << elapsed << "ms, took" << (elapsed - previousPhase) << "ms";
+    previousPhase = elapsed;
+}
+
+void StartupTrace::finish(const char *phase)
+{
+    mark(phase);
+    finished = true;
+}
@@ -0,0 +1,31 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#ifndef STARTUPTRACE_H
+#define STARTUPTRACE_H
+
+/*
+ * The StartupTrace class logs how long each phase of a D-Bus activation
+ * took, from main() until the first PositionChanged is delivered.  Every
+ * mark() after finish() is ignored, so the trace is written only once
+ * per process.
+ */
+
+class StartupTrace
+{
+public:
+    static void start();
+    static void mark(const char *phase);
+    static void finish(const char *phase);
+
+private:
+    StartupTrace();
+};
+
+#endif // STARTUPTRACE_H
@@ -0,0 +1,64 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include "tokenbucket.h"
+
+#include <QtCore/QtNumeric>
+
+#include <cmath>
+
+TokenBucket::TokenBucket(double tokensPerHour, int burst)
+    : m_tokensPerMsec(0)
+    , m_tokens(0)
+    , m_burst(1)
+    , m_lastRefill(0)
+{
+    setRate(tokensPerHour, burst);
+    m_tokens = m_burst;
+}
+
+void TokenBucket::setRate(double tokensPerHour, int burst)
+{
+    m_tokensPerMsec = qMax(0.0, tokensPerHour) / (60 * 60 * 1000);
+    m_burst = qMax(1, burst);
+    m_tokens = qMin(m_tokens, double(m_burst));
+}
+
+void TokenBucket::refill(qint64 now)
+{
+    if (m_lastRefill != 0 && now > m_lastRefill) {
+        m_tokens = qMin(double(m_burst), m_tokens + (now - m_lastRefill) * m_tokensPerMsec);
+    }
+    m_lastRefill = now;
+}
+
+bool TokenBucket::tryAcquire(qint64 now)
+{
+    refill(now);
+    if (m_tokens < 1.0) {
+        return false;
+    }
+    m_tokens -= 1.0;
+    return true;
+}
+
+qint64 TokenBucket::msecsUntilAvailable(qint64 now) const
+{
+    double tokens = m_tokens;
+    if (m_lastRefill != 0 && now > m_lastRefill) {
+        tokens = qMin(double(m_burst), tokens + (now - m_lastRefill) * m_tokensPerMsec);
+    }
+    if (tokens >= 1.0) {
+        return 0;
+    }
+    if (qFuzzyIsNull(m_tokensPerMsec)) {
+        return -1; // never
+    }
+    return qint64(std::ceil((1.0 - tokens) / m_tokensPerMsec));
+}
@@ -0,0 +1,42 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#ifndef TOKENBUCKET_H
+#define TOKENBUCKET_H
+
+#include <QtCore/QtGlobal>
+
+/*
+ * The TokenBucket class limits the rate of some action.  Tokens are
+ * added at a steady rate, up to the burst size, and each action spends
+ * one.  Starts full.
+ */
+
+class TokenBucket
+{
+public:
+    TokenBucket(double tokensPerHour, int burst);
+
+    void setRate(double tokensPerHour, int burst);
+    double tokensPerHour() const { return m_tokensPerMsec * 60 * 60 * 1000; }
+    int burst() const { return m_burst; }
+
+    bool tryAcquire(qint64 now);
+    qint64 msecsUntilAvailable(qint64 now) const;
+
+private:
+    void refill(qint64 now);
+
+    double m_tokensPerMsec;
+    double m_tokens;
+    int m_burst;
+    qint64 m_lastRefill; // msecs since epoch
+};
+
+#endif // TOKENBUCKET_H
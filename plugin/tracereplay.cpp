@@ -0,0 +1,250 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include "tracereplay.h"
+
+#include "yandexprovider.h"
+#include "yandexonlinelocator.h"
+#include "providerclock.h"
+#include "providerstatistics.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QTextStream>
+#include <QtCore/QVariantMap>
+
+#include <string.h>
+#include <sys/resource.h>
+
+namespace {
+    const int DrainTime = 5000; // 5s, for replies and lookups still in flight after the last event
+
+    qint64 cpuTime()
+    {
+        struct rusage usage;
+        memset(&usage, 0, sizeof(usage));
+        getrusage(RUSAGE_SELF, &usage);
+        return qint64(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000
+                + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000;
+    }
+}
+
+ReplayNetworkAccessManager::ReplayNetworkAccessManager(QObject *parent)
+    : QNetworkAccessManager(parent)
+    , m_requestCount(0)
+    , m_unansweredCount(0)
+{
+}
+
+void ReplayNetworkAccessManager::appendReply(const ObservationTraceRecord &reply)
+{
+    m_replies.append(reply);
+}
+
+QNetworkReply *ReplayNetworkAccessManager::createRequest(Operation op, const QNetworkRequest &request,
+                                                         QIODevice *outgoingData)
+{
+    Q_UNUSED(outgoingData)
+    ++m_requestCount;
+
+    const uint queryFingerprint = request.attribute(YandexOnlineLocator::QueryFingerprintAttribute).toUInt();
+    int index = 0;
+    while (index < m_replies.size() && m_replies.at(index).queryFingerprint != queryFingerprint) {
+        ++index;
+    }
+    if (index == m_replies.size()) {
+        // the replay asked what the recording did not.
+        ++m_unansweredCount;
+        ObservationTraceRecord failure;
+        failure.type = ObservationTraceRecord::OnlineReplyRecord;
+        failure.networkError = QNetworkReply::HostNotFoundError;
+        return new ReplayNetworkReply(op, request, failure, 0, this);
+    }
+
+    const ObservationTraceRecord reply = m_replies.takeAt(index);
+    const int delay = reply.networkError == QNetworkReply::TimeoutError
+            ? -1 : ProviderClock::timerInterval(reply.latency);
+    return new ReplayNetworkReply(op, request, reply, delay, this);
+}
+
+ReplayNetworkReply::ReplayNetworkReply(QNetworkAccessManager::Operation op, const QNetworkRequest &request,
+                                       const ObservationTraceRecord &reply, int delay, QObject *parent)
+    : QNetworkReply(parent)
+    , m_body(reply.body)
+    , m_offset(0)
+    , m_networkError(reply.networkError)
+    , m_httpStatus(reply.httpStatus)
+{
+    setRequest(request);
+    setOperation(op);
+    setUrl(request.url());
+    open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+    if (delay >= 0) {
+        QTimer::singleShot(delay, this, SLOT(deliver()));
+    }
+}
+
+void ReplayNetworkReply::abort()
+{
+    if (isFinished()) {
+        return;
+    }
+    m_body.clear();
+    setError(OperationCanceledError, QStringLiteral("Operation canceled"));
+    finish();
+}
+
+qint64 ReplayNetworkReply::bytesAvailable() const
+{
+    return m_body.size() - m_offset + QNetworkReply::bytesAvailable();
+}
+
+qint64 ReplayNetworkReply::readData(char *data, qint64 maxSize)
+{
+    const qint64 count = qMin<qint64>(maxSize, m_body.size() - m_offset);
+    if (count <= 0) {
+        return isFinished() ? -1 : 0;
+    }
+    memcpy(data, m_body.constData() + m_offset, count);
+    m_offset += count;
+    return count;
+}
+
+void ReplayNetworkReply::deliver()
+{
+    if (isFinished()) {
+        return;
+    }
+    if (m_httpStatus != 0) {
+        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, m_httpStatus);
+    }
+    if (m_networkError != NoError) {
+        setError(static_cast<NetworkError>(m_networkError), QStringLiteral("replayed network error"));
+    }
+    emit metaDataChanged();
+    if (!m_body.isEmpty()) {
+        emit readyRead();
+    }
+    finish();
+}
+
+void ReplayNetworkReply::finish()
+{
+    setFinished(true);
+    emit finished();
+}
+
+TraceReplay::TraceReplay(YandexProvider *provider, QObject *parent)
+    : QObject(parent)
+    , m_provider(provider)
+    , m_network(new ReplayNetworkAccessManager(this))
+    , m_nextEvent(0)
+    , m_replyCount(0)
+    , m_speed(1.0)
+    , m_requiredAccuracy(qQNaN())
+{
+    m_timer.setSingleShot(true);
+    connect(&m_timer, &QTimer::timeout, this, &TraceReplay::replayNext);
+}
+
+bool TraceReplay::open(const QString &fileName)
+{
+    // replies are handed out as queries are made, so set them aside up front.
+    ObservationTraceReader reader;
+    if (!reader.open(fileName)) {
+        return false;
+    }
+    ObservationTraceRecord record;
+    while (reader.readNext(&record)) {
+        if (record.type == ObservationTraceRecord::OnlineReplyRecord) {
+            m_network->appendReply(record);
+            ++m_replyCount;
+        } else {
+            m_events.append(record);
+        }
+    }
+    qDebug() << "Read observation trace" << fileName << "with" << m_events.size()
+             << "observations and" << m_replyCount << "online replies";
+    return !m_events.isEmpty();
+}
+
+void TraceReplay::setSpeed(double speed)
+{
+    m_speed = speed > 0 ? speed : 1.0;
+}
+
+void TraceReplay::setDataDirectory(const QString &path)
+{
+    m_dataDirectory = path;
+}
+
+void TraceReplay::setRequiredAccuracy(double metres)
+{
+    m_requiredAccuracy = metres > 0 ? metres : qQNaN();
+}
+
+void TraceReplay::start()
+{
+    ProviderStatistics::reset();
+    ProviderClock::startReplay(m_events.first().timestamp, m_speed);
+    m_provider->startReplay(m_network, m_dataDirectory, m_requiredAccuracy);
+    m_clock.start();
+    replayNext();
+}
+
+qint64 TraceReplay::traceTime() const
+{
+    // the time in the trace which the replay has reached.
+    return ProviderClock::currentMSecsSinceEpoch();
+}
+
+void TraceReplay::replayNext()
+{
+    while (m_nextEvent < m_events.size() && m_events.at(m_nextEvent).timestamp <= traceTime()) {
+        const ObservationTraceRecord &event(m_events.at(m_nextEvent++));
+        if (event.type == ObservationTraceRecord::CellsRecord) {
+            m_provider->replayCells(event.cells);
+        } else {
+            m_provider->replayAccessPoints(event.accessPoints);
+        }
+    }
+
+    if (m_nextEvent < m_events.size()) {
+        m_timer.start(ProviderClock::timerInterval(m_events.at(m_nextEvent).timestamp - traceTime()));
+    } else {
+        QTimer::singleShot(DrainTime, this, SLOT(report()));
+    }
+}
+
+void TraceReplay::report()
+{
+    const QVariantMap statistics = ProviderStatistics::snapshot();
+    const qint64 traceDuration = m_events.last().timestamp - m_events.first().timestamp;
+
+    QTextStream out(stdout);
+    out << "trace: " << m_events.size() << " observations and " << m_replyCount << " online replies over "
+        << traceDuration << " ms, replayed in " << m_clock.elapsed() << " ms at " << m_speed << "x" << endl;
+    out << "fixes: " << statistics.value(QStringLiteral("FixesOffline")).toUInt() << " offline, "
+        << statistics.value(QStringLiteral("FixesOnline")).toUInt() << " online, "
+        << statistics.value(QStringLiteral("FixesReused")).toUInt() << " reused, "
+        << statistics.value(QStringLiteral("FixesLost")).toUInt() << " lost" << endl;
+    out << "recalculations: " << statistics.value(QStringLiteral("RecalculationsTriggered")).toUInt() << " triggered, "
+        << statistics.value(QStringLiteral("RecalculationsSkipped")).toUInt() << " skipped" << endl;
+    out << "network: " << m_network->requestCount() << " requests ("
+        << m_network->unansweredCount() << " beyond the recording), "
+        << statistics.value(QStringLiteral("OnlineQueriesThrottled")).toUInt() << " throttled, "
+        << statistics.value(QStringLiteral("OnlineQueriesSkipped")).toUInt() << " skipped as accurate enough, "
+        << statistics.value(QStringLiteral("OnlineResultCacheHits")).toUInt() << " answered from cache" << endl;
+    out << "offline: " << statistics.value(QStringLiteral("OfflineLookups")).toUInt() << " lookups, "
+        << statistics.value(QStringLiteral("CellCacheHits")).toUInt() << " cache hits, "
+        << statistics.value(QStringLiteral("LearnedCellHits")).toUInt() << " learned, "
+        << statistics.value(QStringLiteral("CellCacheMisses")).toUInt() << " misses" << endl;
+    out << "cpu: " << cpuTime() << " ms" << endl;
+
+    emit finished();
+}
@@ -0,0 +1,129 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#ifndef TRACEREPLAY_H
+#define TRACEREPLAY_H
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QList>
+#include <QtCore/QObject>
+#include <QtCore/QTimer>
+#include <QtNetwork/QNetworkAccessManager>
+#include <QtNetwork/QNetworkReply>
+
+#include "observationtrace.h"
+
+class YandexProvider;
+
+/*
+ * The ReplayNetworkAccessManager class answers the online queries of a
+ * replay with the replies recorded in the trace.  Each query gets the
+ * first reply recorded for the same query fingerprint, after the recorded
+ * latency in ProviderClock time, so a replay which queries differently
+ * from the recording (say, because of the rate limit) still gets the
+ * right answers.  A recorded timeout is never answered, so that the
+ * locator times out by itself.
+ */
+
+class ReplayNetworkAccessManager : public QNetworkAccessManager
+{
+    Q_OBJECT
+
+public:
+    explicit ReplayNetworkAccessManager(QObject *parent = 0);
+
+    void appendReply(const ObservationTraceRecord &reply);
+
+    int requestCount() const { return m_requestCount; }
+    int unansweredCount() const { return m_unansweredCount; }
+
+protected:
+    QNetworkReply *createRequest(Operation op, const QNetworkRequest &request,
+                                 QIODevice *outgoingData) Q_DECL_OVERRIDE;
+
+private:
+    QList<ObservationTraceRecord> m_replies; // not yet handed out, in recorded order
+    int m_requestCount;
+    int m_unansweredCount; // requests for which no reply was recorded
+};
+
+class ReplayNetworkReply : public QNetworkReply
+{
+    Q_OBJECT
+
+public:
+    ReplayNetworkReply(QNetworkAccessManager::Operation op, const QNetworkRequest &request,
+                       const ObservationTraceRecord &reply, int delay, QObject *parent);
+
+    void abort() Q_DECL_OVERRIDE;
+    qint64 bytesAvailable() const Q_DECL_OVERRIDE;
+    bool isSequential() const Q_DECL_OVERRIDE { return true; }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) Q_DECL_OVERRIDE;
+
+private Q_SLOTS:
+    void deliver();
+
+private:
+    void finish();
+
+    QByteArray m_body;
+    qint64 m_offset;
+    qint32 m_networkError;
+    qint32 m_httpStatus;
+};
+
+/*
+ * The TraceReplay class feeds a recorded observation trace into the
+ * provider, in place of the cell watcher, connman and the network, at
+ * the given speed.  When the trace is over it prints the fixes, network
+ * calls and CPU time of the replay.
+ *
+ * The provider's clock (see ProviderClock) follows the replay, so its
+ * timers, the query rate limit and the fix timestamps run at the same
+ * speed as the trace.
+ */
+
+class TraceReplay : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit TraceReplay(YandexProvider *provider, QObject *parent = 0);
+
+    bool open(const QString &fileName);
+    void setSpeed(double speed);
+    void setDataDirectory(const QString &path);
+    void setRequiredAccuracy(double metres); // as if the client had passed RequiredAccuracy
+    void start();
+
+signals:
+    void finished();
+
+private Q_SLOTS:
+    void replayNext();
+    void report();
+
+private:
+    qint64 traceTime() const;
+
+    YandexProvider *m_provider;
+    ReplayNetworkAccessManager *m_network;
+    QList<ObservationTraceRecord> m_events; // observations, in recorded order
+    int m_nextEvent;
+    int m_replyCount;
+    double m_speed;
+    QString m_dataDirectory;
+    double m_requiredAccuracy;
+    QElapsedTimer m_clock;
+    QTimer m_timer;
+};
+
+#endif // TRACEREPLAY_H
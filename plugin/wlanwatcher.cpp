@@ -0,0 +1,81 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include "wlanwatcher.h"
+
+#include <networkmanager.h>
+#include <networkservice.h>
+
+#include <algorithm>
+
+WlanWatcher::WlanWatcher(QObject *parent)
+    : QObject(parent)
+    , m_networkManager(new NetworkManager(this))
+{
+    connect(m_networkManager, SIGNAL(servicesChanged()), SLOT(servicesChanged()));
+    updateAccessPoints(); // connman may already know networks, before it next reports a change.
+}
+
+WlanWatcher::~WlanWatcher()
+{
+}
+
+QVector<ObservedAccessPoint> WlanWatcher::accessPoints() const
+{
+    return m_accessPoints;
+}
+
+void WlanWatcher::servicesChanged()
+{
+    if (updateAccessPoints()) {
+        emit accessPointsChanged();
+    }
+}
+
+bool WlanWatcher::updateAccessPoints()
+{
+    // returns whether an access point appeared or disappeared.
+    // filter the scan results once, rather than every time they are used.
+    const QVector<NetworkService*> services = m_networkManager->getServices("wifi");
+    QVector<quint64> previousBssids;
+    previousBssids.reserve(m_accessPoints.size());
+    Q_FOREACH (const ObservedAccessPoint &accessPoint, m_accessPoints) {
+        previousBssids.append(accessPoint.bssid);
+    }
+    m_accessPoints.clear();
+    m_accessPoints.reserve(services.size());
+    Q_FOREACH (NetworkService *service, services) {
+        if (service->hidden() || service->name().endsWith(QStringLiteral("_nomap"))) {
+            // https://mozilla.github.io/ichnaea/api/geolocate.html
+            // "Hidden WiFi networks and those whose SSID (clear text name) ends with the string
+            // _nomap must NOT be used for privacy reasons."
+            continue;
+        }
+        ObservedAccessPoint accessPoint;
+        accessPoint.bssid = Observation::bssidFromString(service->bssid());
+        if (accessPoint.bssid == 0) {
+            // "Though in order to get a Bluetooth or WiFi based position estimate at least
+            // two networks need to be provided and for each the macAddress needs to be known."
+            // https://mozilla.github.io/ichnaea/api/geolocate.html#field-definition
+            continue;
+        }
+        accessPoint.frequency = service->frequency();
+        accessPoint.strength = service->strength();
+        m_accessPoints.append(accessPoint);
+    }
+
+    QVector<quint64> bssids;
+    bssids.reserve(m_accessPoints.size());
+    Q_FOREACH (const ObservedAccessPoint &accessPoint, m_accessPoints) {
+        bssids.append(accessPoint.bssid);
+    }
+    std::sort(previousBssids.begin(), previousBssids.end());
+    std::sort(bssids.begin(), bssids.end());
+    return bssids != previousBssids;
+}
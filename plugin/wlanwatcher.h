@@ -0,0 +1,53 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#ifndef WLANWATCHER_H
+#define WLANWATCHER_H
+
+#include <QtCore/QObject>
+#include <QtCore/QVector>
+
+#include "observation.h"
+
+class NetworkManager;
+
+/*
+ * The WlanWatcher class follows the WLAN scan results of connman, for
+ * the online query and the offline access point index alike.
+ *
+ * The scan results are filtered once when they change, so that
+ * accessPoints() only holds those which may be used for positioning.
+ * accessPointsChanged() is only emitted when the set of access points
+ * changes, not for every strength update connman sends.
+ */
+
+class WlanWatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit WlanWatcher(QObject *parent = 0);
+    ~WlanWatcher();
+
+    QVector<ObservedAccessPoint> accessPoints() const;
+
+signals:
+    void accessPointsChanged();
+
+private Q_SLOTS:
+    void servicesChanged();
+
+private:
+    bool updateAccessPoints();
+
+    NetworkManager *m_networkManager;
+    QVector<ObservedAccessPoint> m_accessPoints; // usable access points of the latest scan
+};
+
+#endif // WLANWATCHER_H
@@ -0,0 +1,166 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include "yandexlocationquery.h"
+
+#include <QtCore/QHash>
+
+namespace {
+    const quint32 MaximumAsu = 31; // ofono reports 0 - 31, and 99 if unknown
+    const qint32 AccessPointStrengthOffset = 120; // connman reports 120 + dBm, capped to 0 - 100
+
+    // the service expects signal strengths in dBm.
+    qint32 cellSignalDbm(quint32 asu)
+    {
+        return asu <= MaximumAsu ? -113 + 2 * qint32(asu) : 0; // 3GPP TS 27.007, +CSQ
+    }
+
+    qint32 accessPointSignalDbm(quint16 strength)
+    {
+        return strength > 0 ? qint32(strength) - AccessPointStrengthOffset : 0;
+    }
+
+    void appendJsonString(QByteArray *json, const QByteArray &value)
+    {
+        json->append('"');
+        for (int i = 0; i < value.size(); ++i) {
+            const char c = value.at(i);
+            if (c == '"' || c == '\\') {
+                json->append('\\');
+                json->append(c);
+            } else if (static_cast<uchar>(c) < 0x20) {
+                char escaped[8];
+                qsnprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<uchar>(c));
+                json->append(escaped);
+            } else {
+                json->append(c);
+            }
+        }
+        json->append('"');
+    }
+
+    void appendJsonField(QByteArray *json, const char *name, qint64 value)
+    {
+        json->append('"');
+        json->append(name);
+        json->append("\":");
+        json->append(QByteArray::number(value));
+    }
+}
+
+YandexLocationQuery YandexLocationQuery::fromObservation(const Observation &observation)
+{
+    YandexLocationQuery query;
+    query.addCells(observation.cells());
+    query.addAccessPoints(observation.accessPoints());
+    query.observedCells = observation.cells();
+    return query;
+}
+
+void YandexLocationQuery::addCells(const QVector<ObservedCell> &observedCells)
+{
+    cells.reserve(observedCells.size());
+    Q_FOREACH (const ObservedCell &cell, observedCells) {
+        // gsm_cells takes gsm, wcdma and lte cells alike.
+        switch (cell.uniqueCellId.cellType()) {
+        case MLSDB_CELL_TYPE_LTE:
+        case MLSDB_CELL_TYPE_GSM:
+        case MLSDB_CELL_TYPE_UMTS:
+            break;
+        default:
+            // type currently unsupported by the service, don't add it to the query
+            continue;
+        }
+        if (cell.uniqueCellId.mcc() == 0 || cell.uniqueCellId.mnc() == 0
+                || cell.uniqueCellId.locationCode() == 0 || cell.uniqueCellId.cellId() == 0) {
+            // a cell is only useful if it is fully identified.
+            continue;
+        }
+        Cell queryCell;
+        queryCell.cellId = cell.uniqueCellId.cellId();
+        queryCell.locationAreaCode = cell.uniqueCellId.locationCode();
+        queryCell.mobileCountryCode = cell.uniqueCellId.mcc();
+        queryCell.mobileNetworkCode = cell.uniqueCellId.mnc();
+        queryCell.signalStrength = cellSignalDbm(cell.signalStrength);
+        queryCell.registered = cell.registered;
+        cells.append(queryCell);
+    }
+}
+
+void YandexLocationQuery::addAccessPoints(const QVector<ObservedAccessPoint> &observedAccessPoints)
+{
+    if (observedAccessPoints.size() < 2) {
+        // "The minimum of two networks is a mandatory privacy
+        // restriction for Bluetooth and WiFi based location services."
+        // https://mozilla.github.io/ichnaea/api/geolocate.html#field-definition
+        return;
+    }
+    accessPoints.reserve(observedAccessPoints.size());
+    Q_FOREACH (const ObservedAccessPoint &observed, observedAccessPoints) {
+        AccessPoint accessPoint;
+        accessPoint.bssid = observed.bssid;
+        accessPoint.signalStrength = accessPointSignalDbm(observed.strength);
+        accessPoints.append(accessPoint);
+    }
+}
+
+uint YandexLocationQuery::fingerprint() const
+{
+    return qHash(toJson(QByteArray()));
+}
+
+QByteArray YandexLocationQuery::toJson(const QByteArray &apiKey) const
+{
+    // https://yandex.ru/dev/locator/doc/dg/api/geolocation-api_json.html
+    QByteArray json;
+    json.reserve(64 + apiKey.size() + cells.size() * 96 + accessPoints.size() * 56);
+
+    json.append("{\"common\":{\"version\":\"1.0\",\"api_key\":");
+    appendJsonString(&json, apiKey);
+    json.append('}');
+
+    if (!cells.isEmpty()) {
+        json.append(",\"gsm_cells\":[");
+        for (int i = 0; i < cells.size(); ++i) {
+            const Cell &cell(cells.at(i));
+            json.append(i == 0 ? "{" : ",{");
+            appendJsonField(&json, "countrycode", cell.mobileCountryCode);
+            json.append(',');
+            appendJsonField(&json, "operatorid", cell.mobileNetworkCode);
+            json.append(',');
+            appendJsonField(&json, "cellid", cell.cellId);
+            json.append(',');
+            appendJsonField(&json, "lac", cell.locationAreaCode);
+            if (cell.signalStrength != 0) {
+                json.append(',');
+                appendJsonField(&json, "signal_strength", cell.signalStrength);
+            }
+            json.append('}');
+        }
+        json.append(']');
+    }
+
+    if (!accessPoints.isEmpty()) {
+        json.append(",\"wifi_networks\":[");
+        for (int i = 0; i < accessPoints.size(); ++i) {
+            const AccessPoint &accessPoint(accessPoints.at(i));
+            json.append(i == 0 ? "{\"mac\":" : ",{\"mac\":");
+            appendJsonString(&json, Observation::bssidToString(accessPoint.bssid));
+            if (accessPoint.signalStrength != 0) {
+                json.append(',');
+                appendJsonField(&json, "signal_strength", accessPoint.signalStrength);
+            }
+            json.append('}');
+        }
+        json.append(']');
+    }
+
+    json.append('}');
+    return json;
+}
@@ -0,0 +1,79 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#ifndef YANDEXLOCATIONQUERY_H
+#define YANDEXLOCATIONQUERY_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QDateTime>
+#include <QtCore/QVector>
+
+#include "observation.h"
+
+/*
+ * The YandexLocationQuery struct holds the observations sent to the
+ * Yandex geolocation service in one request, in the form they are
+ * encoded in.  A query with a null timestamp was not performed.
+ *
+ * fromObservation() keeps only the cells and access points the service
+ * accepts, and toJson() encodes the query as the request body.  The
+ * observed cells travel with the query, so that its answer is matched
+ * with the cells it was made from even if newer queries are queued.
+ */
+
+struct YandexLocationQuery
+{
+    struct Cell {
+        quint32 cellId;
+        quint32 locationAreaCode;
+        quint16 mobileCountryCode;
+        quint16 mobileNetworkCode;
+        qint32 signalStrength; // dBm, 0 if unknown
+        bool registered;       // the serving cell
+    };
+
+    struct AccessPoint {
+        quint64 bssid;
+        qint32 signalStrength; // dBm, 0 if unknown
+    };
+
+    static YandexLocationQuery fromObservation(const Observation &observation);
+    QByteArray toJson(const QByteArray &apiKey) const;
+    uint fingerprint() const; // of the request body, without the API key
+
+    bool isNull() const { return timestamp.isNull(); }
+    bool isEmpty() const { return cells.isEmpty() && accessPoints.isEmpty(); }
+
+    bool hasSameCells(const YandexLocationQuery &other) const
+    {
+        if (cells.size() != other.cells.size()) {
+            return false;
+        }
+        for (int i = 0; i < cells.size(); ++i) {
+            if (cells.at(i).cellId != other.cells.at(i).cellId) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    QDateTime timestamp;
+    QVector<Cell> cells;
+    QVector<AccessPoint> accessPoints;
+    QVector<ObservedCell> observedCells; // as observed, so that the answer can be learned from
+
+private:
+    void addCells(const QVector<ObservedCell> &observedCells);
+    void addAccessPoints(const QVector<ObservedAccessPoint> &observedAccessPoints);
+};
+
+Q_DECLARE_TYPEINFO(YandexLocationQuery::Cell, Q_PRIMITIVE_TYPE);
+Q_DECLARE_TYPEINFO(YandexLocationQuery::AccessPoint, Q_PRIMITIVE_TYPE);
+
+#endif // YANDEXLOCATIONQUERY_H
@@ -12,31 +12,56 @@
 */
 
 #include "yandexonlinelocator.h"
+#include "providerclock.h"
+#include "providerstatistics.h"
 
 #include <QtCore/QJsonDocument>
 #include <QtCore/QJsonObject>
 #include <QtCore/QJsonParseError>
 #include <QtCore/QVariantMap>
-#include <QtCore/QTextStream>
 #include <QtCore/QDateTime>
+#include <QtCore/QDataStream>
+#include <QtCore/QDir>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSaveFile>
+#include <QtCore/QStandardPaths>
+#include <QtCore/QtNumeric>
 #include <QtNetwork/QNetworkAccessManager>
 #include <QtNetwork/QNetworkRequest>
 #include <QtNetwork/QNetworkReply>
+#ifndef QT_NO_SSL
+#include <QtNetwork/QSslSocket>
+#endif
 #include <QtCore/QLoggingCategory>
 #include <QtGlobal>
-#include <QSettings>
 
 #include <qofonosimmanager.h>
 #include <qofonoextmodemmanager.h>
-#include <networkmanager.h>
-#include <networkservice.h>
 #include <QFile>
 
-#define REQUEST_REPLY_TIMEOUT_INTERVAL 10000 /* 10 seconds */
+#include <algorithm>
 
-#define REQUEST_TIMESTAMPS_TO_TRACK 10
-#define REQUEST_BASE_ADAPTIVE_INTERVAL 60000 /* 60 seconds */
-#define REQUEST_MODIFY_ADAPTIVE_INTERVAL 10000 /* 10 seconds */
+#define REQUEST_REPLY_TIMEOUT_INTERVAL 10000 /* 10 seconds, until enough replies have been timed */
+#define REQUEST_REPLY_TIMEOUT_MINIMUM 2000 /* 2 seconds */
+#define REQUEST_REPLY_TIMEOUT_MAXIMUM 30000 /* 30 seconds */
+#define REQUEST_LATENCY_MINIMUM_SAMPLES 4
+#define REQUEST_TIMEOUT_GROWTH 1.5 /* the timeout grows by this much for each reply which missed it */
+
+#define REQUEST_RETRY_LIMIT 2
+#define REQUEST_RETRY_BASE_DELAY 500 /* 0.5 seconds, doubled for each attempt */
+
+#define YANDEX_LOCATOR_HOST "api.lbs.yandex.net"
+#define YANDEX_LOCATOR_PATH "/geolocation"
+
+#define REQUEST_REFRESH_INTERVAL 360000 /* 6 minutes, before re-sending an unchanged query */
+#define REQUEST_DEFAULT_RATE 10 /* queries per hour */
+#define REQUEST_DEFAULT_BURST 3
+
+#define RESULT_CACHE_SIZE 256
+#define RESULT_CACHE_LIFETIME (7LL * 24 * 60 * 60 * 1000) /* 7 days */
+#define RESULT_CACHE_MAGIC 0x79636f72 /* "ycor" */
+#define RESULT_CACHE_VERSION 2
+#define RESULT_CACHE_STRONGEST_WLANS 3
 
 /*
  * HTTP requests are sent based on the Mozilla Location Services API.
@@ -45,188 +70,376 @@
 
 namespace {
 const QString KeyFailureTimeKey(QStringLiteral("/mlsprovider/keyfailure_time"));
+const QString MLSConfigQueryRateKey(QStringLiteral("MLS/QUERY_RATE"));
+const QString MLSConfigQueryBurstKey(QStringLiteral("MLS/QUERY_BURST"));
 
-QList<quint32> cellIdsFromQueryData(const QVariantMap &queryData)
+bool useEncryption()
 {
-    QList<quint32> cellIds;
-
-    const QVariantList cellTowers = queryData.value(QLatin1String("cellTowers")).toList();
-    for (const QVariant &ct : cellTowers) {
-        const QVariantMap ctm = ct.toMap();
-        const quint32 cellId = ctm.value(QLatin1String("cellId")).value<quint32>();
-        if (cellId != 0 && !cellIds.contains(cellId)) {
-            cellIds.append(cellId);
+#ifndef QT_NO_SSL
+    // checked, and warned about, once per process rather than once per query.
+    static const bool supported = []() {
+        const bool available = QSslSocket::supportsSsl();
+        if (!available) {
+            qWarning() << "TLS is not available, the Yandex locator will be queried over plain HTTP";
         }
+        return available;
+    }();
+    return supported;
+#else
+    return false;
+#endif
+}
+
+bool isTransientError(QNetworkReply::NetworkError error)
+{
+    // errors which a later attempt may well not run into.
+    switch (error) {
+    case QNetworkReply::RemoteHostClosedError:
+    case QNetworkReply::HostNotFoundError:
+    case QNetworkReply::TimeoutError:
+    case QNetworkReply::TemporaryNetworkFailureError:
+    case QNetworkReply::NetworkSessionFailedError:
+    case QNetworkReply::ProxyTimeoutError:
+    case QNetworkReply::InternalServerError:
+    case QNetworkReply::ServiceUnavailableError:
+    case QNetworkReply::UnknownNetworkError:
+        return true;
+    default:
+        return false;
     }
+}
 
-    return cellIds;
+QString resultCacheFileName()
+{
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).filePath(QStringLiteral("online.cache"));
 }
 }
 
-YandexOnlineLocator::YandexOnlineLocator(QObject *parent)
+YandexOnlineLocator::YandexOnlineLocator(ProviderConfig *config, QObject *parent)
     : QObject(parent)
+    , m_config(config)
     , m_nam(new QNetworkAccessManager(this))
     , m_modemManager(new QOfonoExtModemManager(this))
     , m_simManager(0)
-    , m_networkManager(new NetworkManager(this))
     , m_currentReply(0)
-    , m_fallbacksLacf(true)
-    , m_fallbacksIpf(true)
-    , m_wlanDataAllowed(true)
-    , m_adaptiveInterval(REQUEST_BASE_ADAPTIVE_INTERVAL)
+    , m_timeout(REQUEST_REPLY_TIMEOUT_INTERVAL)
+    , m_requestTime(0)
+    , m_retryCount(0)
+    , m_latencyIndex(0)
+    , m_latencyCount(0)
+    , m_resultCacheDirty(false)
+    , m_waitForWlanInfo(true)
+    , m_queryLimiter(REQUEST_DEFAULT_RATE, REQUEST_DEFAULT_BURST)
     , m_keyFailureTime(KeyFailureTimeKey)
+    , m_traceWriter(0)
+    , m_replaying(false)
 {
-    QString MLSConfigFile = QStringLiteral("/etc/gps_xtra.ini");
-    QSettings settings(MLSConfigFile, QSettings::IniFormat);
-    m_fallbacksLacf = settings.value("MLS/FALLBACKS_LACF", true).toBool();
-    m_fallbacksIpf = settings.value("MLS/FALLBACKS_IPF", true).toBool();
+    connect(m_config, &ProviderConfig::mlsConfigChanged, this, &YandexOnlineLocator::applyConfig);
+    connect(m_config, &ProviderConfig::yandexKeyChanged, this, &YandexOnlineLocator::yandexKeyChanged);
+    applyConfig();
 
-    qDebug() << "MLS_FALLBACKS_LACF" << m_fallbacksLacf
-                            << "MLS_FALLBACKS_IPF" << m_fallbacksIpf;
-
-    connect(m_nam, SIGNAL(finished(QNetworkReply*)), SLOT(requestOnlineLocationFinished(QNetworkReply*)));
     connect(m_modemManager, SIGNAL(enabledModemsChanged(QStringList)), SLOT(enabledModemsChanged(QStringList)));
     connect(m_modemManager, SIGNAL(defaultVoiceModemChanged(QString)), SLOT(defaultVoiceModemChanged(QString)));
-    connect(m_networkManager, SIGNAL(servicesChanged()), SLOT(networkServicesChanged()));
     connect(&m_replyTimer, &QTimer::timeout, this, &YandexOnlineLocator::timeoutReply);
-    m_replyTimer.setInterval(REQUEST_REPLY_TIMEOUT_INTERVAL);
     m_replyTimer.setSingleShot(true);
+    connect(&m_retryTimer, &QTimer::timeout, this, &YandexOnlineLocator::retryQuery);
+    m_retryTimer.setSingleShot(true);
+    m_jitter.seed(uint(QDateTime::currentMSecsSinceEpoch()) ^ uint(quintptr(this)));
+
+    loadResultCache();
 }
 
 YandexOnlineLocator::~YandexOnlineLocator()
 {
+    saveResultCache();
+}
+
+void YandexOnlineLocator::applyConfig()
+{
+    // fleet devices may be allowed to query more often, battery devices less.
+    m_queryLimiter.setRate(m_config->mlsValue(MLSConfigQueryRateKey, REQUEST_DEFAULT_RATE).toDouble(),
+                           m_config->mlsValue(MLSConfigQueryBurstKey, REQUEST_DEFAULT_BURST).toInt());
+    qDebug() << "MLS_QUERY_RATE" << m_queryLimiter.tokensPerHour()
+             << "MLS_QUERY_BURST" << m_queryLimiter.burst();
 }
 
-void YandexOnlineLocator::networkServicesChanged()
+void YandexOnlineLocator::yandexKeyChanged()
 {
-    if (m_wlanDataAllowed) {
-        m_wlanServices = m_networkManager->getServices("wifi");
-        emit wlanChanged();
+    // a rejected key has been replaced, no need to wait out the lockout.
+    qDebug() << "Yandex API key changed, clearing key failure time";
+    m_keyFailureTime.unset();
+}
+
+YandexOnlineLocator::ResultCacheKey YandexOnlineLocator::resultCacheKey(const YandexLocationQuery &query)
+{
+    ResultCacheKey key;
+
+    // the cell the modem is registered to, or failing that (a trace recorded
+    // without registration states), the strongest.  the order of the other cells
+    // is only the order the modem reported them in.
+    const YandexLocationQuery::Cell *servingCell = 0;
+    Q_FOREACH (const YandexLocationQuery::Cell &cell, query.cells) {
+        if (cell.registered) {
+            servingCell = &cell;
+            break;
+        }
+        if (!servingCell || (cell.signalStrength != 0
+                             && (servingCell->signalStrength == 0 || cell.signalStrength > servingCell->signalStrength))) {
+            servingCell = &cell;
+        }
+    }
+    if (servingCell) {
+        key.cellId = servingCell->cellId;
+        key.locationAreaCode = servingCell->locationAreaCode;
+        key.mobileCountryCode = servingCell->mobileCountryCode;
+        key.mobileNetworkCode = servingCell->mobileNetworkCode;
     }
+
+    QVector<QPair<qint32, quint64> > strengths;
+    strengths.reserve(query.accessPoints.size());
+    Q_FOREACH (const YandexLocationQuery::AccessPoint &accessPoint, query.accessPoints) {
+        // strongest first, and those of unknown strength last.
+        strengths.append(qMakePair(accessPoint.signalStrength != 0 ? -accessPoint.signalStrength : 0x7FFFFFFF,
+                                   accessPoint.bssid));
+    }
+    std::sort(strengths.begin(), strengths.end());
+    for (int i = 0; i < strengths.size() && i < RESULT_CACHE_STRONGEST_WLANS; ++i) {
+        key.accessPoints.append(strengths.at(i).second);
+    }
+    std::sort(key.accessPoints.begin(), key.accessPoints.end());
+    return key;
 }
 
-void YandexOnlineLocator::enabledModemsChanged(const QStringList &modems)
+void YandexOnlineLocator::loadResultCache()
 {
-    Q_UNUSED(modems);
-    setupSimManager();
+    QFile file(resultCacheFileName());
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+    quint32 magic = 0, count = 0;
+    qint32 version = 0;
+    in >> magic >> version >> count;
+    if (magic != RESULT_CACHE_MAGIC || version != RESULT_CACHE_VERSION) {
+        qDebug() << "Online result cache format unknown, ignoring";
+        return;
+    }
+
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        ResultCacheKey key;
+        CachedResult result;
+        in >> key.cellId >> key.locationAreaCode >> key.mobileCountryCode >> key.mobileNetworkCode
+           >> key.accessPoints
+           >> result.latitude >> result.longitude >> result.accuracy >> result.timestamp;
+        // results of unknown accuracy were once cached as -1, drop them.
+        if (in.status() == QDataStream::Ok && now - result.timestamp < RESULT_CACHE_LIFETIME
+                && result.accuracy > 0) {
+            m_resultCache.insert(key, result);
+        }
+    }
+    qDebug() << "Loaded" << m_resultCache.size() << "cached online results";
 }
 
-void YandexOnlineLocator::defaultVoiceModemChanged(const QString &modem)
+void YandexOnlineLocator::saveResultCache()
 {
-    Q_UNUSED(modem);
-    setupSimManager();
+    if (!m_resultCacheDirty || m_replaying) {
+        return;
+    }
+
+    QDir().mkpath(QFileInfo(resultCacheFileName()).path());
+    QSaveFile file(resultCacheFileName());
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "Cannot write online result cache:" << file.errorString();
+        return;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << quint32(RESULT_CACHE_MAGIC) << qint32(RESULT_CACHE_VERSION) << quint32(m_resultCache.size());
+    for (QHash<ResultCacheKey, CachedResult>::const_iterator it = m_resultCache.constBegin(); it != m_resultCache.constEnd(); ++it) {
+        const ResultCacheKey &key(it.key());
+        out << key.cellId << key.locationAreaCode << key.mobileCountryCode << key.mobileNetworkCode
+            << key.accessPoints
+            << it->latitude << it->longitude << it->accuracy << it->timestamp;
+    }
+    if (file.commit()) {
+        m_resultCacheDirty = false;
+    } else {
+        qDebug() << "Cannot write online result cache:" << file.errorString();
+    }
 }
 
-bool YandexOnlineLocator::wlanDataAllowed() const
+void YandexOnlineLocator::cacheResult(const ResultCacheKey &key, double latitude, double longitude, double accuracy)
 {
-    return m_wlanDataAllowed;
+    if (key.isNull()) {
+        return;
+    }
+
+    if (m_resultCache.size() >= RESULT_CACHE_SIZE && !m_resultCache.contains(key)) {
+        // make room by dropping the oldest result.
+        QHash<ResultCacheKey, CachedResult>::iterator oldest = m_resultCache.begin();
+        for (QHash<ResultCacheKey, CachedResult>::iterator it = m_resultCache.begin(); it != m_resultCache.end(); ++it) {
+            if (it->timestamp < oldest->timestamp) {
+                oldest = it;
+            }
+        }
+        m_resultCache.erase(oldest);
+    }
+
+    CachedResult result;
+    result.latitude = latitude;
+    result.longitude = longitude;
+    result.accuracy = accuracy;
+    result.timestamp = ProviderClock::currentMSecsSinceEpoch();
+    m_resultCache.insert(key, result);
+    m_resultCacheDirty = true;
 }
 
-void YandexOnlineLocator::setWlanDataAllowed(bool allowed)
+void YandexOnlineLocator::warmUp()
 {
-    if (m_wlanDataAllowed != allowed) {
-        m_wlanDataAllowed = allowed;
-        emit wlanDataAllowedChanged();
+    if (m_replaying) {
+        return;
     }
-    if (m_wlanDataAllowed && m_wlanServices.isEmpty() && m_networkManager) {
-        m_wlanServices = m_networkManager->getServices("wifi");
-        emit wlanChanged();
-    } else if (!m_wlanDataAllowed) {
-        m_wlanServices.clear();
-        emit wlanChanged();
+
+    // open (and for https, handshake) the connection to the service ahead of the
+    // first query.  The access manager keeps it alive and reuses it for queries.
+    const QString host = QStringLiteral(YANDEX_LOCATOR_HOST);
+#ifndef QT_NO_SSL
+    if (useEncryption()) {
+        m_nam->connectToHostEncrypted(host);
+    } else
+#endif
+    {
+        m_nam->connectToHost(host);
     }
+    qDebug() << "Warming up connection to" << host;
+}
+
+void YandexOnlineLocator::releaseConnection()
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 9, 0)
+    if (!m_currentReply) {
+        m_nam->clearConnectionCache();
+    }
+#endif
+}
+
+void YandexOnlineLocator::setTraceWriter(ObservationTraceWriter *writer)
+{
+    m_traceWriter = writer;
+}
+
+void YandexOnlineLocator::startReplay(QNetworkAccessManager *network)
+{
+    // answers come from the trace, not from the service or from earlier sessions.
+    m_replaying = true;
+    m_nam->deleteLater();
+    m_nam = network;
+    m_resultCache.clear();
+    m_resultCacheDirty = false;
+}
+
+void YandexOnlineLocator::enabledModemsChanged(const QStringList &modems)
+{
+    Q_UNUSED(modems);
+    setupSimManager();
+}
+
+void YandexOnlineLocator::defaultVoiceModemChanged(const QString &modem)
+{
+    Q_UNUSED(modem);
+    setupSimManager();
 }
 
-QPair<QDateTime, QVariantMap> YandexOnlineLocator::buildLocationQuery(
-        const QList<YandexProvider::CellPositioningData> &cells,
-        const QPair<QDateTime, QVariantMap> &oldQuery) const
+YandexLocationQuery YandexOnlineLocator::buildLocationQuery(
+        const Observation &observation,
+        const YandexLocationQuery &oldQuery,
+        bool accurateEnough)
 {
-    static bool waitForWlanInfo = true;
     const QDateTime currDt = QDateTime::currentDateTimeUtc();
-    QVariantMap map;
-    map.unite(cellTowerFields(cells));
-    map.unite(wlanAccessPointFields());
+    YandexLocationQuery query = YandexLocationQuery::fromObservation(observation);
 
-    if (map.isEmpty()) {
+    if (query.isEmpty()) {
         // no field data(cell, wifi) available
         qDebug() << "No field data(cell, wifi) available for MLS online request";
-    } else if (!map.contains(QStringLiteral("wifiAccessPoints")) && waitForWlanInfo) {
+    } else if (query.accessPoints.isEmpty() && m_waitForWlanInfo) {
         // it can take some time to receive wlan network info.
         // the MLS online lookup is far more accurate if we have some wlan network info to provide.
         // so, if we have no wlan info, and this was the first request, don't do an online request yet.
         qDebug() << "No wifi data available for MLS online request, postponing";
-        waitForWlanInfo = false;
+        m_waitForWlanInfo = false;
     } else {
-        map.unite(globalFields());
-        map.unite(fallbackFields());
-
         // Only send the query if we have more information than previously
         // or if sufficient time has passed since the last query we performed.
-        const bool firstTimeQuery = oldQuery.first.isNull() || oldQuery.second.isEmpty();
-        const bool intervalExceeded = oldQuery.first.isNull() || oldQuery.first.msecsTo(currDt) >= m_adaptiveInterval;
-        const bool moreInfo = map.keys().size() > oldQuery.second.keys().size();
-        const bool newCells = cellIdsFromQueryData(oldQuery.second) != cellIdsFromQueryData(map);
-
-        if (firstTimeQuery || intervalExceeded || moreInfo || newCells) {
-            // adaptively back-off future requests to avoid server-side throttling.
-            static quint32 backOffFactor = 8;
-
-            // we want to aim for approximately 6 minutes per request.
-            const qint64 deltaMsecs = (m_queryTimestamps.size() < 3)
-                                    ? 0
-                                    : (m_queryTimestamps.first() - m_queryTimestamps.last());
-            const double minutesPerQuery = (m_queryTimestamps.size() < 3)
-                                         ? 6
-                                         : ((deltaMsecs / (1000.0 * 60.0)) / m_queryTimestamps.size());
-            if (minutesPerQuery > 6 || backOffFactor > 64) {
-                // it's been a long time since the last request, reduce the back off factor.
-                backOffFactor = backOffFactor <= 2 ? 1 : (backOffFactor / 2);
-            } else if (minutesPerQuery < 4) {
-                // too many recent requests, increase the back-off factor.
-                backOffFactor = backOffFactor >= 32 ? 64 : (backOffFactor * 2);
-            }
-
-            // max interval will be about 12 minutes (1 + 10.667 minutes).
-            m_adaptiveInterval = REQUEST_BASE_ADAPTIVE_INTERVAL + (REQUEST_MODIFY_ADAPTIVE_INTERVAL * backOffFactor);
-
-            if (backOffFactor == 1 || intervalExceeded) {
-                // return the query data for the request.
-                qDebug() << "Performing MLS online query due to conditions:"
-                                              << "first:" << firstTimeQuery
-                                              << "interval:" << intervalExceeded
-                                              << "info:" << moreInfo
-                                              << "cells:" << newCells;
-                m_queryTimestamps.prepend(QDateTime::currentMSecsSinceEpoch());
-                if (m_queryTimestamps.size() > REQUEST_TIMESTAMPS_TO_TRACK) {
-                    m_queryTimestamps.removeLast();
-                }
-                return qMakePair(currDt, map);
-            } else {
-                qDebug() << "Locally throttling online MLS query due to interval";
-            }
+        const bool firstTimeQuery = oldQuery.isNull() || oldQuery.isEmpty();
+        const bool intervalExceeded = oldQuery.isNull() || oldQuery.timestamp.msecsTo(currDt) >= REQUEST_REFRESH_INTERVAL;
+        const bool moreInfo = (oldQuery.cells.isEmpty() && !query.cells.isEmpty())
+                           || (oldQuery.accessPoints.isEmpty() && !query.accessPoints.isEmpty());
+        const bool newCells = !query.hasSameCells(oldQuery);
+
+        if (accurateEnough && !firstTimeQuery && !intervalExceeded) {
+            // new cells or networks alone don't justify a query while the
+            // filtered position still meets what the clients need.
+            ProviderStatistics::increment(ProviderStatistics::OnlineQueriesSkipped);
+            qDebug() << "Skipping online MLS query, filtered position is accurate enough";
+        } else if (firstTimeQuery || intervalExceeded || moreInfo || newCells) {
+            // return the query data for the request.
+            qDebug() << "Performing MLS online query due to conditions:"
+                                          << "first:" << firstTimeQuery
+                                          << "interval:" << intervalExceeded
+                                          << "info:" << moreInfo
+                                          << "cells:" << newCells;
+            query.timestamp = currDt;
+            return query;
         } else {
             qDebug() << "No required conditions true for online MLS query!";
         }
     }
 
-    return qMakePair(QDateTime(), QVariantMap());
+    return YandexLocationQuery();
+}
+
+bool YandexOnlineLocator::findLocation(const YandexLocationQuery &query)
+{
+    return startQuery(query, false);
 }
 
-bool YandexOnlineLocator::findLocation(const QPair<QDateTime, QVariantMap> &query)
+bool YandexOnlineLocator::startQuery(const YandexLocationQuery &query, bool replacement)
 {
+    // replacement: the query is sent in place of the one it aborted.
+    if (query.isNull()) {
+        return false;
+    }
+
     if (!loadYandexKey()) {
         qDebug() << "Unable to load Yandex API key";
         return false;
     }
 
-    if (m_currentReply) {
-        qDebug() << "Previous request still in progress";
+    // answer locally if we have been here recently.
+    // the whole key is compared on a hit, not just its hash.
+    const ResultCacheKey queryKey = resultCacheKey(query);
+    QHash<ResultCacheKey, CachedResult>::const_iterator cached = m_resultCache.constFind(queryKey);
+    if (!queryKey.isNull() && cached != m_resultCache.constEnd()
+            && ProviderClock::currentMSecsSinceEpoch() - cached->timestamp < RESULT_CACHE_LIFETIME) {
+        qDebug() << "Using cached online result from:" << QDateTime::fromMSecsSinceEpoch(cached->timestamp);
+        ProviderStatistics::increment(ProviderStatistics::OnlineResultCacheHits);
+        // the cached answer was learned from when it was first received.
+        QMetaObject::invokeMethod(this, "locationFound", Qt::QueuedConnection,
+                                  Q_ARG(double, cached->latitude),
+                                  Q_ARG(double, cached->longitude),
+                                  Q_ARG(double, cached->accuracy),
+                                  Q_ARG(QVector<ObservedCell>, QVector<ObservedCell>()));
+        m_pendingQuery = YandexLocationQuery(); // anything still queued is older than this.
         return true;
     }
 
     QString failureTimeString = m_keyFailureTime.value().toString();
 
-    if (!failureTimeString.isEmpty()) {
+    if (!m_replaying && !failureTimeString.isEmpty()) {
         QDateTime failureTime = QDateTime::fromString(failureTimeString, Qt::ISODate);
         if (failureTime.isValid()) {
             QDateTime currentTime = QDateTime::currentDateTimeUtc();
@@ -234,32 +447,82 @@ bool YandexOnlineLocator::findLocation(const QPair<QDateTime, QVariantMap> &quer
 
             if (diff >= 0 && diff < 12*60*60*1000) {
                 qDebug() << "Less than 12 hour old key failure, refusing a new try";
+                ProviderStatistics::increment(ProviderStatistics::KeyFailureLockouts);
                 return false;
             }
         }
     }
 
-    QNetworkRequest req(QUrl("http://api.lbs.yandex.net/geolocation"));
-    req.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
-
-    QJsonObject doc;
+    if (m_currentReply) {
+        // only the latest observation matters, so keep at most one query
+        // waiting behind the one in flight and send it once that one finishes.
+        qDebug() << "Previous request still in progress,"
+                 << (m_pendingQuery.isNull() ? "queueing" : "replacing the queued") << "query";
+        m_pendingQuery = query;
+        if (!m_currentReply->property("replacement").toBool()) {
+            // abort the obsolete request, which sends this one.  a request which
+            // already replaced an aborted one is left to finish, so that an
+            // observation which keeps changing still gets answers.
+            ProviderStatistics::increment(ProviderStatistics::OnlineQueriesSuperseded);
+            m_currentReply->setProperty("superseded", QVariant::fromValue<bool>(true));
+            m_currentReply->abort(); // will emit finished, the finished slot will deleteLater().
+        }
+        return true;
+    }
 
-    QJsonObject common;
-    common["version"] = "1.0";
-    common["api_key"] = m_yandexKey;
-    doc.insert("common",common);
+    // limit the request rate to avoid server-side throttling.  only what
+    // actually goes out spends a token, not what the cache answers.
+    if (!acquireQueryToken()) {
+        return false;
+    }
 
-    /*TODO ADD CELLID and WiFi*/
-    Q_UNUSED(query);
+    // a new query supersedes any retry of an older one.
+    m_retryTimer.stop();
+    m_retryCount = 0;
+    return sendQuery(query, queryKey, replacement);
+}
 
-    const QByteArray json = QJsonDocument(doc).toJson();
+bool YandexOnlineLocator::acquireQueryToken()
+{
+    const qint64 now = ProviderClock::currentMSecsSinceEpoch();
+    if (m_queryLimiter.tryAcquire(now)) {
+        return true;
+    }
+    ProviderStatistics::increment(ProviderStatistics::OnlineQueriesThrottled);
+    qDebug() << "Locally throttling online MLS query, next allowed in"
+             << m_queryLimiter.msecsUntilAvailable(now) << "ms";
+    return false;
+}
 
-    m_currentReply = m_nam->post(req, "json="+json);
-    if (m_currentReply->error() != QNetworkReply::NoError) {
-        qDebug() << "POST request failed:" << m_currentReply->errorString();
+bool YandexOnlineLocator::sendQuery(const YandexLocationQuery &query, const ResultCacheKey &queryKey, bool replacement)
+{
+    QUrl url;
+    url.setScheme(useEncryption() ? QStringLiteral("https") : QStringLiteral("http"));
+    url.setHost(QStringLiteral(YANDEX_LOCATOR_HOST));
+    url.setPath(QStringLiteral(YANDEX_LOCATOR_PATH));
+    QNetworkRequest req(url);
+    req.setHeader(QNetworkRequest::ContentTypeHeader, "application/x-www-form-urlencoded");
+    req.setAttribute(QueryFingerprintAttribute, query.fingerprint());
+
+    const QByteArray json = query.toJson(m_yandexKey.toUtf8());
+
+    QNetworkReply *reply = m_nam->post(req, "json=" + json.toPercentEncoding());
+    if (reply->error() != QNetworkReply::NoError) {
+        qDebug() << "POST request failed:" << reply->errorString();
+        reply->deleteLater();
         return false;
     }
-    m_replyTimer.start();
+    // per reply rather than QNetworkAccessManager::finished(), which replays can't rely on.
+    connect(reply, &QNetworkReply::finished, this, [this, reply]() {
+        requestOnlineLocationFinished(reply);
+    });
+    reply->setProperty("replacement", QVariant::fromValue<bool>(replacement));
+    m_currentReply = reply;
+    m_currentQuery = query;
+    m_currentQueryKey = queryKey;
+    m_replyTimer.start(ProviderClock::timerInterval(m_timeout));
+    m_requestTime = ProviderClock::currentMSecsSinceEpoch();
+    ProviderStatistics::increment(ProviderStatistics::OnlineQueriesSent);
     qDebug() << "Sent request at:" << QDateTime::currentDateTimeUtc().toTime_t() << "with data:" << json;
     return true;
 }
@@ -271,32 +534,160 @@ void YandexOnlineLocator::requestOnlineLocationFinished(QNetworkReply *reply)
         return;
     }
 
+    const qint64 latency = ProviderClock::currentMSecsSinceEpoch() - m_requestTime;
+    const uint queryFingerprint = reply->request().attribute(QueryFingerprintAttribute).toUInt();
+    qDebug() << "Request finished after" << latency << "ms";
+
     QString errorString;
-    if (m_currentReply->property("timedOut").toBool()) {
-        emit error(QStringLiteral("manual timeout"));
+    bool transient = false;
+    const bool superseded = m_currentReply->property("superseded").toBool();
+    if (m_currentReply->property("cancelled").toBool()) {
+        qDebug() << "Request cancelled";
+    } else if (superseded) {
+        qDebug() << "Request superseded by a newer query";
+        if (m_traceWriter) {
+            // keeps the recorded replies in step with the queries when replaying.
+            m_traceWriter->writeOnlineReply(queryFingerprint, QNetworkReply::OperationCanceledError, 0,
+                                            qint32(latency), QByteArray());
+        }
+    } else if (m_currentReply->property("timedOut").toBool()) {
+        // the real latency is only known to be longer than the timeout, so it is
+        // not a sample: counting it as one would ratchet the timeout up to the
+        // maximum.  a slow link still gets a longer timeout, a step at a time.
+        growTimeout();
+        if (m_traceWriter) {
+            m_traceWriter->writeOnlineReply(queryFingerprint, QNetworkReply::TimeoutError, 0,
+                                            qint32(latency), QByteArray());
+        }
+        errorString = QStringLiteral("manual timeout");
+        transient = true;
     } else {
         QByteArray data = m_currentReply->readAll();
+        if (m_traceWriter) {
+            m_traceWriter->writeOnlineReply(queryFingerprint, m_currentReply->error(),
+                                            m_currentReply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt(),
+                                            qint32(latency), data);
+        }
 
         if (m_currentReply->error() == QNetworkReply::NoError) {
-            m_keyFailureTime.unset();
+            recordLatency(latency);
+            ProviderStatistics::record(ProviderStatistics::OnlineRoundTripMilliseconds, latency);
+            if (!m_replaying) {
+                m_keyFailureTime.unset();
+            }
+            m_retryCount = 0;
 
             qDebug() << "MLS response:" << data;
             if (!readServerResponseData(data, &errorString)) {
                 emit error(errorString);
+                errorString.clear();
             }
         } else {
+            if (m_currentReply->attribute(QNetworkRequest::HttpStatusCodeAttribute).isValid()) {
+                recordLatency(latency); // the server did answer.
+                ProviderStatistics::record(ProviderStatistics::OnlineRoundTripMilliseconds, latency);
+            }
             checkError(data);
-            emit error(m_currentReply->errorString());
+            errorString = m_currentReply->errorString();
+            transient = isTransientError(m_currentReply->error());
         }
     }
     m_currentReply->deleteLater();
     m_currentReply = 0;
     m_replyTimer.stop();
+
+    if (!errorString.isEmpty()) {
+        ProviderStatistics::increment(ProviderStatistics::OnlineQueriesFailed);
+        if (transient && m_pendingQuery.isNull() && m_retryCount < REQUEST_RETRY_LIMIT) {
+            // back off exponentially, with jitter so that devices which lost
+            // the network together don't all come back at the same moment.
+            const int delay = REQUEST_RETRY_BASE_DELAY << m_retryCount;
+            m_retryCount++;
+            const int jitteredDelay = delay + int(m_jitter() % uint(delay / 2 + 1));
+            m_retryTimer.start(ProviderClock::timerInterval(jitteredDelay));
+            qDebug() << "Retrying request" << m_retryCount << "of" << REQUEST_RETRY_LIMIT
+                     << "in" << jitteredDelay << "ms after error:" << errorString;
+        } else {
+            emit error(errorString);
+        }
+    }
+
+    if (!m_pendingQuery.isNull()) {
+        const YandexLocationQuery query = m_pendingQuery;
+        m_pendingQuery = YandexLocationQuery();
+        qDebug() << "Sending queued query from:" << query.timestamp;
+        if (!startQuery(query, superseded)) {
+            emit error(QStringLiteral("queued query could not be sent"));
+        }
+    }
+}
+
+void YandexOnlineLocator::retryQuery()
+{
+    if (m_currentReply || m_currentQuery.isNull()) {
+        return;
+    }
+    // retries count against the rate too, the server sees them just the same.
+    // rather than wait for a token, give up: the answer would be stale by then.
+    if (!acquireQueryToken()) {
+        emit error(QStringLiteral("retried query throttled"));
+        return;
+    }
+    if (!sendQuery(m_currentQuery, m_currentQueryKey, false)) {
+        emit error(QStringLiteral("retried query could not be sent"));
+    }
+}
+
+void YandexOnlineLocator::recordLatency(qint64 latency)
+{
+    m_latencies[m_latencyIndex] = latency;
+    m_latencyIndex = (m_latencyIndex + 1) % LatencySamples;
+    m_latencyCount = qMin<int>(m_latencyCount + 1, LatencySamples);
+    if (m_latencyCount < REQUEST_LATENCY_MINIMUM_SAMPLES) {
+        return;
+    }
+
+    // wait for twice the 95th percentile of recent replies, interpolated
+    // between the two samples around it.
+    qint64 samples[LatencySamples];
+    std::copy(m_latencies, m_latencies + m_latencyCount, samples);
+    std::sort(samples, samples + m_latencyCount);
+    const double rank = 0.95 * (m_latencyCount - 1);
+    const int below = int(rank);
+    const int above = qMin(below + 1, m_latencyCount - 1);
+    const double percentile = samples[below] + (rank - below) * (samples[above] - samples[below]);
+    setTimeout(qint64(2 * percentile));
+}
+
+void YandexOnlineLocator::growTimeout()
+{
+    setTimeout(qint64(m_timeout * REQUEST_TIMEOUT_GROWTH));
+}
+
+void YandexOnlineLocator::setTimeout(qint64 timeout)
+{
+    timeout = qBound<qint64>(REQUEST_REPLY_TIMEOUT_MINIMUM, timeout, REQUEST_REPLY_TIMEOUT_MAXIMUM);
+    if (timeout != m_timeout) {
+        qDebug() << "Request timeout is now" << timeout << "ms";
+        m_timeout = timeout;
+    }
+}
+
+void YandexOnlineLocator::cancel()
+{
+    m_pendingQuery = YandexLocationQuery();
+    m_retryTimer.stop();
+    m_retryCount = 0;
+    if (m_currentReply) {
+        m_currentReply->setProperty("cancelled", QVariant::fromValue<bool>(true));
+        m_currentReply->abort(); // will emit finished, the finished slot will deleteLater().
+    }
 }
 
 void YandexOnlineLocator::timeoutReply()
 {
     qDebug() << "Request timed out at:" << QDateTime::currentDateTimeUtc().toTime_t();
+    ProviderStatistics::increment(ProviderStatistics::OnlineQueriesTimedOut);
     m_currentReply->setProperty("timedOut", QVariant::fromValue<bool>(true));
     m_currentReply->abort(); // will emit finished, the finished slot will deleteLater().
 }
@@ -331,15 +722,16 @@ bool YandexOnlineLocator::readServerResponseData(const QByteArray &data, QString
         return false;
     }
 
+    // the radius (in metres) the service thinks the device is within, NaN if it does not say.
     bool accuracyOk = false;
-
-    // Yandex locator dont have accuracy
-    double accuracy = 0.0;
-    //double accuracy = obj.value("accuracy").toVariant().toDouble(&accuracyOk);
-    if (!accuracyOk) {
-        accuracy = -1;
+    double accuracy = location["precision"].toDouble(&accuracyOk);
+    if (!accuracyOk || accuracy <= 0) {
+        accuracy = qQNaN();
+    } else {
+        // an answer of unknown accuracy is not worth reusing.
+        cacheResult(m_currentQueryKey, latitude, longitude, accuracy);
     }
-    emit locationFound(latitude, longitude, accuracy);
+    emit locationFound(latitude, longitude, accuracy, m_currentQuery.observedCells);
     return true;
 }
 
@@ -357,135 +749,12 @@ void YandexOnlineLocator::checkError(const QByteArray &data)
 
     int errorCode = json.object().value(QLatin1String("error")).toObject().value(QLatin1String("code")).toInt();
 
-    if (errorCode == 400) {
+    if (errorCode == 400 && !m_replaying) {
         qWarning() << "Mozilla Location Service failed due to invalid API key, disabling the locator for 12 hours";
         m_keyFailureTime.set(QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
     }
 }
 
-QVariantMap YandexOnlineLocator::globalFields() const
-{
-    QVariantMap map;
-    if (!m_simManager || !m_simManager->isValid()) {
-        return map;
-    }
-    map["carrier"] = m_simManager->serviceProviderName();
-    map["considerIp"] = true;
-    map["homeMobileCountryCode"] = m_simManager->mobileCountryCode();
-    map["homeMobileNetworkCode"] = m_simManager->mobileNetworkCode();
-    return map;
-}
-
-QVariantMap YandexOnlineLocator::cellTowerFields(const QList<YandexProvider::CellPositioningData> &cells) const
-{
-    QVariantMap map;
-    if (!cells.isEmpty()) {
-        QVariantList cellTowers;
-        Q_FOREACH (const YandexProvider::CellPositioningData &cell, cells) {
-            QVariantMap cellTowerMap;
-            // supported radio types: gsm, wcdma or lte
-            switch (cell.uniqueCellId.cellType()) {
-            case MLSDB_CELL_TYPE_LTE:
-                cellTowerMap["radioType"] = "lte";
-                break;
-            case MLSDB_CELL_TYPE_GSM:
-                cellTowerMap["radioType"] = "gsm";
-                break;
-            case MLSDB_CELL_TYPE_UMTS:
-                cellTowerMap["radioType"] = "wcdma";
-                break;
-            default:
-                // type currently unsupported by MLS, don't add it to the field
-                break;
-            }
-            if (cell.uniqueCellId.mcc() != 0) {
-                cellTowerMap["mobileCountryCode"] = cell.uniqueCellId.mcc();
-            }
-            if (cell.uniqueCellId.mnc() != 0) {
-                cellTowerMap["mobileNetworkCode"] = cell.uniqueCellId.mnc();
-            }
-            if (cell.uniqueCellId.locationCode() != 0) {
-                cellTowerMap["locationAreaCode"] = cell.uniqueCellId.locationCode();
-            }
-            if (cell.uniqueCellId.cellId() != 0) {
-                cellTowerMap["cellId"] = cell.uniqueCellId.cellId();
-            }
-            if (cellTowerMap.size() < 5) {
-                // "Cell based position estimates require each cell record to contain
-                // at least the five radioType, mobileCountryCode, mobileNetworkCode,
-                // locationAreaCode and cellId values."
-                // https://mozilla.github.io/ichnaea/api/geolocate.html#field-definition
-                continue;
-            }
-            if (cell.signalStrength != 0) {
-                // "Position estimates do get a lot more precise if in addition to these
-                // unique identifiers at least signalStrength data can be provided for each entry."
-                cellTowerMap["signalStrength"] = cell.signalStrength;
-            }
-            cellTowers.append(cellTowerMap);
-        }
-        if (!cellTowers.isEmpty()) {
-            map["cellTowers"] = cellTowers;
-        }
-    }
-
-    return map;
-}
-
-QVariantMap YandexOnlineLocator::wlanAccessPointFields() const
-{
-    QVariantMap map;
-    if (!m_wlanServices.isEmpty()) {
-        QVariantList wifiInfoList;
-        for (int i = 0; i < m_wlanServices.count(); i++) {
-            NetworkService *service = m_wlanServices.at(i);
-            if (service->hidden() || service->name().endsWith(QStringLiteral("_nomap"))) {
-                // https://mozilla.github.io/ichnaea/api/geolocate.html
-                // "Hidden WiFi networks and those whose SSID (clear text name) ends with the string
-                // _nomap must NOT be used for privacy reasons."
-                continue;
-            }
-            if (service->bssid().isEmpty()) {
-                // "Though in order to get a Bluetooth or WiFi based position estimate at least
-                // two networks need to be provided and for each the macAddress needs to be known."
-                // https://mozilla.github.io/ichnaea/api/geolocate.html#field-definition
-                continue;
-            }
-            QVariantMap wifiInfo;
-            wifiInfo["macAddress"] = service->bssid();
-            wifiInfo["frequency"] = service->frequency();
-            wifiInfo["signalStrength"] = service->strength();
-            wifiInfoList.append(wifiInfo);
-        }
-        if (wifiInfoList.size() >= 2) {
-            // "The minimum of two networks is a mandatory privacy
-            // restriction for Bluetooth and WiFi based location services."
-            // https://mozilla.github.io/ichnaea/api/geolocate.html#field-definition
-            map["wifiAccessPoints"] = wifiInfoList;
-        }
-    }
-
-    return map;
-}
-
-QVariantMap YandexOnlineLocator::fallbackFields() const
-{
-    QVariantMap fallbacks;
-
-    // If no exact cell match can be found, fall back from exact cell position estimates to more
-    // coarse grained cell location area estimates, rather than going directly to an even worse
-    // GeoIP based estimate.
-    fallbacks["lacf"] = m_fallbacksLacf;
-
-    // If no position can be estimated based on any of the provided data points, fall back to an
-    // estimate based on a GeoIP database based on the senders IP address at the time of the query.
-    fallbacks["ipf"] = m_fallbacksIpf;
-
-    QVariantMap map;
-    map["fallbacks"] = fallbacks;
-    return map;
-}
-
 void YandexOnlineLocator::setupSimManager()
 {
     if (!m_simManager) {
@@ -502,28 +771,12 @@ void YandexOnlineLocator::setupSimManager()
     }
 }
 
-
 bool YandexOnlineLocator::loadYandexKey()
 {
-    QFile keyFile("/etc/yandex.key");
-    if(!keyFile.exists()) {
-        qWarning() << "Key file not exists. Read documentation";
-        return false;
-    }
-
-    if(!keyFile.open(QIODevice::ReadOnly)) {
-        qWarning() << "Can't read key file";
-        return false;
+    // the key file is read by the config, and only again when it changes.
+    m_yandexKey = m_config->yandexKey();
+    if (m_yandexKey.isEmpty() && m_replaying) {
+        m_yandexKey = QStringLiteral("replay"); // the replay network does not check it.
     }
-
-    QTextStream in(&keyFile);
-    QString key = in.readAll();
-
-    if(key.isEmpty()) {
-        qWarning() << "Key file is empty";
-        return false;
-    }
-
-    m_yandexKey = key;
-    return true;
+    return !m_yandexKey.isEmpty();
 }
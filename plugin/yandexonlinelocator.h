@@ -16,19 +16,26 @@
 
 #include <QtCore/QObject>
 #include <QtCore/QList>
+#include <QtCore/QHash>
 #include <QtCore/QVector>
 #include <QtCore/QTimer>
+#include <QtNetwork/QNetworkRequest>
 
 #include <MGConfItem>
 
+#include <random>
+
 #include "yandexprovider.h"
+#include "yandexlocationquery.h"
+#include "observation.h"
+#include "tokenbucket.h"
+#include "providerconfig.h"
+#include "observationtrace.h"
 
 QT_FORWARD_DECLARE_CLASS(QNetworkAccessManager)
 QT_FORWARD_DECLARE_CLASS(QNetworkReply)
 class QOfonoExtModemManager;
 class QOfonoSimManager;
-class NetworkManager;
-class NetworkService;
 
 /*
  * The MlsdbOnlineLocator class looks up the current location from the
@@ -38,64 +45,131 @@ class NetworkService;
 class YandexOnlineLocator : public QObject
 {
     Q_OBJECT
-    Q_PROPERTY(bool wlanDataAllowed READ wlanDataAllowed WRITE setWlanDataAllowed NOTIFY wlanDataAllowedChanged)
 
 public:
-    explicit YandexOnlineLocator(QObject *parent = 0);
+    explicit YandexOnlineLocator(ProviderConfig *config, QObject *parent = 0);
     ~YandexOnlineLocator();
 
-    bool wlanDataAllowed() const;
-    void setWlanDataAllowed(bool allowed);
+    YandexLocationQuery buildLocationQuery(
+        const Observation &observation,
+        const YandexLocationQuery &oldQuery,
+        bool accurateEnough = false);
+    bool findLocation(const YandexLocationQuery &query);
+    void cancel();
+
+    void saveResultCache();
+
+    void warmUp();
+    void releaseConnection();
+
+    void setTraceWriter(ObservationTraceWriter *writer);
 
-    QPair<QDateTime, QVariantMap> buildLocationQuery(
-        const QList<YandexProvider::CellPositioningData> &cells,
-        const QPair<QDateTime, QVariantMap> &oldQuery) const;
-    bool findLocation(const QPair<QDateTime, QVariantMap> &request);
+    // replaces the service with a recorded trace, see TraceReplay.
+    void startReplay(QNetworkAccessManager *network);
+
+    // carries the YandexLocationQuery::fingerprint() of each request, so that a
+    // replay answers it with the reply recorded for the same query.
+    static const QNetworkRequest::Attribute QueryFingerprintAttribute = QNetworkRequest::Attribute(QNetworkRequest::User + 1);
 
 signals:
-    void locationFound(double latitude, double longitude, double accuracy);
+    // cells are those the answered query was made from, empty if it was answered from the cache.
+    void locationFound(double latitude, double longitude, double accuracy, const QVector<ObservedCell> &cells);
     void error(const QString &errorString);
-    void wlanChanged();
-    void wlanDataAllowedChanged();
 
 private Q_SLOTS:
-    void networkServicesChanged();
     void enabledModemsChanged(const QStringList &modems);
     void defaultVoiceModemChanged(const QString &modem);
-    void requestOnlineLocationFinished(QNetworkReply *reply);
     void timeoutReply();
+    void retryQuery();
+    void applyConfig();
+    void yandexKeyChanged();
 
 private:
+    // the serving cell and the set of strongest access points identify a place well
+    // enough to re-use an online answer for it.
+    struct ResultCacheKey {
+        ResultCacheKey() : cellId(0), locationAreaCode(0), mobileCountryCode(0), mobileNetworkCode(0) { }
+
+        bool isNull() const { return cellId == 0 && accessPoints.isEmpty(); }
+        bool operator==(const ResultCacheKey &other) const
+        {
+            return cellId == other.cellId && locationAreaCode == other.locationAreaCode
+                    && mobileCountryCode == other.mobileCountryCode
+                    && mobileNetworkCode == other.mobileNetworkCode
+                    && accessPoints == other.accessPoints;
+        }
+        friend uint qHash(const ResultCacheKey &key, uint seed = 0)
+        {
+            seed = qHash(key.cellId, seed);
+            seed = qHash(key.locationAreaCode, seed);
+            seed = qHash(key.mobileCountryCode, seed);
+            seed = qHash(key.mobileNetworkCode, seed);
+            return qHash(key.accessPoints, seed);
+        }
+
+        quint32 cellId; // of the serving cell, 0 if there is none
+        quint32 locationAreaCode;
+        quint16 mobileCountryCode;
+        quint16 mobileNetworkCode;
+        QVector<quint64> accessPoints; // BSSIDs, in ascending order
+    };
+    struct CachedResult {
+        double latitude;
+        double longitude;
+        double accuracy;
+        qint64 timestamp;
+    };
+
+    void requestOnlineLocationFinished(QNetworkReply *reply);
+    bool startQuery(const YandexLocationQuery &query, bool replacement);
+    bool sendQuery(const YandexLocationQuery &query, const ResultCacheKey &queryKey, bool replacement);
+    bool acquireQueryToken();
+    void recordLatency(qint64 latency);
+    void growTimeout();
+    void setTimeout(qint64 timeout);
     bool readServerResponseData(const QByteArray &data, QString *errorString);
     void checkError(const QByteArray &data);
 
-    QVariantMap globalFields() const;
-    QVariantMap cellTowerFields(const QList<YandexProvider::CellPositioningData> &cells) const;
-    QVariantMap wlanAccessPointFields() const;
-    QVariantMap fallbackFields() const;
-
     void setupSimManager();
     bool loadYandexKey();
 
+    static ResultCacheKey resultCacheKey(const YandexLocationQuery &query);
+    void loadResultCache();
+    void cacheResult(const ResultCacheKey &key, double latitude, double longitude, double accuracy);
+
+    ProviderConfig *m_config;
     QNetworkAccessManager *m_nam;
     QOfonoExtModemManager *m_modemManager;
     QOfonoSimManager *m_simManager;
-    NetworkManager *m_networkManager;
     QNetworkReply *m_currentReply;
+    YandexLocationQuery m_currentQuery; // the query last sent, kept for retrying it
+    ResultCacheKey m_currentQueryKey;
+    YandexLocationQuery m_pendingQuery; // latest query held back while m_currentReply is in flight
     QTimer m_replyTimer;
+    qint64 m_timeout;     // of m_replyTimer, in ProviderClock msecs
+    qint64 m_requestTime; // ProviderClock time m_currentReply was sent
+    QTimer m_retryTimer;
+    int m_retryCount;
 
-    QVector<NetworkService*> m_wlanServices;
-    QString m_yandexKey;
+    std::minstd_rand m_jitter; // spreads out the retries
 
-    bool m_fallbacksLacf;
-    bool m_fallbacksIpf;
+    enum { LatencySamples = 64 };
+    qint64 m_latencies[LatencySamples]; // ring buffer of recent reply latencies, ms
+    int m_latencyIndex;
+    int m_latencyCount;
 
-    bool m_wlanDataAllowed;
+    QHash<ResultCacheKey, CachedResult> m_resultCache; // last online answer for each place
+    bool m_resultCacheDirty;
 
-    mutable quint32 m_adaptiveInterval;
-    mutable QVector<qint64> m_queryTimestamps;
+    QString m_yandexKey;
+
+    bool m_waitForWlanInfo; // postpone the first query until wlan info is available
+    TokenBucket m_queryLimiter;
 
     MGConfItem m_keyFailureTime;
+
+    ObservationTraceWriter *m_traceWriter; // owned by the provider, may be null
+    bool m_replaying;
 };
 
 #endif // MLSDBONLINELOCATOR_H
@@ -14,14 +14,17 @@
 #include "yandexprovider.h"
 
 #include "yandexonlinelocator.h"
+#include "wlanwatcher.h"
+#include "startuptrace.h"
+#include "providerclock.h"
+#include "providerstatistics.h"
+#include "cellestimate.h"
 #include "geoclue_adaptor.h"
 #include "position_adaptor.h"
+#include "statistics_adaptor.h"
 
 #include <QtGlobal>
 #include <QtCore/QFile>
-#include <QtCore/QDir>
-#include <QtCore/QDirIterator>
-#include <QtCore/QFileInfoList>
 #include <QtCore/QSharedPointer>
 #include <QtCore/QList>
 #include <QtDBus/QDBusConnection>
@@ -34,46 +37,20 @@
 
 namespace {
     YandexProvider *staticProvider = 0;
-    const int MinimumCalculatedAccuracy = 2500; // 2500 metres - arbitrary but large, manual cell-based triangulation is error-prone.
     const int QuitIdleTime = 30000;             // 30s, plugin process will kill itself if no clients request position updates in this time
     const int FixTimeout = 30000;               // 30s, status will change from Available to Acquiring if no position update can be calculated in this time since last update.
     const quint32 MinimumInterval = 10000;      // 10s, the shortest interval at which the plugin will recalculate position since last update
     const quint32 ReuseInterval = 30000;        // 30s, the amount of time a previously calculated position updates will be re-used for without recalculating new position
-    const quint32 FallbackInterval = 120000;    // 120s, the amount of time a previously calculated position update with high accuracy can supercede a newly calculated low-accuracy position
-    const QString LocationSettingsDir = QStringLiteral("/etc/location/");
-    const QString LocationSettingsFile = QStringLiteral("/etc/location/location.conf");
-    const QString LocationSettingsEnabledKey = QStringLiteral("location/enabled");
-    const QString LocationSettingsMlsEnabledKey = QStringLiteral("location/mls/enabled");
-    const QString LocationSettingsMlsOnlineEnabledKey = QStringLiteral("location/mls/online_enabled");
-    const QString LocationSettingsOldMlsEnabledKey = QStringLiteral("location/cell_id_positioning_enabled"); // deprecated key
-    const QString LocationSettingsDataSourceOnlineAllowedKey = QStringLiteral("location/allowed_data_sources/online");
-    const QString LocationSettingsDataSourceCellDataAllowedKey = QStringLiteral("location/allowed_data_sources/cell_data");
-    const QString LocationSettingsDataSourceWlanDataAllowedKey = QStringLiteral("location/allowed_data_sources/wlan_data");
-}
-
-QDBusArgument &operator<<(QDBusArgument &argument, const Accuracy &accuracy)
-{
-    const qint32 GeoclueAccuracyLevelPostalcode = 4;
-
-    argument.beginStructure();
-    argument << GeoclueAccuracyLevelPostalcode << accuracy.horizontal() << accuracy.vertical();
-    argument.endStructure();
-    return argument;
-}
-
-const QDBusArgument &operator>>(const QDBusArgument &argument, Accuracy &accuracy)
-{
-    qint32 level;
-    double a;
-
-    argument.beginStructure();
-    argument >> level;
-    argument >> a;
-    accuracy.setHorizontal(a);
-    argument >> a;
-    accuracy.setVertical(a);
-    argument.endStructure();
-    return argument;
+    const quint32 MaximumStationaryInterval = 300000; // 5 min, the longest the recalculation interval is stretched to while nothing observed changes
+    const int DeliveryTolerance = 1000;         // 1s, how early a position update may be delivered to a client relative to its requested interval
+    const QString ProviderObjectPath = QStringLiteral("/org/freedesktop/Geoclue/Providers/Yandex");
+    const QString PositionInterface = QStringLiteral("org.freedesktop.Geoclue.Position");
+    const int MaximumAccessPointEntries = 4096; // access point lookups remembered, before they are all forgotten
+    const QString ReplayService = QStringLiteral("replay"); // the client a replay pretends to have
+    const QString MLSConfigCellCacheSizeKey = QStringLiteral("MLS/CELL_CACHE_SIZE");
+    const QString MLSConfigRaceOfflineKey = QStringLiteral("MLS/RACE_OFFLINE");
+    const QString MLSConfigLearnedCellsKey = QStringLiteral("MLS/LEARNED_CELLS");
+    const QString MLSConfigTraceFileKey = QStringLiteral("MLS/TRACE_FILE");
 }
 
 YandexProvider::YandexProvider(QObject *parent)
@@ -85,34 +62,40 @@ YandexProvider::YandexProvider(QObject *parent)
     m_mlsdbOnlineLocator(0),
     m_onlinePositioningEnabled(false),
     m_onlineDataAllowed(false),
+    m_raceOfflineEstimate(true),
     m_wlanDataAllowed(false),
     m_cellWatcher(Q_NULLPTR),
-    m_signalUpdateCell(false),
-    m_signalUpdateWlan(false)
+    m_wlanWatcher(Q_NULLPTR),
+    m_initialized(false),
+    m_replayNetwork(0),
+    m_cellLocationCacheLoaded(false),
+    m_cellDatabase(new MlsdbCellDatabase),
+    m_mlsdbDataVersion(0),
+    m_dirtyStages(NoStages),
+    m_observationEstimated(false),
+    m_stationaryRounds(0),
+    m_stationaryPlace(0),
+    m_stationaryExtension(0)
 {
     if (staticProvider)
         qFatal("Only a single instance of MlsdbProvider is supported.");
 
     qRegisterMetaType<Location>();
+    qRegisterMetaType<QVector<MlsdbUniqueCellId> >();
+    qRegisterMetaType<QVector<ObservedCell> >();
+    qRegisterMetaType<MlsdbCellLocations>("MlsdbCellLocations");
+    qRegisterMetaType<QVector<quint64> >();
+    qRegisterMetaType<MlsdbAccessPointLocations>("MlsdbAccessPointLocations");
     qDBusRegisterMetaType<Accuracy>();
 
     staticProvider = this;
 
-    connect(&m_locationSettingsWatcher, &QFileSystemWatcher::fileChanged,
-            this, &YandexProvider::updatePositioningEnabled);
-    connect(&m_locationSettingsWatcher, &QFileSystemWatcher::directoryChanged,
-            this, &YandexProvider::updatePositioningEnabled);
-    m_locationSettingsWatcher.addPath(LocationSettingsDir);
-    m_locationSettingsWatcher.addPath(LocationSettingsFile);
-    updatePositioningEnabled();
-
+    // only what is needed to answer D-Bus calls is set up here, so that the
+    // service can be registered as soon as possible after activation.
+    // everything else is done by initialize() once the event loop runs.
     new GeoclueAdaptor(this);
     new PositionAdaptor(this);
-
-    qDebug() << "Yandex Location Services geoclue plugin active";
-    if (m_watchedServices.isEmpty()) {
-        m_idleTimer.start(QuitIdleTime, this);
-    }
+    new StatisticsAdaptor(this);
 
     QDBusConnection connection = QDBusConnection::sessionBus();
     m_watcher = new QDBusServiceWatcher(this);
@@ -121,64 +104,226 @@ YandexProvider::YandexProvider(QObject *parent)
     connect(m_watcher, &QDBusServiceWatcher::serviceUnregistered,
             this, &YandexProvider::serviceUnregistered);
 
+    qDebug() << "Yandex Location Services geoclue plugin active";
+    if (m_watchedServices.isEmpty()) {
+        m_idleTimer.start(QuitIdleTime, this);
+    }
+}
+
+void YandexProvider::initialize()
+{
+    if (m_initialized)
+        return;
+    m_initialized = true;
+
+    m_config.load();
+    connect(&m_config, &ProviderConfig::mlsConfigChanged,
+            this, &YandexProvider::applyMlsConfig);
+    applyMlsConfig();
+
+    // offline lookups do blocking file I/O, keep them off the thread serving D-Bus.
+    m_cellDatabase->moveToThread(&m_cellLookupThread);
+    connect(&m_cellLookupThread, &QThread::finished,
+            m_cellDatabase, &QObject::deleteLater);
+    connect(m_cellDatabase, &MlsdbCellDatabase::ready,
+            this, &YandexProvider::mlsdbDataReady);
+    connect(m_cellDatabase, &MlsdbCellDatabase::cellsLookedUp,
+            this, &YandexProvider::mlsdbCellsLookedUp);
+    connect(m_cellDatabase, &MlsdbCellDatabase::accessPointsLookedUp,
+            this, &YandexProvider::mlsdbAccessPointsLookedUp);
+    connect(m_cellDatabase, &MlsdbCellDatabase::dataChanged,
+            this, &YandexProvider::mlsdbDataChanged);
+    m_cellLookupThread.start(QThread::LowPriority);
+
+    if (m_replayNetwork) {
+        // a replay uses everything the trace recorded.
+        LocationSettingsSnapshot settings;
+        settings.positioningEnabled = settings.cellPositioningEnabled = settings.onlinePositioningEnabled = true;
+        settings.onlineDataAllowed = settings.cellDataAllowed = settings.wlanDataAllowed = true;
+        applyLocationSettings(settings);
+    } else {
+        const QString traceFile = m_config.mlsValue(MLSConfigTraceFileKey).toString();
+        if (!traceFile.isEmpty()) {
+            m_traceWriter.open(traceFile);
+        }
+        // a replay never opens the store, so it learns in memory only.
+        m_learnedCells.open(LearnedCellStore::defaultDirectory());
+
+        connect(&m_locationSettings, &LocationSettings::changed,
+                this, &YandexProvider::updatePositioningEnabled);
+        m_locationSettings.start();
+        updatePositioningEnabled();
+    }
+
     if (m_positioningEnabled) {
         cellularNetworkRegistrationChanged();
     } else {
         qDebug() << "positioning is not currently enabled, idling";
     }
+
+    StartupTrace::mark("provider initialized");
+}
+
+void YandexProvider::applyMlsConfig()
+{
+    m_cellLocationCache.setMaximumEntries(m_config.mlsValue(MLSConfigCellCacheSizeKey,
+                                                            int(CellLocationCache::DefaultMaximumEntries)).toInt());
+    m_raceOfflineEstimate = m_config.mlsValue(MLSConfigRaceOfflineKey, true).toBool();
+    m_learnedCells.setMaximumCells(m_config.mlsValue(MLSConfigLearnedCellsKey,
+                                                     int(LearnedCellStore::DefaultMaximumCells)).toInt());
 }
 
 YandexProvider::~YandexProvider()
 {
+    m_cellLookupThread.quit();
+    m_cellLookupThread.wait();
+    if (!m_initialized)
+        delete m_cellDatabase; // never moved to the lookup thread
+
     if (staticProvider == this)
         staticProvider = 0;
 }
 
-/* TODO: coalesce lookups to avoid unnecessary repeated file I/O */
-bool YandexProvider::searchForCellIdLocation(const MlsdbUniqueCellId &uniqueCellId, MlsdbCoords *coords)
-{
-    // try to find the mlsdb data file which should contain it.
-    // the mlsdb data files are separated into "first digit of location code" directories/buckets.
-    QChar firstDigitAreaCode = QString::number(uniqueCellId.locationCode()).at(0);
-    QDirIterator it("/usr/share/geoclue-provider-mlsdb/", QDirIterator::Subdirectories);
-    while (it.hasNext()) {
-        const QString fname(it.next());
-        if (fname.endsWith(QStringLiteral("/%1/mlsdb.data").arg(firstDigitAreaCode), Qt::CaseInsensitive)) {
-            // found an mlsdb.data file which might contain the cell data.  search it.
-            QFile file(fname);
-            file.open(QIODevice::ReadOnly);
-            QDataStream in(&file);
-            quint32 magic = 0, expectedMagic = (quint32)0xc710cdb;
-            in >> magic;
-            if (magic != 0xc710cdb) {
-                qDebug() << "geoclue-mlsdb data file" << fname << "format unknown:" << magic << "expected:" << expectedMagic;
-                continue; // ignore this file
-            }
-            qint32 version;
-            in >> version;
-            if (version != 3) {
-                qDebug() << "geoclue-mlsdb data file" << fname << "version unknown:" << version;
-                continue; // ignore this file
+bool YandexProvider::searchForCellIdLocations(const QVector<CellPositioningData> &cells)
+{
+    // returns true if the location of any of the cells is still being looked up.
+    bool pending = false;
+    QVector<MlsdbUniqueCellId> uniqueCellIds;
+    Q_FOREACH (const CellPositioningData &cell, cells) {
+        MlsdbCoords coords;
+        if (m_pendingCellLookups.contains(cell.uniqueCellId)) {
+            pending = true; // coalesce with the lookup already in flight.
+        } else if (m_cellLocationCache.lookup(cell.uniqueCellId, &coords) == CellLocationCache::Unknown) {
+            if (m_learnedCells.lookup(cell.uniqueCellId, &coords)) {
+                // what online fixes taught us about this cell takes precedence over the installed data.
+                ProviderStatistics::increment(ProviderStatistics::LearnedCellHits);
+                m_cellLocationCache.insertLocation(cell.uniqueCellId, coords, CellLocationCache::OnlineSource);
+                continue;
             }
+            ProviderStatistics::increment(ProviderStatistics::CellCacheMisses);
+            m_pendingCellLookups.insert(cell.uniqueCellId);
+            uniqueCellIds.append(cell.uniqueCellId);
+            pending = true;
+        } else {
+            ProviderStatistics::increment(ProviderStatistics::CellCacheHits);
+        }
+    }
 
-            QMap<MlsdbUniqueCellId, MlsdbCoords> perLcCellIdToLocations;
-            in >> perLcCellIdToLocations;
-            if (perLcCellIdToLocations.isEmpty()) {
-                qDebug() << "geoclue-mlsdb data file" << fname << "contained no cell locations!";
-            } else {
-                if (perLcCellIdToLocations.contains(uniqueCellId)) {
-                    *coords = perLcCellIdToLocations.value(uniqueCellId);
-                    qDebug() << "geoclue-mlsdb data file" << fname << "contains the location of composed cell id:" << uniqueCellId.toString() << "->" << coords->lat << "," << coords->lon;
-                    return true; // found!
-                } else {
-                    qDebug() << "geoclue-mlsdb data file" << fname << "contains" << perLcCellIdToLocations.size() << "cell locations, but not for:" << uniqueCellId.toString();
-                }
-            }
+    if (!uniqueCellIds.isEmpty()) {
+        QMetaObject::invokeMethod(m_cellDatabase, "requestLookup", Qt::QueuedConnection,
+                                  Q_ARG(QVector<MlsdbUniqueCellId>, uniqueCellIds));
+    }
+    return pending;
+}
+
+void YandexProvider::mlsdbCellsLookedUp(const MlsdbCellLocations &found, const QVector<MlsdbUniqueCellId> &unknown, quint32 dataVersion)
+{
+    m_mlsdbDataVersion = dataVersion;
+
+    // cache the results for future reference.
+    for (MlsdbCellLocations::const_iterator it = found.constBegin(); it != found.constEnd(); ++it) {
+        m_cellLocationCache.insertLocation(it.key(), it.value(), CellLocationCache::OfflineSource);
+        m_pendingCellLookups.remove(it.key());
+    }
+    Q_FOREACH (const MlsdbUniqueCellId &uniqueCellId, unknown) {
+        m_cellLocationCache.insertUnlocatable(uniqueCellId);
+        m_pendingCellLookups.remove(uniqueCellId);
+    }
+
+    // an estimate was waiting for these results.
+    if (m_pendingCellLookups.isEmpty() && m_pendingAccessPointLookups.isEmpty()
+            && (m_dirtyStages & EstimateStage) && m_positioningStarted && m_positioningEnabled) {
+        runPipeline();
+    }
+}
+
+bool YandexProvider::searchForAccessPointLocations(const QVector<ObservedAccessPoint> &accessPoints)
+{
+    // returns true if the location of any of the access points is still being looked up.
+    if (m_accessPointLocations.size() + m_unlocatableAccessPoints.size() > MaximumAccessPointEntries) {
+        m_accessPointLocations.clear();
+        m_unlocatableAccessPoints.clear();
+    }
+
+    bool pending = false;
+    QVector<quint64> bssids;
+    Q_FOREACH (const ObservedAccessPoint &accessPoint, accessPoints) {
+        if (m_pendingAccessPointLookups.contains(accessPoint.bssid)) {
+            pending = true;
+        } else if (!m_accessPointLocations.contains(accessPoint.bssid)
+                   && !m_unlocatableAccessPoints.contains(accessPoint.bssid)) {
+            m_pendingAccessPointLookups.insert(accessPoint.bssid);
+            bssids.append(accessPoint.bssid);
+            pending = true;
         }
     }
 
-    qDebug() << "no geoclue-mlsdb data files contain the location of composed cell id:" << uniqueCellId.toString();
-    return false;
+    if (!bssids.isEmpty()) {
+        QMetaObject::invokeMethod(m_cellDatabase, "requestAccessPointLookup", Qt::QueuedConnection,
+                                  Q_ARG(QVector<quint64>, bssids));
+    }
+    return pending;
+}
+
+void YandexProvider::mlsdbAccessPointsLookedUp(const MlsdbAccessPointLocations &found, const QVector<quint64> &unknown, quint32 dataVersion)
+{
+    m_mlsdbDataVersion = dataVersion;
+
+    for (MlsdbAccessPointLocations::const_iterator it = found.constBegin(); it != found.constEnd(); ++it) {
+        m_accessPointLocations.insert(it.key(), it.value());
+        m_pendingAccessPointLookups.remove(it.key());
+    }
+    Q_FOREACH (quint64 bssid, unknown) {
+        m_unlocatableAccessPoints.insert(bssid);
+        m_pendingAccessPointLookups.remove(bssid);
+    }
+
+    if (m_pendingCellLookups.isEmpty() && m_pendingAccessPointLookups.isEmpty()
+            && (m_dirtyStages & EstimateStage) && m_positioningStarted && m_positioningEnabled) {
+        runPipeline();
+    }
+}
+
+void YandexProvider::mlsdbDataReady(quint32 dataVersion)
+{
+    m_mlsdbDataVersion = dataVersion;
+    loadCellLocationCache();
+}
+
+void YandexProvider::loadCellLocationCache()
+{
+    if (m_cellLocationCacheLoaded || m_mlsdbDataVersion == 0 || m_replayNetwork) {
+        return; // a replay starts cold, and leaves the cache of the device alone.
+    }
+    m_cellLocationCacheLoaded = true;
+    m_cellLocationCache.load(CellLocationCache::defaultFileName(), m_mlsdbDataVersion);
+}
+
+void YandexProvider::saveCellLocationCache()
+{
+    const CellLocationCache::Statistics statistics = m_cellLocationCache.statistics();
+    qDebug() << "cell location cache holds" << m_cellLocationCache.size() << "of" << m_cellLocationCache.maximumEntries()
+             << "entries, hits:" << statistics.hits << "misses:" << statistics.misses
+             << "evictions:" << statistics.evictions << "expirations:" << statistics.expirations;
+
+    if (m_cellLocationCacheLoaded && m_mlsdbDataVersion != 0 && m_cellLocationCache.isDirty()) {
+        m_cellLocationCache.save(CellLocationCache::defaultFileName(), m_mlsdbDataVersion);
+    }
+}
+
+void YandexProvider::mlsdbDataChanged()
+{
+    // installed data packs have changed, forget what we know (and don't know) about cells.
+    // the new data version is reported with the next lookup.
+    m_cellLocationCache.clear();
+    m_accessPointLocations.clear();
+    m_unlocatableAccessPoints.clear();
+    m_mlsdbDataVersion = 0;
+
+    // and search for the current observation again the next round, even if it is unchanged.
+    m_observation = Observation();
+    m_observationEstimated = false;
+    m_dirtyStages |= ObservationStage;
 }
 
 void YandexProvider::AddReference()
@@ -186,6 +331,9 @@ void YandexProvider::AddReference()
     if (!calledFromDBus())
         qFatal("AddReference must only be called from DBus");
 
+    // the first client may call in before the queued initialization has run.
+    initialize();
+
     bool wasInactive = m_watchedServices.isEmpty();
     const QString service = message().service();
     m_watcher->addWatchedService(service);
@@ -193,6 +341,7 @@ void YandexProvider::AddReference()
     if (wasInactive) {
         qDebug() << "new watched service, stopping idle timer.";
         m_idleTimer.stop();
+        StartupTrace::mark("first client reference");
     }
 
     startPositioningIfNeeded();
@@ -243,15 +392,61 @@ void YandexProvider::SetOptions(const QVariantMap &options)
         return;
     }
 
+    if (options.contains(QStringLiteral("RequiredAccuracy"))) {
+        // metres, lets online queries be skipped while the filtered position is good enough.
+        bool ok = false;
+        const double requiredAccuracy = options.value(QStringLiteral("RequiredAccuracy")).toDouble(&ok);
+        m_watchedServices[service].requiredAccuracy = ok && requiredAccuracy > 0 ? requiredAccuracy : qQNaN();
+    }
+
     if (options.contains(QStringLiteral("UpdateInterval"))) {
         m_watchedServices[service].updateInterval =
             options.value(QStringLiteral("UpdateInterval")).toUInt();
 
-        quint32 updateInterval = minimumRequestedUpdateInterval();
-        m_recalculatePositionTimer.start(updateInterval, this);
+        // deliver the next position under the new interval.
+        m_dirtyStages |= EmitStage;
+        startRecalculatePositionTimer(false);
     }
 }
 
+void YandexProvider::startReplay(QNetworkAccessManager *network, const QString &dataDirectory, double requiredAccuracy)
+{
+    // the trace stands in for the cell watcher, connman and the network,
+    // and a client which never goes away for the D-Bus clients.
+    m_replayNetwork = network;
+    if (!dataDirectory.isEmpty()) {
+        m_cellDatabase->setDataDirectory(dataDirectory); // not yet moved to the lookup thread
+    }
+    initialize();
+
+    m_idleTimer.stop();
+    m_watchedServices[ReplayService].referenceCount = 1;
+    m_watchedServices[ReplayService].requiredAccuracy = requiredAccuracy;
+    startPositioningIfNeeded();
+}
+
+void YandexProvider::replayCells(const QVector<CellPositioningData> &cells)
+{
+    m_replayCells = cells;
+    cellularNetworkRegistrationChanged();
+}
+
+void YandexProvider::replayAccessPoints(const QVector<ObservedAccessPoint> &accessPoints)
+{
+    m_replayAccessPoints = accessPoints;
+    wlanNetworksChanged();
+}
+
+QVariantMap YandexProvider::GetStatistics()
+{
+    return ProviderStatistics::snapshot();
+}
+
+void YandexProvider::ResetStatistics()
+{
+    ProviderStatistics::reset();
+}
+
 int YandexProvider::GetPosition(int &timestamp, double &latitude, double &longitude,
                                 double &altitude, Accuracy &accuracy)
 {
@@ -284,73 +479,150 @@ int YandexProvider::GetPosition(int &timestamp, double &latitude, double &longit
 
 void YandexProvider::timerEvent(QTimerEvent *event)
 {
-    //DEBUG
-    calculatePositionAndEmitLocation();
-
     if (event->timerId() == m_idleTimer.timerId()) {
         m_idleTimer.stop();
         qDebug() << "have been idle for too long, quitting";
 //        qApp->quit();
+    } else if (event->timerId() == m_deliveryTimer.timerId()) {
+        m_deliveryTimer.stop();
+        deliverLocation(true);
     } else if (event->timerId() == m_fixLostTimer.timerId()) {
         m_fixLostTimer.stop();
         setStatus(StatusAcquiring);
     } else if (event->timerId() == m_recalculatePositionTimer.timerId()) {
-        const qint64 currTimestamp = QDateTime::currentMSecsSinceEpoch();
         if (!m_positioningEnabled) {
             qDebug() << "positioning is disabled, preventing MLS calculation";
-        } else if (m_currentLocation.timestamp() == 0
-                || ((currTimestamp - m_currentLocation.timestamp()) > ReuseInterval)
-                || m_signalUpdateCell || m_signalUpdateWlan) {
-            qDebug() << "calculating new position information";
-            m_signalUpdateCell = false;
-            m_signalUpdateWlan = false;
-            calculatePositionAndEmitLocation();
         } else {
-            qDebug() << "re-using old position information";
-            setLocation(m_currentLocation);
+            // the same serving cell and access points as in the last round means
+            // we are most likely not moving, so wake up less and less often.
+            // Signal strengths still change the estimate, but not this.
+            const uint place = currentObservation().placeFingerprint();
+            const bool stationary = m_stationaryPlace != 0 && place == m_stationaryPlace;
+            m_stationaryPlace = place;
+            m_dirtyStages |= EmitStage; // clients expect an update every interval.
+            runPipeline();
+            if (stationary || m_stationaryRounds > 0) {
+                startRecalculatePositionTimer(stationary);
+            }
         }
     } else {
         QObject::timerEvent(event);
     }
 }
 
-void YandexProvider::calculatePositionAndEmitLocation()
+void YandexProvider::createOnlineLocatorIfNeeded()
 {
-    const QList<CellPositioningData> cellIds = seenCellIds();
-    if (m_onlinePositioningEnabled) {
-        if (!m_mlsdbOnlineLocator) {
-            m_mlsdbOnlineLocator = new YandexOnlineLocator(this);
-            m_mlsdbOnlineLocator->setWlanDataAllowed(m_wlanDataAllowed);
-            connect(m_mlsdbOnlineLocator, &YandexOnlineLocator::wlanChanged,
-                    this, &YandexProvider::onlineWlanChanged);
-            connect(m_mlsdbOnlineLocator, &YandexOnlineLocator::locationFound,
-                    this, &YandexProvider::onlineLocationFound);
-            connect(m_mlsdbOnlineLocator, &YandexOnlineLocator::error,
-                    this, &YandexProvider::onlineLocationError);
+    if (m_onlinePositioningEnabled && !m_mlsdbOnlineLocator) {
+        m_mlsdbOnlineLocator = new YandexOnlineLocator(&m_config, this);
+        m_mlsdbOnlineLocator->setTraceWriter(&m_traceWriter);
+        if (m_replayNetwork) {
+            m_mlsdbOnlineLocator->startReplay(m_replayNetwork);
+        }
+        connect(m_mlsdbOnlineLocator, &YandexOnlineLocator::locationFound,
+                this, &YandexProvider::onlineLocationFound);
+        connect(m_mlsdbOnlineLocator, &YandexOnlineLocator::error,
+                this, &YandexProvider::onlineLocationError);
+    }
+}
+
+void YandexProvider::runPipeline()
+{
+    // inputs mark the stage they feed as dirty, and each stage which runs marks
+    // the stages after it.  Only dirty stages run: observation snapshot, then
+    // cell lookups and online query, then offline estimate, then emit.
+    createOnlineLocatorIfNeeded();
+
+    // a fix which is too old is refreshed even if nothing observed has changed,
+    // except while stationary: then the cells and networks watchers report any
+    // change, and the stretched wakeups only re-emit the position.
+    const bool stale = m_currentLocation.timestamp() == 0
+            || (m_stationaryRounds == 0
+                && (ProviderClock::currentMSecsSinceEpoch() - m_currentLocation.timestamp()) > ReuseInterval);
+    if (stale) {
+        m_dirtyStages |= ObservationStage;
+    }
+
+    if (m_dirtyStages & ObservationStage) {
+        m_dirtyStages &= ~ObservationStage;
+        const Observation observation = currentObservation();
+        if (stale || observation.fingerprint() != m_observation.fingerprint()) {
+            m_observation = observation;
+            m_observationEstimated = false;
+            m_dirtyStages |= LookupStage | EstimateStage;
+            ProviderStatistics::increment(ProviderStatistics::RecalculationsTriggered);
+        } else {
+            // if we observe exactly what we observed last time, the position can't
+            // have changed meaningfully, so skip all lookup and network work.
+            qDebug() << "observed cells and networks are unchanged";
+            ProviderStatistics::increment(ProviderStatistics::RecalculationsSkipped);
         }
-        const QPair<QDateTime, QVariantMap> query = m_mlsdbOnlineLocator->buildLocationQuery(
-                cellIds, m_previousQuery);
-        if (m_mlsdbOnlineLocator->findLocation(query)) {
-            m_previousQuery = query;
-            return;
+    }
+
+    if (m_dirtyStages & LookupStage) {
+        m_dirtyStages &= ~(LookupStage | EmitStage); // a new position will be emitted instead.
+        qDebug() << "calculating new position information";
+        searchForCellIdLocations(m_observation.cells());
+        searchForAccessPointLocations(m_observation.accessPoints());
+        if (m_onlinePositioningEnabled && m_mlsdbOnlineLocator) {
+            const double required = requiredAccuracy();
+            const bool accurateEnough = !qIsNaN(required)
+                    && m_positionFilter.predictedAccuracy(ProviderClock::currentMSecsSinceEpoch()) <= required;
+            const YandexLocationQuery query = m_mlsdbOnlineLocator->buildLocationQuery(
+                    m_observation, m_previousQuery, accurateEnough);
+            if (m_mlsdbOnlineLocator->findLocation(query)) {
+                m_previousQuery = query;
+                if (m_raceOfflineEstimate) {
+                    // emit the offline estimate as a coarse fix right away, rather than
+                    // waiting for the online answer (or its timeout) on a slow network.
+                    qDebug() << "online query sent, emitting offline estimate meanwhile";
+                } else {
+                    // the estimate is only needed if the query fails.
+                    m_dirtyStages &= ~EstimateStage;
+                }
+            }
         }
     }
 
-    // fall back to using offline position
-    updateLocationFromCells(cellIds);
+    if (m_dirtyStages & EstimateStage) {
+        m_dirtyStages &= ~(EstimateStage | EmitStage);
+        // stays dirty if it has to wait for cell location lookups.
+        updateLocationFromObservation(m_observation);
+    }
+
+    if (m_dirtyStages & EmitStage) {
+        m_dirtyStages &= ~EmitStage;
+        qDebug() << "re-using old position information";
+        ProviderStatistics::increment(ProviderStatistics::FixesReused);
+        setLocation(m_currentLocation);
+    }
 }
 
-void YandexProvider::onlineWlanChanged()
+Observation YandexProvider::currentObservation() const
 {
-    m_signalUpdateWlan = true;
+    return Observation(seenCellIds(), seenAccessPoints());
+}
+
+void YandexProvider::wlanNetworksChanged()
+{
+    if (m_traceWriter.isOpen()) {
+        m_traceWriter.writeAccessPoints(seenAccessPoints());
+    }
+
+    m_dirtyStages |= ObservationStage;
+    if (m_positioningStarted && m_stationaryRounds > 0
+            && currentObservation().placeFingerprint() != m_stationaryPlace) {
+        qDebug() << "wlan networks changed, no longer stationary";
+        startRecalculatePositionTimer(false);
+    }
 }
 
-void YandexProvider::onlineLocationFound(double latitude, double longitude, double accuracy)
+void YandexProvider::onlineLocationFound(double latitude, double longitude, double accuracy,
+                                         const QVector<ObservedCell> &cells)
 {
     qDebug() << "Location from MLS online:" << latitude << longitude << accuracy;
 
     Location deviceLocation;
-    deviceLocation.setTimestamp(QDateTime::currentMSecsSinceEpoch());
+    deviceLocation.setTimestamp(ProviderClock::currentMSecsSinceEpoch());
     deviceLocation.setLatitude(latitude);
     deviceLocation.setLongitude(longitude);
 
@@ -358,7 +630,31 @@ void YandexProvider::onlineLocationFound(double latitude, double longitude, doub
     positionAccuracy.setHorizontal(accuracy);
     deviceLocation.setAccuracy(positionAccuracy);
 
-    setLocation(deviceLocation);
+    learnCellLocations(cells, deviceLocation);
+
+    // when racing the offline estimate, this usually replaces the coarse fix
+    // emitted while the query was in flight.
+    setLocationFromEstimate(deviceLocation, true);
+}
+
+void YandexProvider::learnCellLocations(const QVector<ObservedCell> &cells, const Location &onlineLocation)
+{
+    // the cells seen when the answered query was made are somewhere around the answer.
+    if (cells.isEmpty()) {
+        return;
+    }
+    m_learnedCells.learn(cells, onlineLocation.latitude(), onlineLocation.longitude(),
+                         onlineLocation.accuracy().horizontal(), onlineLocation.timestamp());
+
+    // cells which have now been learned are located from here on, even if the
+    // installed data had no location for them.
+    Q_FOREACH (const ObservedCell &cell, cells) {
+        MlsdbCoords coords;
+        if (!m_pendingCellLookups.contains(cell.uniqueCellId)
+                && m_learnedCells.lookup(cell.uniqueCellId, &coords)) {
+            m_cellLocationCache.insertLocation(cell.uniqueCellId, coords, CellLocationCache::OnlineSource);
+        }
+    }
 }
 
 void YandexProvider::onlineLocationError(const QString &errorString)
@@ -366,18 +662,39 @@ void YandexProvider::onlineLocationError(const QString &errorString)
     qDebug() << "Cannot fetch position from online source:" << errorString
                                     << ", falling back to offline source";
 
-    // fall back to using offline position
-    updateLocationFromCells(seenCellIds());
+    // fall back to using offline position, unless it was already emitted while
+    // racing the query: estimating the same observation again would only repeat it.
+    if (m_observationEstimated) {
+        qDebug() << "offline estimate for this observation was already emitted";
+        return;
+    }
+    m_dirtyStages |= EstimateStage;
+    runPipeline();
+}
+
+QVector<ObservedAccessPoint> YandexProvider::seenAccessPoints() const
+{
+    if (!m_wlanDataAllowed) {
+        return QVector<ObservedAccessPoint>();
+    }
+    if (m_replayNetwork) {
+        return m_replayAccessPoints;
+    }
+    return m_wlanWatcher ? m_wlanWatcher->accessPoints() : QVector<ObservedAccessPoint>();
 }
 
-QList<YandexProvider::CellPositioningData> YandexProvider::seenCellIds() const
+QVector<YandexProvider::CellPositioningData> YandexProvider::seenCellIds() const
 {
-    QList<CellPositioningData> cells;
+    QVector<CellPositioningData> cells;
     if (!m_cellDataAllowed) {
         return cells;
     }
+    if (m_replayNetwork) {
+        return m_replayCells;
+    }
 
     qDebug() << "have" << m_cellWatcher->cells().size() << "neighbouring cells";
+    cells.reserve(m_cellWatcher->cells().size());
     quint32 maxNeighborSignalStrength = 1;
     QSet<MlsdbUniqueCellId> seenCellIds;
     Q_FOREACH (const QSharedPointer<QOfonoExtCell> &c, m_cellWatcher->cells()) {
@@ -410,6 +727,7 @@ QList<YandexProvider::CellPositioningData> YandexProvider::seenCellIds() const
             qDebug() << "have neighbour cell:" << cell.uniqueCellId.toString()
                                             << "with strength:" << c->signalStrength();
             cell.signalStrength = c->signalStrength();
+            cell.registered = c->registered();
             if (cell.signalStrength > maxNeighborSignalStrength) {
                 // used for the cells we're connected to.
                 // if no signal strength data is available from ofono,
@@ -424,106 +742,87 @@ QList<YandexProvider::CellPositioningData> YandexProvider::seenCellIds() const
     return cells;
 }
 
-void YandexProvider::updateLocationFromCells(const QList<CellPositioningData> &cells)
+void YandexProvider::updateLocationFromObservation(const Observation &observation)
 {
-    // determine which cells we have an accurate location for, from MLSDB data.
-    double totalSignalStrength = 0.0;
-    QMap<MlsdbUniqueCellId, MlsdbCoords> cellLocations;
-    Q_FOREACH (const CellPositioningData &cell, cells) {
-        MlsdbCoords cellCoords;
-        if (!m_uniqueCellIdToLocation.contains(cell.uniqueCellId)) {
-            if (m_knownCellIdsWithUnknownLocations.contains(cell.uniqueCellId)) {
-                // we know that we don't know the location of this cellId.  Skip it.
-                continue;
-            } else {
-                // this is a new cell Id that we haven't encountered yet.  Probe it.
-                if (!searchForCellIdLocation(cell.uniqueCellId, &cellCoords)) {
-                    // we now know that we don't know the location of this cellId.
-                    m_knownCellIdsWithUnknownLocations.insert(cell.uniqueCellId);
-                    continue;
-                }
-                // cache the location of the cell id for future reference.
-                m_uniqueCellIdToLocation.insert(cell.uniqueCellId, cellCoords);
-            }
-        } else {
-            cellCoords = m_uniqueCellIdToLocation.value(cell.uniqueCellId);
-        }
-        // we have a known location for this cell.  Update our locations list.
-        cellLocations.insert(cell.uniqueCellId, cellCoords);
-        totalSignalStrength += (1.0 * cell.signalStrength);
+    // the lookup stage searched for the cells and access points of the observation.
+    // if that needed file I/O, calculate the position once the results are known.
+    if (!m_pendingCellLookups.isEmpty() || !m_pendingAccessPointLookups.isEmpty()) {
+        qDebug() << "waiting for cell and access point location lookups to complete";
+        m_dirtyStages |= EstimateStage;
+        return;
     }
+    m_observationEstimated = true;
 
-    if (cellLocations.size() == 0) {
-        qDebug() << "no cell id data to calculate position from";
+    // access points locate the device far more precisely than cells do.
+    Location deviceLocation = estimateLocationFromAccessPoints(observation.accessPoints(), m_accessPointLocations);
+    if (deviceLocation.timestamp() == 0) {
+        deviceLocation = estimateLocationFromCells(observation.cells(), m_cellLocationCache);
+    }
+    if (deviceLocation.timestamp() == 0) {
         return;
-    } else if (cellLocations.size() == 1) {
-        qDebug() << "only one cell id datum to calculate position from, position will be extremely inaccurate";
-    } else if (cellLocations.size() == 2) {
-        qDebug() << "only two cell id data to calculate position from, position will be highly inaccurate";
-    } else {
-        qDebug() << "calculating position from" << cellLocations.size() << "cell id data";
     }
 
-    // now use the current cell and neighboringcell information to triangulate our position.
-    double deviceLatitude = 0.0;
-    double deviceLongitude = 0.0;
-    Q_FOREACH (const CellPositioningData &cell, cells) {
-        if (cellLocations.contains(cell.uniqueCellId)) {
-            const MlsdbCoords &cellCoords(cellLocations.value(cell.uniqueCellId));
-            double weight = (((double)cell.signalStrength) / totalSignalStrength);
-            deviceLatitude += (weight * cellCoords.lat);
-            deviceLongitude += (weight * cellCoords.lon);
-            qDebug() << "have cell:" << cell.uniqueCellId.toString()
-                                            << "with position:" << cellCoords.lat << "," << cellCoords.lon
-                                            << "with strength:" << ((double)cell.signalStrength / totalSignalStrength);
-        } else {
-            qDebug() << "do not know position of cell with id:" << cell.uniqueCellId.toString();
-        }
-    }
+    setLocationFromEstimate(deviceLocation, false);
+}
 
-    Location deviceLocation;
-    if (cellLocations.size()) {
-        // estimate accuracy based on how many cells we have.
-        Accuracy positionAccuracy;
-        positionAccuracy.setHorizontal(qMax(MinimumCalculatedAccuracy,
-                                            10000 - (1000 * cellLocations.size())));
-        deviceLocation.setTimestamp(QDateTime::currentMSecsSinceEpoch());
-        deviceLocation.setLatitude(deviceLatitude);
-        deviceLocation.setLongitude(deviceLongitude);
-        deviceLocation.setAccuracy(positionAccuracy);
-    }
-
-    // and set this as our location if it is at least as accurate as our previous data,
-    // or if the previous data is more than two minutes old.
-    if (m_currentLocation.timestamp() != 0
-            && (QDateTime::currentMSecsSinceEpoch() - m_currentLocation.timestamp()) < FallbackInterval
-            && m_currentLocation.accuracy().horizontal() < deviceLocation.accuracy().horizontal()) {
+void YandexProvider::setLocationFromEstimate(const Location &estimate, bool online)
+{
+    // fuse the estimate with the previous ones, weighted by their accuracy.  The filter
+    // rejects an estimate which contradicts a more accurate position from the last two minutes.
+    if (m_positionFilter.update(estimate)) {
+        ProviderStatistics::increment(online ? ProviderStatistics::FixesOnline
+                                             : ProviderStatistics::FixesOffline);
+        setLocation(m_positionFilter.location());
+    } else {
         qDebug() << "re-using old position information due to better accuracy";
         qDebug() << "preferring:" << m_currentLocation.latitude() << ","
                                                  << m_currentLocation.longitude() << ","
                                                  << m_currentLocation.accuracy().horizontal()
-                                << "over:" << deviceLocation.latitude() << ","
-                                           << deviceLocation.longitude() << ","
-                                           << deviceLocation.accuracy().horizontal();
+                                << "over:" << estimate.latitude() << ","
+                                           << estimate.longitude() << ","
+                                           << estimate.accuracy().horizontal();
+        ProviderStatistics::increment(ProviderStatistics::FixesReused);
         setLocation(m_currentLocation);
-    } else {
-        setLocation(deviceLocation);
     }
 }
 
+double YandexProvider::requiredAccuracy() const
+{
+    // the strictest need of the clients, NaN unless every client has stated one.
+    double required = qQNaN();
+    Q_FOREACH (const ServiceData &data, m_watchedServices) {
+        if (data.referenceCount <= 0) {
+            continue;
+        }
+        if (qIsNaN(data.requiredAccuracy)) {
+            return qQNaN();
+        }
+        required = qIsNaN(required) ? data.requiredAccuracy : qMin(required, data.requiredAccuracy);
+    }
+    return required;
+}
+
 void YandexProvider::setLocation(const Location &location)
 {
+    m_dirtyStages &= ~EmitStage;
     qDebug() << "setting current location to:"
                                     << "ts:" << location.timestamp() << ","
                                     << "lat:" << location.latitude() << "," << "lon:" << location.longitude() << ","
-                                    << "accuracy:" << location.accuracy().horizontal();
+                                    << "accuracy:" << location.accuracy().horizontal() << ","
+                                    << "speed:" << location.speed() << "," << "direction:" << location.direction();
 
     if (location.timestamp() != 0) {
+        if (m_firstFixTimer.isValid()) {
+            qDebug() << "time to first fix:" << m_firstFixTimer.elapsed() << "ms";
+            m_firstFixTimer.invalidate();
+        }
         setStatus(StatusAvailable);
-        m_fixLostTimer.start(FixTimeout, this);
+        m_fixLostTimer.start(ProviderClock::timerInterval(FixTimeout + m_stationaryExtension), this);
         m_lastLocation = m_currentLocation;
     } else {
         qDebug() << "location invalid, lost positioning fix";
+        m_positionFilter.reset();
+        ProviderStatistics::increment(ProviderStatistics::FixesLost);
         m_lastLocation = Location(); // lost fix, reset last location also.
     }
 
@@ -545,28 +844,37 @@ void YandexProvider::serviceUnregistered(const QString &service)
 
 void YandexProvider::updatePositioningEnabled()
 {
-    bool positioningEnabled = false;
-    bool cellPositioningEnabled = false;
-
-    bool onlineDataAllowed = false;
-    bool cellDataAllowed = false;
-    bool wlanDataAllowed = false;
-
-    getEnabled(&positioningEnabled,
-               &cellPositioningEnabled,
-               &m_onlinePositioningEnabled,
-               &onlineDataAllowed,
-               &cellDataAllowed,
-               &wlanDataAllowed);
+    applyLocationSettings(m_locationSettings.snapshot());
+}
 
-    qDebug() << "positioning is" << (positioningEnabled ? "enabled" : "disabled");
-    qDebug() << "device-local cell triangulation positioning is" << (cellPositioningEnabled ? "enabled" : "disabled");
-    qDebug() << "mls online service positioning is" << (m_onlinePositioningEnabled ? "enabled" : "disabled");
+void YandexProvider::applyLocationSettings(const LocationSettingsSnapshot &settings)
+{
+    qDebug() << "positioning is" << (settings.positioningEnabled ? "enabled" : "disabled");
+    qDebug() << "device-local cell triangulation positioning is" << (settings.cellPositioningEnabled ? "enabled" : "disabled");
+    qDebug() << "mls online service positioning is" << (settings.onlinePositioningEnabled ? "enabled" : "disabled");
 
     qDebug() << "now checking MDM data source restrictions...";
 
-    if (m_onlineDataAllowed != onlineDataAllowed) {
-        m_onlineDataAllowed = onlineDataAllowed;
+    // only what actually changed is torn down or set up, and only a change
+    // of the allowed data sources changes what can be observed.
+    if (m_onlinePositioningEnabled != settings.onlinePositioningEnabled) {
+        m_onlinePositioningEnabled = settings.onlinePositioningEnabled;
+        m_dirtyStages |= ObservationStage;
+        if (m_onlinePositioningEnabled && m_positioningStarted) {
+            createOnlineLocatorIfNeeded();
+            m_mlsdbOnlineLocator->warmUp();
+        } else if (!m_onlinePositioningEnabled && m_mlsdbOnlineLocator) {
+            qDebug() << "no longer using the online locator";
+            m_mlsdbOnlineLocator->cancel();
+            m_mlsdbOnlineLocator->deleteLater(); // saves its result cache
+            m_mlsdbOnlineLocator = 0;
+            m_previousQuery = YandexLocationQuery();
+        }
+    }
+
+    if (m_onlineDataAllowed != settings.onlineDataAllowed) {
+        m_onlineDataAllowed = settings.onlineDataAllowed;
+        m_dirtyStages |= ObservationStage;
     }
     if (m_onlineDataAllowed) {
         qDebug() << "allowed to use online data to determine position";
@@ -574,9 +882,10 @@ void YandexProvider::updatePositioningEnabled()
         qDebug() << "not allowed to use online data to determine position";
     }
 
-    if (m_cellDataAllowed != cellDataAllowed) {
-        m_cellDataAllowed = cellDataAllowed;
-        if (!m_cellWatcher && m_cellDataAllowed) {
+    if (m_cellDataAllowed != settings.cellDataAllowed) {
+        m_cellDataAllowed = settings.cellDataAllowed;
+        m_dirtyStages |= ObservationStage;
+        if (!m_cellWatcher && m_cellDataAllowed && !m_replayNetwork) {
             qDebug() << "listening for cell data changes";
             m_cellWatcher = new QOfonoExtCellWatcher(this);
             connect(m_cellWatcher, &QOfonoExtCellWatcher::cellsChanged,
@@ -593,8 +902,24 @@ void YandexProvider::updatePositioningEnabled()
         qDebug() << "not allowed to use adjacent cell id data to determine position";
     }
 
-    if (m_wlanDataAllowed != wlanDataAllowed) {
-        m_wlanDataAllowed = wlanDataAllowed;
+    if (m_wlanDataAllowed != settings.wlanDataAllowed) {
+        m_wlanDataAllowed = settings.wlanDataAllowed;
+        m_dirtyStages |= ObservationStage;
+        if (!m_wlanWatcher && m_wlanDataAllowed && !m_replayNetwork) {
+            // the scans feed the offline access point index as well as the online
+            // query, so they are followed whether or not online positioning is enabled.
+            qDebug() << "listening for wlan network changes";
+            m_wlanWatcher = new WlanWatcher(this);
+            connect(m_wlanWatcher, &WlanWatcher::accessPointsChanged,
+                    this, &YandexProvider::wlanNetworksChanged);
+            if (m_traceWriter.isOpen()) {
+                m_traceWriter.writeAccessPoints(seenAccessPoints());
+            }
+        } else if (m_wlanWatcher && !m_wlanDataAllowed) {
+            qDebug() << "no longer listening for wlan network changes";
+            m_wlanWatcher->deleteLater();
+            m_wlanWatcher = Q_NULLPTR;
+        }
     }
     if (m_wlanDataAllowed) {
         qDebug() << "allowed to use wlan data to determine position";
@@ -602,12 +927,8 @@ void YandexProvider::updatePositioningEnabled()
         qDebug() << "not allowed to use wlan data to determine position";
     }
 
-    if (m_mlsdbOnlineLocator) {
-        m_mlsdbOnlineLocator->setWlanDataAllowed(m_wlanDataAllowed);
-    }
-
     bool previous = m_positioningEnabled;
-    bool enabled = positioningEnabled && cellPositioningEnabled;
+    bool enabled = settings.positioningEnabled && settings.cellPositioningEnabled;
     if (previous == enabled) {
         return;
     }
@@ -626,11 +947,67 @@ void YandexProvider::updatePositioningEnabled()
 
 void YandexProvider::cellularNetworkRegistrationChanged()
 {
-    m_signalUpdateCell = true;
+    if (m_traceWriter.isOpen()) {
+        m_traceWriter.writeCells(seenCellIds());
+    }
+
+    m_dirtyStages |= ObservationStage;
+    if (m_positioningStarted && m_stationaryRounds > 0
+            && currentObservation().placeFingerprint() != m_stationaryPlace) {
+        qDebug() << "serving cell changed, no longer stationary";
+        startRecalculatePositionTimer(false);
+    }
+
+    // start resolving any new cells in the background right away, so that the
+    // next recalculation finds their locations already cached.
+    if (m_positioningEnabled && (m_cellWatcher || m_replayNetwork)) {
+        searchForCellIdLocations(seenCellIds());
+    }
 }
 
 void YandexProvider::emitLocationChanged()
 {
+    // positions are calculated at the fastest rate any client asked for, but
+    // each client only receives them at its own rate.
+    deliverLocation(false);
+}
+
+void YandexProvider::deliverLocation(bool pendingOnly)
+{
+    const qint64 now = ProviderClock::currentMSecsSinceEpoch();
+    const bool fixLost = m_currentLocation.timestamp() == 0;
+    qint64 nextDelivery = -1;
+
+    for (QMap<QString, ServiceData>::iterator it = m_watchedServices.begin(); it != m_watchedServices.end(); ++it) {
+        ServiceData &data(it.value());
+        if (pendingOnly && !data.deliveryPending) {
+            continue;
+        }
+        const qint64 due = data.lastDelivery + data.updateInterval;
+        if (fixLost || data.updateInterval == 0 || now >= due - DeliveryTolerance) {
+            sendPositionChanged(it.key());
+            data.lastDelivery = now;
+            data.deliveryPending = false;
+        } else {
+            // coalesce: the client gets the latest position once its interval is up.
+            data.deliveryPending = true;
+            nextDelivery = nextDelivery < 0 ? due : qMin(nextDelivery, due);
+        }
+    }
+
+    if (nextDelivery >= 0) {
+        m_deliveryTimer.start(ProviderClock::timerInterval(nextDelivery - now), this);
+    } else if (!pendingOnly) {
+        m_deliveryTimer.stop();
+    }
+}
+
+void YandexProvider::sendPositionChanged(const QString &service)
+{
+    if (m_replayNetwork) {
+        return; // nobody to deliver to, the fixes are counted by the statistics.
+    }
+
     PositionFields positionFields = NoPositionFields;
 
     if (!qIsNaN(m_currentLocation.latitude()))
@@ -640,9 +1017,19 @@ void YandexProvider::emitLocationChanged()
     if (!qIsNaN(m_currentLocation.altitude()))
         positionFields |= AltitudePresent;
 
-    emit PositionChanged(positionFields, m_currentLocation.timestamp() / 1000,
-                         m_currentLocation.latitude(), m_currentLocation.longitude(),
-                         m_currentLocation.altitude(), m_currentLocation.accuracy());
+    // a targeted signal, rather than the broadcast PositionChanged of the adaptor,
+    // so that clients which asked for slower updates are not woken up.
+    QDBusMessage signal = QDBusMessage::createTargetedSignal(service, ProviderObjectPath,
+                                                             PositionInterface,
+                                                             QStringLiteral("PositionChanged"));
+    signal << int(positionFields) << int(m_currentLocation.timestamp() / 1000)
+           << m_currentLocation.latitude() << m_currentLocation.longitude()
+           << m_currentLocation.altitude() << QVariant::fromValue(m_currentLocation.accuracy());
+    if (!QDBusConnection::sessionBus().send(signal)) {
+        qDebug() << "failed to deliver position to" << service;
+    } else if (positionFields != NoPositionFields) {
+        StartupTrace::finish("first PositionChanged delivered");
+    }
 }
 
 void YandexProvider::startPositioningIfNeeded()
@@ -663,9 +1050,18 @@ void YandexProvider::startPositioningIfNeeded()
 
     qDebug() << "Starting positioning";
     m_positioningStarted = true;
-    calculatePositionAndEmitLocation();
-    quint32 updateInterval = minimumRequestedUpdateInterval();
-    m_recalculatePositionTimer.start(updateInterval, this);
+    m_firstFixTimer.start();
+    if (!m_cellLocationCacheLoaded) {
+        // builds the data manifest, and then loads the cache.
+        QMetaObject::invokeMethod(m_cellDatabase, "prepare", Qt::QueuedConnection);
+    }
+    createOnlineLocatorIfNeeded();
+    if (m_mlsdbOnlineLocator && m_onlinePositioningEnabled) {
+        m_mlsdbOnlineLocator->warmUp();
+    }
+    m_dirtyStages |= ObservationStage;
+    runPipeline();
+    startRecalculatePositionTimer(false);
 }
 
 void YandexProvider::stopPositioningIfNeeded()
@@ -680,9 +1076,38 @@ void YandexProvider::stopPositioningIfNeeded()
 
     qDebug() << "Stopping positioning";
     m_positioningStarted = false;
+    saveCellLocationCache();
+    if (m_mlsdbOnlineLocator) {
+        m_mlsdbOnlineLocator->cancel();
+        m_mlsdbOnlineLocator->saveResultCache();
+        m_mlsdbOnlineLocator->releaseConnection();
+    }
+    m_firstFixTimer.invalidate();
     setStatus(StatusUnavailable);
     m_fixLostTimer.stop();
     m_recalculatePositionTimer.stop();
+    m_deliveryTimer.stop();
+    m_stationaryRounds = 0;
+    m_stationaryPlace = 0;
+    m_stationaryExtension = 0;
+}
+
+void YandexProvider::startRecalculatePositionTimer(bool stationary)
+{
+    // while stationary, double the interval each round, up to a cap.
+    // otherwise (re)start at the interval the clients asked for.
+    const quint32 requestedInterval = minimumRequestedUpdateInterval();
+    m_stationaryRounds = stationary ? qMin(m_stationaryRounds + 1, 16) : 0;
+    const quint64 stretchedInterval = quint64(requestedInterval) << m_stationaryRounds;
+    const quint32 interval = qMax(requestedInterval,
+                                  quint32(qMin<quint64>(stretchedInterval, MaximumStationaryInterval)));
+    if (stationary) {
+        qDebug() << "stationary for" << m_stationaryRounds << "rounds, next recalculation in" << interval << "ms";
+    }
+
+    // a fix is not lost just because we recalculate it less often.
+    m_stationaryExtension = interval - requestedInterval;
+    m_recalculatePositionTimer.start(ProviderClock::timerInterval(interval), this);
 }
 
 void YandexProvider::setStatus(YandexProvider::Status status)
@@ -694,30 +1119,6 @@ void YandexProvider::setStatus(YandexProvider::Status status)
     emit StatusChanged(m_status);
 }
 
-/*
-    Checks the state of the Location enabled setting,
-    the MLS enabled setting, and the MLS online_enabled setting.
-*/
-void YandexProvider::getEnabled(bool *positioningEnabled, bool *cellPositioningEnabled,
-                               bool *onlinePositioningEnabled, bool *onlineDataAllowed,
-                               bool *cellDataAllowed, bool *wlanDataAllowed)
-{
-    QSettings settings(LocationSettingsFile, QSettings::IniFormat);
-
-    *positioningEnabled = settings.value(LocationSettingsEnabledKey, false).toBool();
-
-    *cellPositioningEnabled = *positioningEnabled
-                            && (settings.value(LocationSettingsMlsEnabledKey, false).toBool()
-                             || settings.value(LocationSettingsOldMlsEnabledKey, false).toBool());
-
-    *onlinePositioningEnabled = *cellPositioningEnabled
-                            && settings.value(LocationSettingsMlsOnlineEnabledKey, false).toBool();
-
-    *onlineDataAllowed = settings.value(LocationSettingsDataSourceOnlineAllowedKey, true).toBool();
-    *cellDataAllowed = settings.value(LocationSettingsDataSourceCellDataAllowedKey, true).toBool();
-    *wlanDataAllowed = settings.value(LocationSettingsDataSourceWlanDataAllowedKey, true).toBool();
-}
-
 quint32 YandexProvider::minimumRequestedUpdateInterval() const
 {
     quint32 updateInterval = UINT_MAX;
@@ -14,19 +14,31 @@
 #ifndef MLSDBPROVIDER_H
 #define MLSDBPROVIDER_H
 
-#include <QtCore/QFileSystemWatcher>
 #include <QtCore/QObject>
 #include <QtCore/QStringList>
 #include <QtCore/QBasicTimer>
+#include <QtCore/QThread>
 #include <QtCore/QList>
+#include <QtCore/QVector>
 #include <QtCore/QSet>
+#include <QtCore/QHash>
 #include <QtCore/QMap>
 #include <QtCore/QDateTime>
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QVariantMap>
 #include <QtDBus/QDBusContext>
 
 #include "locationtypes.h"
 #include "mlsdbserialisation.h"
+#include "mlsdbcelldatabase.h"
+#include "celllocationcache.h"
+#include "learnedcellstore.h"
+#include "yandexlocationquery.h"
+#include "observation.h"
+#include "providerconfig.h"
+#include "locationsettings.h"
+#include "observationtrace.h"
+#include "positionfilter.h"
 
 /*
 // TODO: use RIL to perform RIL_REQUEST_GET_NEIGHBORING_CELL_IDS
@@ -47,7 +59,9 @@ BuildRequires: pkgconfig(android-headers)
 */
 
 QT_FORWARD_DECLARE_CLASS(QDBusServiceWatcher)
+QT_FORWARD_DECLARE_CLASS(QNetworkAccessManager)
 class QOfonoExtCellWatcher;
+class WlanWatcher;
 class YandexOnlineLocator;
 
 /*
@@ -64,10 +78,7 @@ class YandexProvider : public QObject, public QDBusContext
     Q_OBJECT
 
 public:
-    struct CellPositioningData {
-        MlsdbUniqueCellId uniqueCellId;
-        quint32 signalStrength;
-    };
+    typedef ObservedCell CellPositioningData;
 
     explicit YandexProvider(QObject *parent = 0);
     ~YandexProvider();
@@ -102,9 +113,31 @@ public:
     };
     Q_DECLARE_FLAGS(PositionFields, PositionField)
 
+    // Stages of the position calculation, see runPipeline()
+    enum PipelineStage {
+        NoStages = 0x0,
+        ObservationStage = 0x1, // cells, wlan networks or allowed data sources changed
+        LookupStage = 0x2,      // the observation changed, resolve it
+        EstimateStage = 0x4,    // cell locations changed, triangulate
+        EmitStage = 0x8         // the current position is due to be delivered
+    };
+    Q_DECLARE_FLAGS(PipelineStages, PipelineStage)
+
     // org.freedesktop.Geoclue.Position
     int GetPosition(int &timestamp, double &latitude, double &longitude, double &altitude, Accuracy &accuracy);
 
+    // replaces the cell watcher, connman and the network with a recorded trace, see TraceReplay
+    void startReplay(QNetworkAccessManager *network, const QString &dataDirectory, double requiredAccuracy);
+    void replayCells(const QVector<CellPositioningData> &cells);
+    void replayAccessPoints(const QVector<ObservedAccessPoint> &accessPoints);
+
+    // org.freedesktop.Geoclue.Providers.Yandex.Statistics
+    QVariantMap GetStatistics();
+    void ResetStatistics();
+
+public Q_SLOTS:
+    void initialize();
+
 signals:
     // org.freedesktop.Geoclue
     void StatusChanged(int status);
@@ -117,66 +150,108 @@ private Q_SLOTS:
     void serviceUnregistered(const QString &service);
     void updatePositioningEnabled();
     void cellularNetworkRegistrationChanged();
-    void onlineLocationFound(double latitude, double longitude, double accuracy);
+    void onlineLocationFound(double latitude, double longitude, double accuracy, const QVector<ObservedCell> &cells);
     void onlineLocationError(const QString &errorString);
-    void onlineWlanChanged();
+    void wlanNetworksChanged();
+    void mlsdbDataReady(quint32 dataVersion);
+    void mlsdbCellsLookedUp(const MlsdbCellLocations &found, const QVector<MlsdbUniqueCellId> &unknown, quint32 dataVersion);
+    void mlsdbAccessPointsLookedUp(const MlsdbAccessPointLocations &found, const QVector<quint64> &unknown, quint32 dataVersion);
+    void mlsdbDataChanged();
+    void applyMlsConfig();
 
 protected:
     void timerEvent(QTimerEvent *event) Q_DECL_OVERRIDE; // QObject
 
 private:
     void emitLocationChanged();
+    void deliverLocation(bool pendingOnly);
+    void sendPositionChanged(const QString &service);
     void startPositioningIfNeeded();
+    void applyLocationSettings(const LocationSettingsSnapshot &settings);
     void stopPositioningIfNeeded();
     void setStatus(Status status);
-    void getEnabled(bool *positioningEnabled, bool *cellPositioningEnabled,
-                    bool *onlinePositioningEnabled, bool *onlineDataAllowed,
-                    bool *cellDataAllowed, bool *wlanDataAllowed);
     quint32 minimumRequestedUpdateInterval() const;
-    void calculatePositionAndEmitLocation();
-
-    QList<CellPositioningData> seenCellIds() const;
-    void updateLocationFromCells(const QList<CellPositioningData> &cells);
-    bool searchForCellIdLocation(const MlsdbUniqueCellId &uniqueCellId, MlsdbCoords *coords);
-
-    QFileSystemWatcher m_locationSettingsWatcher;
+    void startRecalculatePositionTimer(bool stationary);
+    void createOnlineLocatorIfNeeded();
+    void runPipeline();
+    Observation currentObservation() const;
+
+    QVector<CellPositioningData> seenCellIds() const;
+    QVector<ObservedAccessPoint> seenAccessPoints() const;
+    void updateLocationFromObservation(const Observation &observation);
+    void setLocationFromEstimate(const Location &estimate, bool online);
+    double requiredAccuracy() const;
+    void learnCellLocations(const QVector<ObservedCell> &cells, const Location &onlineLocation);
+    bool searchForCellIdLocations(const QVector<CellPositioningData> &cells);
+    bool searchForAccessPointLocations(const QVector<ObservedAccessPoint> &accessPoints);
+    void loadCellLocationCache();
+    void saveCellLocationCache();
+
+    ProviderConfig m_config;
+    LocationSettings m_locationSettings;
     bool m_positioningEnabled;
     bool m_cellDataAllowed;
     bool m_positioningStarted;
     Status m_status;
     Location m_currentLocation;
     Location m_lastLocation;
+    PositionFilter m_positionFilter; // fuses the estimates into m_currentLocation
+    QElapsedTimer m_firstFixTimer; // valid from starting positioning until the first fix
 
     YandexOnlineLocator *m_mlsdbOnlineLocator;
     bool m_onlinePositioningEnabled;
     bool m_onlineDataAllowed;
+    bool m_raceOfflineEstimate; // emit the offline estimate while the online query is in flight
     bool m_wlanDataAllowed;
-    QPair<QDateTime, QVariantMap> m_previousQuery;
+    YandexLocationQuery m_previousQuery;
 
     QOfonoExtCellWatcher *m_cellWatcher;
-    QMap<MlsdbUniqueCellId, MlsdbCoords> m_uniqueCellIdToLocation; // cache
-    QSet<MlsdbUniqueCellId> m_knownCellIdsWithUnknownLocations;
+    WlanWatcher *m_wlanWatcher;
+    bool m_initialized; // initialize() has run
+    QNetworkAccessManager *m_replayNetwork; // non-null while replaying a trace
+    QVector<CellPositioningData> m_replayCells;
+    QVector<ObservedAccessPoint> m_replayAccessPoints;
+    ObservationTraceWriter m_traceWriter;
+    CellLocationCache m_cellLocationCache;
+    bool m_cellLocationCacheLoaded;
+    QThread m_cellLookupThread;
+    MlsdbCellDatabase *m_cellDatabase; // lives in m_cellLookupThread
+    quint32 m_mlsdbDataVersion;
+    QSet<MlsdbUniqueCellId> m_pendingCellLookups;
+    QHash<quint64, MlsdbCoords> m_accessPointLocations; // by BSSID, from the wlan indexes
+    QSet<quint64> m_unlocatableAccessPoints;
+    QSet<quint64> m_pendingAccessPointLookups;
+    Observation m_observation; // what the current position calculation is based on
+    bool m_observationEstimated; // the offline estimate for m_observation has already been made
+    LearnedCellStore m_learnedCells;
 
     QDBusServiceWatcher *m_watcher;
     struct ServiceData {
         ServiceData()
-        :   referenceCount(0), updateInterval(0)
+        :   referenceCount(0), updateInterval(0), requiredAccuracy(qQNaN()), lastDelivery(0), deliveryPending(false)
         {
         }
 
         int referenceCount;
         quint32 updateInterval;
+        double requiredAccuracy; // metres, NaN if the service did not say
+        qint64 lastDelivery;  // when PositionChanged was last sent to the service
+        bool deliveryPending; // a newer position is waiting for the service's interval to pass
     };
     QMap<QString, ServiceData> m_watchedServices;
 
     QBasicTimer m_idleTimer;    // qApp->quit() if positioning is off for long enough.
     QBasicTimer m_fixLostTimer; // after fix timeout, status set to Acquiring.  timer is reset when a position is calculated.
     QBasicTimer m_recalculatePositionTimer;
+    QBasicTimer m_deliveryTimer; // delivers coalesced position updates to slower clients.
 
-    bool m_signalUpdateCell;
-    bool m_signalUpdateWlan;
+    PipelineStages m_dirtyStages;
+    int m_stationaryRounds;       // recalculation rounds in a row in which nothing observed changed
+    uint m_stationaryPlace;       // placeFingerprint() at the last recalculation round, 0 before the first
+    quint32 m_stationaryExtension; // how much the recalculation interval is currently stretched by
 };
 
 Q_DECLARE_OPERATORS_FOR_FLAGS(YandexProvider::PositionFields)
+Q_DECLARE_OPERATORS_FOR_FLAGS(YandexProvider::PipelineStages)
 
 #endif // MLSDBPROVIDER_H
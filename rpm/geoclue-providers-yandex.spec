@@ -10,6 +10,7 @@ Source1: %{name}.privileges
 BuildRequires: pkgconfig(Qt5Core)
 BuildRequires: pkgconfig(Qt5DBus)
 BuildRequires: pkgconfig(Qt5Network)
+BuildRequires: pkgconfig(Qt5Test)
 BuildRequires: pkgconfig(qofono-qt5)
 BuildRequires: pkgconfig(qofonoext)
 BuildRequires: pkgconfig(connman-qt5)
@@ -20,6 +21,13 @@ Requires: mapplauncherd-qt5
 %description
 %{summary}.
 
+%package tools
+Summary: Tools for preparing Location Services Database data for %{name}
+Group: Development/Tools
+
+%description tools
+%{summary}.
+
 
 %prep
 %setup -q -n %{name}-%{version}
@@ -30,6 +38,10 @@ qmake -qt=5 geoclue-providers-yandex.pro
 make %{?_smp_mflags}
 
 
+%check
+make -C tests/auto check
+
+
 %install
 make INSTALL_ROOT=%{buildroot} install
 
@@ -42,3 +54,7 @@ install -m 644 -p %{SOURCE1} %{buildroot}%{_datadir}/mapplauncherd/privileges.d/
 %{_datadir}/mapplauncherd/privileges.d/*
 %{_datadir}/dbus-1/services/org.freedesktop.Geoclue.Providers.Yandex.service
 %{_datadir}/geoclue-providers/geoclue-yandex.provider
+
+%files tools
+%defattr(-,root,root,-)
+%{_bindir}/geoclue-yandex-mlsdb-tool
@@ -0,0 +1,9 @@
+TEMPLATE = subdirs
+SUBDIRS = \
+    celllocationcache \
+    learnedcellstore \
+    mlsdbbloomfilter \
+    mlsdbindex \
+    positionfilter \
+    tokenbucket \
+    yandexlocationquery
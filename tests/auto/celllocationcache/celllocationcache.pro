@@ -0,0 +1,9 @@
+TARGET = tst_celllocationcache
+include (../../tests.pri)
+
+HEADERS += \
+    $$PWD/../../../plugin/celllocationcache.h
+
+SOURCES += \
+    tst_celllocationcache.cpp \
+    $$PWD/../../../plugin/celllocationcache.cpp
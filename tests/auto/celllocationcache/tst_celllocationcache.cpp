@@ -0,0 +1,230 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include <QtTest/QtTest>
+#include <QtCore/QDataStream>
+#include <QtCore/QDateTime>
+#include <QtCore/QFile>
+#include <QtCore/QTemporaryDir>
+
+#include "celllocationcache.h"
+#include "testfixtures.h"
+
+namespace {
+    const quint32 CacheFileMagic = 0x79636c63; // as written by CellLocationCache::save()
+    const qint32 CacheFileVersion = 1;
+    const quint32 DataVersion = 42;
+}
+
+class tst_CellLocationCache : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void lookupUnknown();
+    void insertAndLookup();
+    void unlocatable();
+    void peekIsNotCounted();
+    void replaceDoesNotGrow();
+    void eviction();
+    void recentlyInsertedSurvive();
+    void expiredEntriesAreDropped();
+    void otherDataVersionIgnored();
+    void saveAndLoad();
+    void shrink();
+};
+
+void tst_CellLocationCache::lookupUnknown()
+{
+    CellLocationCache cache;
+    MlsdbCoords result;
+    QCOMPARE(cache.lookup(cell(1), &result), CellLocationCache::Unknown);
+    QCOMPARE(cache.statistics().misses, quint64(1));
+    QCOMPARE(cache.size(), 0);
+}
+
+void tst_CellLocationCache::insertAndLookup()
+{
+    CellLocationCache cache;
+    cache.insertLocation(cell(1), coords(60.17, 24.94), CellLocationCache::OfflineSource);
+    QVERIFY(cache.isDirty());
+
+    MlsdbCoords result;
+    QCOMPARE(cache.lookup(cell(1), &result), CellLocationCache::Located);
+    QCOMPARE(result.lat, 60.17);
+    QCOMPARE(result.lon, 24.94);
+    QCOMPARE(cache.statistics().hits, quint64(1));
+    QCOMPARE(cache.lookup(cell(2), &result), CellLocationCache::Unknown);
+}
+
+void tst_CellLocationCache::unlocatable()
+{
+    CellLocationCache cache;
+    cache.insertUnlocatable(cell(1));
+    MlsdbCoords result;
+    QCOMPARE(cache.lookup(cell(1), &result), CellLocationCache::Unlocatable);
+}
+
+void tst_CellLocationCache::peekIsNotCounted()
+{
+    CellLocationCache cache;
+    cache.insertLocation(cell(1), coords(60.17, 24.94), CellLocationCache::OfflineSource);
+    cache.insertUnlocatable(cell(2));
+
+    MlsdbCoords result;
+    QCOMPARE(cache.peek(cell(1), &result), CellLocationCache::Located);
+    QCOMPARE(result.lat, 60.17);
+    QCOMPARE(cache.peek(cell(2), &result), CellLocationCache::Unlocatable);
+    QCOMPARE(cache.peek(cell(3), &result), CellLocationCache::Unknown);
+    QCOMPARE(cache.statistics().hits, quint64(0));
+    QCOMPARE(cache.statistics().misses, quint64(0));
+}
+
+void tst_CellLocationCache::replaceDoesNotGrow()
+{
+    CellLocationCache cache;
+    cache.insertUnlocatable(cell(1));
+    cache.insertLocation(cell(1), coords(1, 2), CellLocationCache::OnlineSource);
+    QCOMPARE(cache.size(), 1);
+
+    MlsdbCoords result;
+    QCOMPARE(cache.lookup(cell(1), &result), CellLocationCache::Located);
+    QCOMPARE(result.lat, 1.0);
+}
+
+void tst_CellLocationCache::eviction()
+{
+    CellLocationCache cache(4);
+    for (quint32 i = 1; i <= 8; ++i) {
+        cache.insertLocation(cell(i), coords(i, i), CellLocationCache::OfflineSource);
+        QVERIFY(cache.size() <= 4);
+    }
+    QCOMPARE(cache.size(), 4);
+    QCOMPARE(cache.statistics().evictions, quint64(4));
+    QCOMPARE(cache.statistics().expirations, quint64(0));
+
+    int located = 0;
+    for (quint32 i = 1; i <= 8; ++i) {
+        MlsdbCoords result;
+        if (cache.lookup(cell(i), &result) == CellLocationCache::Located) {
+            QCOMPARE(result.lat, double(i));
+            ++located;
+        }
+    }
+    QCOMPARE(located, 4);
+}
+
+void tst_CellLocationCache::recentlyInsertedSurvive()
+{
+    // the second chance clock evicts the entry which has not been used since
+    // the last eviction, never the one which was just inserted.
+    CellLocationCache cache(2);
+    cache.insertLocation(cell(1), coords(1, 1), CellLocationCache::OfflineSource);
+    cache.insertLocation(cell(2), coords(2, 2), CellLocationCache::OfflineSource);
+    cache.insertLocation(cell(3), coords(3, 3), CellLocationCache::OfflineSource);
+    cache.insertLocation(cell(4), coords(4, 4), CellLocationCache::OfflineSource);
+
+    MlsdbCoords result;
+    QCOMPARE(cache.lookup(cell(1), &result), CellLocationCache::Unknown);
+    QCOMPARE(cache.lookup(cell(2), &result), CellLocationCache::Unknown);
+    QCOMPARE(cache.lookup(cell(3), &result), CellLocationCache::Located);
+    QCOMPARE(cache.lookup(cell(4), &result), CellLocationCache::Located);
+}
+
+void tst_CellLocationCache::expiredEntriesAreDropped()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    const QString fileName = directory.path() + QStringLiteral("/cells.cache");
+
+    // a cache file with an expired, an about to expire and a permanent entry.
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    {
+        QFile file(fileName);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        QDataStream out(&file);
+        out.setVersion(QDataStream::Qt_5_0);
+        out << CacheFileMagic << CacheFileVersion << DataVersion << quint32(3);
+        out << cell(1) << coords(1, 1) << qint64(now - 1000) << true;
+        out << cell(2) << coords(2, 2) << qint64(now + 200) << true;
+        out << cell(3) << coords(3, 3) << qint64(0) << false;
+    }
+
+    CellLocationCache cache;
+    QVERIFY(cache.load(fileName, DataVersion));
+    QCOMPARE(cache.size(), 2);
+    QVERIFY(!cache.isDirty());
+
+    MlsdbCoords result;
+    QCOMPARE(cache.lookup(cell(1), &result), CellLocationCache::Unknown);
+    QCOMPARE(cache.lookup(cell(2), &result), CellLocationCache::Located);
+    QCOMPARE(cache.lookup(cell(3), &result), CellLocationCache::Unlocatable);
+
+    QTest::qSleep(300);
+    QCOMPARE(cache.lookup(cell(2), &result), CellLocationCache::Unknown);
+    QCOMPARE(cache.statistics().expirations, quint64(1));
+    QCOMPARE(cache.size(), 1);
+    QCOMPARE(cache.lookup(cell(3), &result), CellLocationCache::Unlocatable);
+}
+
+void tst_CellLocationCache::otherDataVersionIgnored()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    const QString fileName = directory.path() + QStringLiteral("/cells.cache");
+
+    CellLocationCache cache;
+    cache.insertLocation(cell(1), coords(1, 1), CellLocationCache::OfflineSource);
+    QVERIFY(cache.save(fileName, DataVersion));
+
+    CellLocationCache loaded;
+    QVERIFY(!loaded.load(fileName, DataVersion + 1));
+    QCOMPARE(loaded.size(), 0);
+}
+
+void tst_CellLocationCache::saveAndLoad()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    const QString fileName = directory.path() + QStringLiteral("/cells.cache");
+
+    CellLocationCache cache;
+    cache.insertLocation(cell(1), coords(60.17, 24.94), CellLocationCache::OfflineSource);
+    cache.insertLocation(cell(2), coords(61.5, 23.76), CellLocationCache::OnlineSource);
+    cache.insertUnlocatable(cell(3));
+    QVERIFY(cache.save(fileName, DataVersion));
+    QVERIFY(!cache.isDirty());
+
+    CellLocationCache loaded;
+    QVERIFY(loaded.load(fileName, DataVersion));
+    QCOMPARE(loaded.size(), 3);
+
+    MlsdbCoords result;
+    QCOMPARE(loaded.lookup(cell(1), &result), CellLocationCache::Located);
+    QCOMPARE(result.lat, 60.17);
+    QCOMPARE(result.lon, 24.94);
+    QCOMPARE(loaded.lookup(cell(2), &result), CellLocationCache::Located);
+    QCOMPARE(result.lat, 61.5);
+    QCOMPARE(loaded.lookup(cell(3), &result), CellLocationCache::Unlocatable);
+}
+
+void tst_CellLocationCache::shrink()
+{
+    CellLocationCache cache(8);
+    for (quint32 i = 1; i <= 8; ++i) {
+        cache.insertLocation(cell(i), coords(i, i), CellLocationCache::OfflineSource);
+    }
+    cache.setMaximumEntries(3);
+    QCOMPARE(cache.maximumEntries(), 3);
+    QCOMPARE(cache.size(), 3);
+}
+
+QTEST_APPLESS_MAIN(tst_CellLocationCache)
+
+#include "tst_celllocationcache.moc"
@@ -0,0 +1,11 @@
+TARGET = tst_learnedcellstore
+include (../../tests.pri)
+
+HEADERS += \
+    $$PWD/../../../plugin/learnedcellstore.h \
+    $$PWD/../../../plugin/observation.h
+
+SOURCES += \
+    tst_learnedcellstore.cpp \
+    $$PWD/../../../plugin/learnedcellstore.cpp \
+    $$PWD/../../../plugin/observation.cpp
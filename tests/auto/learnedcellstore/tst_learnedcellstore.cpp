@@ -0,0 +1,243 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include <QtTest/QtTest>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QTemporaryDir>
+
+#include "learnedcellstore.h"
+#include "testfixtures.h"
+
+namespace {
+    const qint64 Start = Q_INT64_C(1500000000000); // msecs since epoch
+    const QString IndexFileName = QStringLiteral("learned-cells.index");
+    const QString LogFileName = QStringLiteral("learned-cells.log");
+
+    QVector<ObservedCell> observed(quint32 cellId)
+    {
+        ObservedCell observedCell;
+        observedCell.uniqueCellId = cell(cellId);
+        observedCell.signalStrength = 0;
+        return QVector<ObservedCell>() << observedCell;
+    }
+
+    // a cell is only located once it has been seen in two fixes.
+    void learnTwice(LearnedCellStore *store, quint32 cellId, double latitude, double longitude, qint64 timestamp)
+    {
+        store->learn(observed(cellId), latitude, longitude, 100, timestamp);
+        store->learn(observed(cellId), latitude, longitude, 100, timestamp + 1000);
+    }
+}
+
+class tst_LearnedCellStore : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void needsTwoFixes();
+    void ignoresInaccurateFixes();
+    void weightedMean();
+    void persistsThroughLog();
+    void compactionWritesIndex();
+    void truncatesPartialLogRecord();
+    void discardsStaleLog();
+    void evictsLeastRecentlySeen();
+    void zeroMaximumDisablesLearning();
+};
+
+void tst_LearnedCellStore::needsTwoFixes()
+{
+    LearnedCellStore store;
+    MlsdbCoords coords;
+    store.learn(observed(1), 60.17, 24.94, 50, Start);
+    QCOMPARE(store.size(), 1);
+    QVERIFY(!store.lookup(cell(1), &coords));
+
+    store.learn(observed(1), 60.17, 24.94, 50, Start + 1000);
+    QVERIFY(store.lookup(cell(1), &coords));
+    QCOMPARE(coords.lat, 60.17);
+    QCOMPARE(coords.lon, 24.94);
+    QVERIFY(!store.lookup(cell(2), &coords));
+}
+
+void tst_LearnedCellStore::ignoresInaccurateFixes()
+{
+    LearnedCellStore store;
+    store.learn(observed(1), 60.17, 24.94, 1001, Start);
+    store.learn(observed(1), 60.17, 24.94, qQNaN(), Start);
+    store.learn(observed(1), 60.17, 24.94, 0, Start);
+    store.learn(observed(1), 60.17, 24.94, -5, Start);
+    store.learn(QVector<ObservedCell>(), 60.17, 24.94, 50, Start);
+    QCOMPARE(store.size(), 0);
+}
+
+void tst_LearnedCellStore::weightedMean()
+{
+    // a fix twice as accurate counts four times as much.
+    LearnedCellStore store;
+    store.learn(observed(1), 10, -10, 100, Start);
+    store.learn(observed(1), 20, -20, 50, Start + 1000);
+
+    MlsdbCoords coords;
+    QVERIFY(store.lookup(cell(1), &coords));
+    QVERIFY(qAbs(coords.lat - 18.0) < 1e-9);
+    QVERIFY(qAbs(coords.lon + 18.0) < 1e-9);
+}
+
+void tst_LearnedCellStore::persistsThroughLog()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    {
+        LearnedCellStore store;
+        QVERIFY(!store.open(directory.path()));
+        learnTwice(&store, 1, 60.17, 24.94, Start);
+    }
+    QVERIFY(QFile::exists(QDir(directory.path()).filePath(LogFileName)));
+    QVERIFY(!QFile::exists(QDir(directory.path()).filePath(IndexFileName)));
+
+    LearnedCellStore store;
+    QVERIFY(store.open(directory.path()));
+    QCOMPARE(store.size(), 1);
+    MlsdbCoords coords;
+    QVERIFY(store.lookup(cell(1), &coords));
+    QCOMPARE(coords.lat, 60.17);
+    QCOMPARE(coords.lon, 24.94);
+}
+
+void tst_LearnedCellStore::compactionWritesIndex()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    const QString logFile = QDir(directory.path()).filePath(LogFileName);
+    {
+        LearnedCellStore store;
+        store.open(directory.path());
+        learnTwice(&store, 1, 60.17, 24.94, Start);
+        QVERIFY(store.compact());
+        QVERIFY(QFile::exists(QDir(directory.path()).filePath(IndexFileName)));
+        QVERIFY(!QFile::exists(logFile));
+
+        // fixes after the compaction go to a log of the new generation.
+        learnTwice(&store, 2, 61.5, 23.76, Start + 10000);
+        QVERIFY(QFile::exists(logFile));
+    }
+
+    LearnedCellStore store;
+    QVERIFY(store.open(directory.path()));
+    QCOMPARE(store.size(), 2);
+    MlsdbCoords coords;
+    QVERIFY(store.lookup(cell(1), &coords));
+    QCOMPARE(coords.lat, 60.17);
+    QVERIFY(store.lookup(cell(2), &coords));
+    QCOMPARE(coords.lat, 61.5);
+    QVERIFY(QFile::exists(logFile));
+}
+
+void tst_LearnedCellStore::truncatesPartialLogRecord()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    const QString logFile = QDir(directory.path()).filePath(LogFileName);
+    {
+        LearnedCellStore store;
+        store.open(directory.path());
+        learnTwice(&store, 1, 60.17, 24.94, Start);
+    }
+    const qint64 completeSize = QFileInfo(logFile).size();
+    {
+        // as if the device lost power in the middle of an append.
+        QFile file(logFile);
+        QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Append));
+        QCOMPARE(file.write("\x01\x02\x03\x04\x05", 5), qint64(5));
+    }
+
+    {
+        LearnedCellStore store;
+        QVERIFY(store.open(directory.path()));
+        MlsdbCoords coords;
+        QVERIFY(store.lookup(cell(1), &coords));
+        QCOMPARE(QFileInfo(logFile).size(), completeSize);
+
+        // a record appended after the recovery can be read back.
+        learnTwice(&store, 2, 61.5, 23.76, Start + 10000);
+    }
+
+    LearnedCellStore store;
+    QVERIFY(store.open(directory.path()));
+    QCOMPARE(store.size(), 2);
+    MlsdbCoords coords;
+    QVERIFY(store.lookup(cell(2), &coords));
+    QCOMPARE(coords.lat, 61.5);
+}
+
+void tst_LearnedCellStore::discardsStaleLog()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    QTemporaryDir other;
+    QVERIFY(other.isValid());
+
+    // a log of the first generation, for a cell which the compacted index does not hold.
+    {
+        LearnedCellStore store;
+        store.open(other.path());
+        learnTwice(&store, 2, 61.5, 23.76, Start);
+    }
+    {
+        LearnedCellStore store;
+        store.open(directory.path());
+        learnTwice(&store, 1, 60.17, 24.94, Start);
+        QVERIFY(store.compact());
+    }
+    const QString logFile = QDir(directory.path()).filePath(LogFileName);
+    QVERIFY(QFile::copy(QDir(other.path()).filePath(LogFileName), logFile));
+
+    LearnedCellStore store;
+    QVERIFY(store.open(directory.path()));
+    QCOMPARE(store.size(), 1);
+    MlsdbCoords coords;
+    QVERIFY(store.lookup(cell(1), &coords));
+    QVERIFY(!store.lookup(cell(2), &coords));
+    QVERIFY(!QFile::exists(logFile));
+}
+
+void tst_LearnedCellStore::evictsLeastRecentlySeen()
+{
+    LearnedCellStore store(2);
+    learnTwice(&store, 1, 1, 1, Start);
+    learnTwice(&store, 2, 2, 2, Start + 10000);
+    learnTwice(&store, 3, 3, 3, Start + 20000);
+    QVERIFY(store.compact());
+    QCOMPARE(store.size(), 2);
+
+    MlsdbCoords coords;
+    QVERIFY(!store.lookup(cell(1), &coords));
+    QVERIFY(store.lookup(cell(2), &coords));
+    QVERIFY(store.lookup(cell(3), &coords));
+
+    store.setMaximumCells(1);
+    QCOMPARE(store.size(), 1);
+    QVERIFY(store.lookup(cell(3), &coords));
+}
+
+void tst_LearnedCellStore::zeroMaximumDisablesLearning()
+{
+    LearnedCellStore store(0);
+    learnTwice(&store, 1, 60.17, 24.94, Start);
+    QCOMPARE(store.size(), 0);
+    MlsdbCoords coords;
+    QVERIFY(!store.lookup(cell(1), &coords));
+}
+
+QTEST_APPLESS_MAIN(tst_LearnedCellStore)
+
+#include "tst_learnedcellstore.moc"
@@ -0,0 +1,5 @@
+TARGET = tst_mlsdbbloomfilter
+include (../../tests.pri)
+
+SOURCES += \
+    tst_mlsdbbloomfilter.cpp
@@ -0,0 +1,175 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include <QtTest/QtTest>
+#include <QtCore/QFile>
+#include <QtCore/QTemporaryDir>
+#include <QtCore/QVector>
+
+#include "mlsdbbloomfilter.h"
+#include "testfixtures.h"
+
+namespace {
+    const int KeyCount = 1000;
+    const int ProbeCount = 100000;
+
+    bool writeFile(const QString &fileName, const QByteArray &contents)
+    {
+        QFile file(fileName);
+        return file.open(QIODevice::WriteOnly | QIODevice::Truncate)
+            && file.write(contents) == contents.size();
+    }
+}
+
+class tst_MlsdbBloomFilter : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void noFalseNegatives();
+    void falsePositiveRate();
+    void emptyFilterRejectsEverything();
+    void closedFilterAcceptsEverything();
+    void keysOfDifferentKindsDiffer();
+    void recordsSourceSize();
+    void rejectsMalformedFile();
+};
+
+void tst_MlsdbBloomFilter::noFalseNegatives()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    const QString fileName = directory.path() + QStringLiteral("/mlsdb.bloom");
+
+    QVector<quint64> keys;
+    for (int i = 0; i < KeyCount; ++i) {
+        keys.append(MlsdbBloomFilter::cellKey(cell(i)));
+        keys.append(MlsdbBloomFilter::accessPointKey(Q_UINT64_C(0x001122000000) + i));
+    }
+    QVERIFY(writeFile(fileName, MlsdbBloomFilter::build(keys, 0)));
+
+    MlsdbBloomFilter filter;
+    QVERIFY(filter.open(fileName));
+    QCOMPARE(filter.keyCount(), quint32(keys.size()));
+    for (int i = 0; i < KeyCount; ++i) {
+        QVERIFY(filter.mayContain(MlsdbBloomFilter::cellKey(cell(i))));
+        QVERIFY(filter.mayContain(MlsdbBloomFilter::accessPointKey(Q_UINT64_C(0x001122000000) + i)));
+    }
+}
+
+void tst_MlsdbBloomFilter::falsePositiveRate()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    const QString fileName = directory.path() + QStringLiteral("/mlsdb.bloom");
+
+    QVector<quint64> keys;
+    for (int i = 0; i < KeyCount; ++i) {
+        keys.append(MlsdbBloomFilter::cellKey(cell(i)));
+    }
+    QVERIFY(writeFile(fileName, MlsdbBloomFilter::build(keys, 0)));
+
+    MlsdbBloomFilter filter;
+    QVERIFY(filter.open(fileName));
+    int falsePositives = 0;
+    for (int i = KeyCount; i < KeyCount + ProbeCount; ++i) {
+        if (filter.mayContain(MlsdbBloomFilter::cellKey(cell(i)))) {
+            ++falsePositives;
+        }
+    }
+    // built for about 1%, allow for the rounding of the bit count and for chance.
+    QVERIFY2(falsePositives < ProbeCount / 20, qPrintable(QString::number(falsePositives)));
+}
+
+void tst_MlsdbBloomFilter::emptyFilterRejectsEverything()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    const QString fileName = directory.path() + QStringLiteral("/mlsdb.bloom");
+    QVERIFY(writeFile(fileName, MlsdbBloomFilter::build(QVector<quint64>(), 0)));
+
+    MlsdbBloomFilter filter;
+    QVERIFY(filter.open(fileName));
+    QCOMPARE(filter.keyCount(), quint32(0));
+    for (int i = 0; i < KeyCount; ++i) {
+        QVERIFY(!filter.mayContain(MlsdbBloomFilter::cellKey(cell(i))));
+    }
+}
+
+void tst_MlsdbBloomFilter::closedFilterAcceptsEverything()
+{
+    MlsdbBloomFilter filter;
+    QVERIFY(!filter.isOpen());
+    QVERIFY(filter.mayContain(MlsdbBloomFilter::cellKey(cell(1))));
+    QVERIFY(filter.mayContain(0));
+}
+
+void tst_MlsdbBloomFilter::keysOfDifferentKindsDiffer()
+{
+    QVERIFY(MlsdbBloomFilter::cellKey(cell(1)) != MlsdbBloomFilter::cellKey(cell(2)));
+    QVERIFY(MlsdbBloomFilter::cellKey(cell(1))
+            != MlsdbBloomFilter::cellKey(MlsdbUniqueCellId(MLSDB_CELL_TYPE_GSM, 1, 1001, 244, 5)));
+    QVERIFY(MlsdbBloomFilter::accessPointKey(1) != MlsdbBloomFilter::accessPointKey(2));
+
+    // only the 48 bits of the BSSID count.
+    QCOMPARE(MlsdbBloomFilter::accessPointKey(Q_UINT64_C(0xffff001122334455)),
+             MlsdbBloomFilter::accessPointKey(Q_UINT64_C(0x001122334455)));
+}
+
+void tst_MlsdbBloomFilter::recordsSourceSize()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    const QString first = directory.path() + QStringLiteral("/mlsdb.index");
+    const QString second = directory.path() + QStringLiteral("/mlsdb.wlan");
+    QVERIFY(writeFile(first, QByteArray(1000, 'x')));
+    QVERIFY(writeFile(second, QByteArray(234, 'x')));
+    const quint32 sourceSize = MlsdbBloomFilter::sourceSize(QStringList() << first << second);
+    QCOMPARE(sourceSize, quint32(1234));
+
+    // the provider compares it with the files, to notice a filter they have outgrown.
+    const QString fileName = directory.path() + QStringLiteral("/mlsdb.bloom");
+    QVERIFY(writeFile(fileName, MlsdbBloomFilter::build(QVector<quint64>() << MlsdbBloomFilter::cellKey(cell(1)), sourceSize)));
+    MlsdbBloomFilter filter;
+    QVERIFY(filter.open(fileName));
+    QCOMPARE(filter.sourceSize(), quint32(1234));
+}
+
+void tst_MlsdbBloomFilter::rejectsMalformedFile()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+
+    QVector<quint64> keys;
+    keys.append(MlsdbBloomFilter::cellKey(cell(1)));
+    const QByteArray contents = MlsdbBloomFilter::build(keys, 0);
+
+    MlsdbBloomFilter filter;
+    const QString truncated = directory.path() + QStringLiteral("/truncated.bloom");
+    QVERIFY(writeFile(truncated, contents.left(contents.size() - 1)));
+    QVERIFY(!filter.open(truncated));
+    QVERIFY(!filter.isOpen());
+
+    const QString header = directory.path() + QStringLiteral("/header.bloom");
+    QVERIFY(writeFile(header, contents.left(sizeof(MlsdbBloomFilterHeader) - 1)));
+    QVERIFY(!filter.open(header));
+
+    QByteArray wrongMagic = contents;
+    wrongMagic[0] = wrongMagic.at(0) ^ 1;
+    const QString magic = directory.path() + QStringLiteral("/magic.bloom");
+    QVERIFY(writeFile(magic, wrongMagic));
+    QVERIFY(!filter.open(magic));
+
+    QVERIFY(!filter.open(directory.path() + QStringLiteral("/missing.bloom")));
+    QVERIFY(filter.mayContain(MlsdbBloomFilter::cellKey(cell(2))));
+}
+
+QTEST_APPLESS_MAIN(tst_MlsdbBloomFilter)
+
+#include "tst_mlsdbbloomfilter.moc"
@@ -0,0 +1,5 @@
+TARGET = tst_mlsdbindex
+include (../../tests.pri)
+
+SOURCES += \
+    tst_mlsdbindex.cpp
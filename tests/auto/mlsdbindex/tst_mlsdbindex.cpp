@@ -0,0 +1,212 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include <QtTest/QtTest>
+#include <QtCore/QFile>
+#include <QtCore/QtEndian>
+#include <QtCore/QTemporaryDir>
+#include <QtCore/QVector>
+
+#include <algorithm>
+
+#include "mlsdbcellindex.h"
+#include "mlsdbwlanindex.h"
+#include "testfixtures.h"
+
+namespace {
+    template <typename Header, typename Record>
+    bool writeIndex(const QString &fileName, const Header &header, const QVector<Record> &records)
+    {
+        QFile file(fileName);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            return false;
+        }
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(records.constData()), records.size() * sizeof(Record));
+        return true;
+    }
+
+    // cells which differ in one field at a time, so that every comparison is exercised.
+    QVector<MlsdbUniqueCellId> testCells()
+    {
+        QVector<MlsdbUniqueCellId> cells;
+        for (quint32 i = 1; i <= 50; ++i) {
+            cells.append(MlsdbUniqueCellId(MLSDB_CELL_TYPE_LTE, i * 977, 1000 + i % 3, quint16(240 + i % 5), quint16(1 + i % 2)));
+        }
+        cells.append(MlsdbUniqueCellId(MLSDB_CELL_TYPE_GSM, 977, 1001, 241, 2));
+        cells.append(MlsdbUniqueCellId(MLSDB_CELL_TYPE_LTE, 977, 1002, 241, 2));
+        cells.append(MlsdbUniqueCellId(MLSDB_CELL_TYPE_LTE, 977, 1001, 242, 2));
+        cells.append(MlsdbUniqueCellId(MLSDB_CELL_TYPE_LTE, 977, 1001, 241, 1));
+        return cells;
+    }
+}
+
+class tst_MlsdbIndex : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void findCells();
+    void emptyCellIndex();
+    void rejectsMalformedCellIndex();
+    void findAccessPoints();
+    void rejectsMalformedWlanIndex();
+};
+
+void tst_MlsdbIndex::findCells()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+
+    const QVector<MlsdbUniqueCellId> cells = testCells();
+    QVector<MlsdbCellIndexRecord> records;
+    quint16 minimumMcc = 0xFFFF, maximumMcc = 0;
+    for (int i = 0; i < cells.size(); ++i) {
+        records.append(mlsdbCellIndexRecord(cells.at(i), coords(-60.0 + i, 170.0 - i)));
+        minimumMcc = qMin(minimumMcc, cells.at(i).mcc());
+        maximumMcc = qMax(maximumMcc, cells.at(i).mcc());
+    }
+    std::sort(records.begin(), records.end(), mlsdbCellIndexRecordLessThan);
+    const QString fileName = directory.path() + QStringLiteral("/mlsdb.index");
+    QVERIFY(writeIndex(fileName, mlsdbCellIndexHeader(records.size(), minimumMcc, maximumMcc), records));
+
+    MlsdbCellIndex index;
+    QVERIFY(index.open(fileName));
+    QCOMPARE(index.recordCount(), quint32(cells.size()));
+    QCOMPARE(index.minimumMcc(), minimumMcc);
+    QCOMPARE(index.maximumMcc(), maximumMcc);
+
+    for (int i = 0; i < cells.size(); ++i) {
+        MlsdbCoords found;
+        QVERIFY(index.find(cells.at(i), &found));
+        QVERIFY(qAbs(found.lat - (-60.0 + i)) < 1e-6);
+        QVERIFY(qAbs(found.lon - (170.0 - i)) < 1e-6);
+    }
+
+    MlsdbCoords found;
+    QVERIFY(!index.find(MlsdbUniqueCellId(MLSDB_CELL_TYPE_LTE, 976, 1001, 241, 2), &found));
+    QVERIFY(!index.find(MlsdbUniqueCellId(MLSDB_CELL_TYPE_UMTS, 977, 1001, 241, 2), &found));
+    QVERIFY(!index.find(MlsdbUniqueCellId(MLSDB_CELL_TYPE_LTE, 0x0FFFFFFF, 1, 999, 99), &found));
+    QVERIFY(!index.find(MlsdbUniqueCellId(), &found));
+
+    index.close();
+    QVERIFY(!index.isOpen());
+    QVERIFY(!index.find(cells.first(), &found));
+}
+
+void tst_MlsdbIndex::emptyCellIndex()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+
+    const QString fileName = directory.path() + QStringLiteral("/mlsdb.index");
+    QVERIFY(writeIndex(fileName, mlsdbCellIndexHeader(0, 0, 0), QVector<MlsdbCellIndexRecord>()));
+
+    MlsdbCellIndex index;
+    QVERIFY(index.open(fileName));
+    QCOMPARE(index.recordCount(), quint32(0));
+    MlsdbCoords found;
+    QVERIFY(!index.find(testCells().first(), &found));
+}
+
+void tst_MlsdbIndex::rejectsMalformedCellIndex()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+
+    QVector<MlsdbCellIndexRecord> records;
+    records.append(mlsdbCellIndexRecord(testCells().first(), coords(1, 2)));
+
+    // more records announced than stored.
+    const QString truncated = directory.path() + QStringLiteral("/truncated.index");
+    QVERIFY(writeIndex(truncated, mlsdbCellIndexHeader(2, 241, 241), records));
+    MlsdbCellIndex index;
+    QVERIFY(!index.open(truncated));
+    QVERIFY(!index.isOpen());
+
+    // a version 3 data file is not an index.
+    MlsdbCellIndexHeader header = mlsdbCellIndexHeader(1, 241, 241);
+    header.version = qToLittleEndian<qint32>(MLSDB_DATA_VERSION);
+    const QString wrongVersion = directory.path() + QStringLiteral("/version.index");
+    QVERIFY(writeIndex(wrongVersion, header, records));
+    QVERIFY(!index.open(wrongVersion));
+
+    header = mlsdbCellIndexHeader(1, 241, 241);
+    header.magic = 0;
+    const QString wrongMagic = directory.path() + QStringLiteral("/magic.index");
+    QVERIFY(writeIndex(wrongMagic, header, records));
+    QVERIFY(!index.open(wrongMagic));
+
+    QVERIFY(!index.open(directory.path() + QStringLiteral("/missing.index")));
+}
+
+void tst_MlsdbIndex::findAccessPoints()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+
+    // either side of the split between the low 32 and high 16 bits of the BSSID.
+    QVector<quint64> bssids;
+    bssids << Q_UINT64_C(0x000000000001) << Q_UINT64_C(0x0000ffffffff) << Q_UINT64_C(0x000100000000)
+           << Q_UINT64_C(0x0123456789ab) << Q_UINT64_C(0xfedcba987654) << Q_UINT64_C(0xffffffffffff);
+    for (quint64 i = 1; i <= 100; ++i) {
+        bssids << (i * Q_UINT64_C(0x9e3779b97f4a) & Q_UINT64_C(0xffffffffffff));
+    }
+
+    QVector<MlsdbWlanIndexRecord> records;
+    for (int i = 0; i < bssids.size(); ++i) {
+        records.append(mlsdbWlanIndexRecord(bssids.at(i), coords(i * 0.5, -i * 0.5)));
+    }
+    std::sort(records.begin(), records.end(), mlsdbWlanIndexRecordLessThan);
+    const QString fileName = directory.path() + QStringLiteral("/mlsdb.wlan");
+    QVERIFY(writeIndex(fileName, mlsdbWlanIndexHeader(records.size()), records));
+
+    MlsdbWlanIndex index;
+    QVERIFY(index.open(fileName));
+    QCOMPARE(index.recordCount(), quint32(bssids.size()));
+    for (int i = 0; i < bssids.size(); ++i) {
+        MlsdbCoords found;
+        QVERIFY(index.find(bssids.at(i), &found));
+        QVERIFY(qAbs(found.lat - i * 0.5) < 1e-6);
+        QVERIFY(qAbs(found.lon + i * 0.5) < 1e-6);
+    }
+
+    MlsdbCoords found;
+    QVERIFY(!index.find(0, &found));
+    QVERIFY(!index.find(Q_UINT64_C(0x000000000002), &found));
+    QVERIFY(!index.find(Q_UINT64_C(0x0001ffffffff), &found));
+    QVERIFY(!index.find(Q_UINT64_C(0xfffffffffffe), &found));
+}
+
+void tst_MlsdbIndex::rejectsMalformedWlanIndex()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+
+    QVector<MlsdbWlanIndexRecord> records;
+    records.append(mlsdbWlanIndexRecord(1, coords(1, 2)));
+
+    const QString truncated = directory.path() + QStringLiteral("/truncated.wlan");
+    QVERIFY(writeIndex(truncated, mlsdbWlanIndexHeader(3), records));
+    MlsdbWlanIndex index;
+    QVERIFY(!index.open(truncated));
+
+    MlsdbWlanIndexHeader header = mlsdbWlanIndexHeader(1);
+    header.magic = qToLittleEndian<quint32>(MLSDB_DATA_MAGIC);
+    const QString wrongMagic = directory.path() + QStringLiteral("/magic.wlan");
+    QVERIFY(writeIndex(wrongMagic, header, records));
+    QVERIFY(!index.open(wrongMagic));
+
+    MlsdbCoords found;
+    QVERIFY(!index.find(1, &found));
+}
+
+QTEST_APPLESS_MAIN(tst_MlsdbIndex)
+
+#include "tst_mlsdbindex.moc"
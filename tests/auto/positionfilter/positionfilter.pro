@@ -0,0 +1,10 @@
+TARGET = tst_positionfilter
+include (../../tests.pri)
+
+HEADERS += \
+    $$PWD/../../../plugin/locationtypes.h \
+    $$PWD/../../../plugin/positionfilter.h
+
+SOURCES += \
+    tst_positionfilter.cpp \
+    $$PWD/../../../plugin/positionfilter.cpp
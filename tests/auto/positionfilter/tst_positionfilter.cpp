@@ -0,0 +1,185 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include <QtTest/QtTest>
+
+#include <cmath>
+
+#include "positionfilter.h"
+
+namespace {
+    const double OriginLatitude = 60.17;
+    const double OriginLongitude = 24.94;
+    const qint64 Start = Q_INT64_C(1500000000000); // msecs since epoch
+    const double MetresPerDegreeLatitude = 6371000.0 * M_PI / 180.0;
+    const double KnotsPerMetrePerSecond = 1.0 / 0.514444;
+
+    // a fix the given number of metres north of the origin.
+    Location fix(qint64 timestamp, double north, double accuracy)
+    {
+        Location location;
+        location.setTimestamp(timestamp);
+        location.setLatitude(OriginLatitude + north / MetresPerDegreeLatitude);
+        location.setLongitude(OriginLongitude);
+        Accuracy horizontal;
+        horizontal.setHorizontal(accuracy);
+        location.setAccuracy(horizontal);
+        return location;
+    }
+
+    double north(const Location &location)
+    {
+        return (location.latitude() - OriginLatitude) * MetresPerDegreeLatitude;
+    }
+}
+
+class tst_PositionFilter : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void firstFixPassesThrough();
+    void invalidFixIgnored();
+    void unknownAccuracy();
+    void fusesTowardsTheMoreAccurateFix();
+    void rejectsInaccurateOutlier();
+    void restartsOnAccurateOutlier();
+    void restartsAfterLongGap();
+    void predictedAccuracy();
+    void estimatesSpeedAndDirection();
+    void reset();
+};
+
+void tst_PositionFilter::firstFixPassesThrough()
+{
+    PositionFilter filter;
+    QVERIFY(!filter.isValid());
+    QVERIFY(filter.update(fix(Start, 0, 100)));
+    QVERIFY(filter.isValid());
+
+    const Location location = filter.location();
+    QCOMPARE(location.timestamp(), Start);
+    QCOMPARE(location.latitude(), OriginLatitude);
+    QCOMPARE(location.longitude(), OriginLongitude);
+    QCOMPARE(location.accuracy().horizontal(), 100.0);
+    QVERIFY(qIsNaN(location.speed())); // not known from a single fix
+}
+
+void tst_PositionFilter::invalidFixIgnored()
+{
+    PositionFilter filter;
+    QVERIFY(!filter.update(fix(0, 0, 100)));
+    Location noPosition = fix(Start, 0, 100);
+    noPosition.setLatitude(qQNaN());
+    QVERIFY(!filter.update(noPosition));
+    QVERIFY(!filter.isValid());
+    QCOMPARE(filter.location().timestamp(), qint64(0));
+}
+
+void tst_PositionFilter::unknownAccuracy()
+{
+    // a fix which does not say how accurate it is counts as a coarse one,
+    // never as a precise one.
+    PositionFilter filter;
+    QVERIFY(filter.update(fix(Start, 0, qQNaN())));
+    QVERIFY(filter.location().accuracy().horizontal() >= 1000.0);
+
+    filter.reset();
+    QVERIFY(filter.update(fix(Start, 0, -1)));
+    QVERIFY(filter.location().accuracy().horizontal() >= 1000.0);
+}
+
+void tst_PositionFilter::fusesTowardsTheMoreAccurateFix()
+{
+    PositionFilter filter;
+    QVERIFY(filter.update(fix(Start, 0, 1000)));
+    QVERIFY(filter.update(fix(Start + 1000, 500, 100)));
+
+    const Location location = filter.location();
+    QVERIFY(north(location) > 450 && north(location) < 500);
+    QVERIFY(location.accuracy().horizontal() >= 100.0);
+    QVERIFY(location.accuracy().horizontal() < 1000.0);
+    QCOMPARE(location.timestamp(), Start + 1000);
+}
+
+void tst_PositionFilter::rejectsInaccurateOutlier()
+{
+    PositionFilter filter;
+    QVERIFY(filter.update(fix(Start, 0, 20)));
+    QVERIFY(!filter.update(fix(Start + 1000, 5000, 1000)));
+
+    const Location location = filter.location();
+    QCOMPARE(location.timestamp(), Start);
+    QVERIFY(qAbs(north(location)) < 1.0);
+}
+
+void tst_PositionFilter::restartsOnAccurateOutlier()
+{
+    PositionFilter filter;
+    QVERIFY(filter.update(fix(Start, 0, 1000)));
+    QVERIFY(filter.update(fix(Start + 1000, 50000, 20)));
+
+    const Location location = filter.location();
+    QVERIFY(qAbs(north(location) - 50000) < 1.0);
+    QCOMPARE(location.accuracy().horizontal(), 20.0);
+}
+
+void tst_PositionFilter::restartsAfterLongGap()
+{
+    PositionFilter filter;
+    QVERIFY(filter.update(fix(Start, 0, 20)));
+    QVERIFY(filter.update(fix(Start + 121000, 5000, 1000)));
+
+    const Location location = filter.location();
+    QVERIFY(qAbs(north(location) - 5000) < 1.0);
+    QCOMPARE(location.accuracy().horizontal(), 1000.0);
+}
+
+void tst_PositionFilter::predictedAccuracy()
+{
+    PositionFilter filter;
+    QVERIFY(qIsNaN(filter.predictedAccuracy(Start)));
+
+    QVERIFY(filter.update(fix(Start, 0, 50)));
+    QCOMPARE(filter.predictedAccuracy(Start), 50.0);
+    QVERIFY(filter.predictedAccuracy(Start + 10000) > filter.predictedAccuracy(Start + 1000));
+    QVERIFY(qIsNaN(filter.predictedAccuracy(Start + 121000)));
+}
+
+void tst_PositionFilter::estimatesSpeedAndDirection()
+{
+    // heading north at 10 m/s.
+    PositionFilter filter;
+    for (int i = 0; i <= 30; ++i) {
+        QVERIFY(filter.update(fix(Start + i * 1000, i * 10.0, 10)));
+    }
+
+    const Location location = filter.location();
+    QVERIFY(!qIsNaN(location.speed()));
+    QVERIFY(qAbs(location.speed() - 10.0 * KnotsPerMetrePerSecond) < 2.0);
+    QVERIFY(!qIsNaN(location.direction()));
+    QVERIFY(location.direction() < 5.0 || location.direction() > 355.0);
+    QVERIFY(qAbs(north(location) - 300.0) < 10.0);
+}
+
+void tst_PositionFilter::reset()
+{
+    PositionFilter filter;
+    QVERIFY(filter.update(fix(Start, 0, 20)));
+    filter.reset();
+    QVERIFY(!filter.isValid());
+
+    // after a reset, a far less accurate fix is taken as it is.
+    QVERIFY(filter.update(fix(Start + 1000, 5000, 1000)));
+    QVERIFY(qAbs(north(filter.location()) - 5000) < 1.0);
+}
+
+QTEST_APPLESS_MAIN(tst_PositionFilter)
+
+#include "tst_positionfilter.moc"
@@ -0,0 +1,9 @@
+TARGET = tst_tokenbucket
+include (../../tests.pri)
+
+HEADERS += \
+    $$PWD/../../../plugin/tokenbucket.h
+
+SOURCES += \
+    tst_tokenbucket.cpp \
+    $$PWD/../../../plugin/tokenbucket.cpp
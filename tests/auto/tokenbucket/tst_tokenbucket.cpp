@@ -0,0 +1,90 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include <QtTest/QtTest>
+
+#include "tokenbucket.h"
+
+namespace {
+    const qint64 Start = Q_INT64_C(1500000000000); // msecs since epoch
+    const qint64 Hour = 60 * 60 * 1000;
+}
+
+class tst_TokenBucket : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void burst();
+    void refill();
+    void refillIsCappedAtBurst();
+    void lowerBurstDropsTokens();
+    void zeroRateNeverRefills();
+};
+
+void tst_TokenBucket::burst()
+{
+    TokenBucket bucket(10, 3);
+    QCOMPARE(bucket.burst(), 3);
+    QVERIFY(bucket.tryAcquire(Start));
+    QVERIFY(bucket.tryAcquire(Start));
+    QVERIFY(bucket.tryAcquire(Start));
+    QVERIFY(!bucket.tryAcquire(Start));
+}
+
+void tst_TokenBucket::refill()
+{
+    // one token a second.
+    TokenBucket bucket(3600, 1);
+    QVERIFY(bucket.tryAcquire(Start));
+    QVERIFY(!bucket.tryAcquire(Start));
+    QVERIFY(qAbs(bucket.msecsUntilAvailable(Start) - 1000) <= 1);
+
+    QVERIFY(!bucket.tryAcquire(Start + 990));
+    QVERIFY(qAbs(bucket.msecsUntilAvailable(Start + 990) - 10) <= 1);
+    QVERIFY(bucket.tryAcquire(Start + 1010));
+    QVERIFY(!bucket.tryAcquire(Start + 1010));
+}
+
+void tst_TokenBucket::refillIsCappedAtBurst()
+{
+    TokenBucket bucket(3600, 2);
+    QVERIFY(bucket.tryAcquire(Start));
+    QVERIFY(bucket.tryAcquire(Start));
+
+    // an idle hour refills the bucket, but only up to the burst.
+    const qint64 later = Start + Hour;
+    QCOMPARE(bucket.msecsUntilAvailable(later), qint64(0));
+    QVERIFY(bucket.tryAcquire(later));
+    QVERIFY(bucket.tryAcquire(later));
+    QVERIFY(!bucket.tryAcquire(later));
+}
+
+void tst_TokenBucket::lowerBurstDropsTokens()
+{
+    TokenBucket bucket(3600, 5);
+    bucket.setRate(7200, 2);
+    QCOMPARE(bucket.burst(), 2);
+    QCOMPARE(bucket.tokensPerHour(), 7200.0);
+    QVERIFY(bucket.tryAcquire(Start));
+    QVERIFY(bucket.tryAcquire(Start));
+    QVERIFY(!bucket.tryAcquire(Start));
+}
+
+void tst_TokenBucket::zeroRateNeverRefills()
+{
+    TokenBucket bucket(0, 1);
+    QVERIFY(bucket.tryAcquire(Start));
+    QVERIFY(!bucket.tryAcquire(Start + Hour));
+    QCOMPARE(bucket.msecsUntilAvailable(Start + Hour), qint64(-1));
+}
+
+QTEST_APPLESS_MAIN(tst_TokenBucket)
+
+#include "tst_tokenbucket.moc"
@@ -0,0 +1,175 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include <QtTest/QtTest>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+
+#include "yandexlocationquery.h"
+
+namespace {
+    const QByteArray ApiKey = QByteArrayLiteral("test-key");
+    const quint32 UnknownAsu = 99;
+
+    ObservedCell observedCell(MlsdbCellType type, quint32 cellId, quint32 locationCode,
+                              quint16 mcc, quint16 mnc, quint32 asu)
+    {
+        ObservedCell cell;
+        cell.uniqueCellId = MlsdbUniqueCellId(type, cellId, locationCode, mcc, mnc);
+        cell.signalStrength = asu;
+        return cell;
+    }
+
+    ObservedAccessPoint observedAccessPoint(quint64 bssid, quint16 strength)
+    {
+        ObservedAccessPoint accessPoint;
+        accessPoint.bssid = bssid;
+        accessPoint.frequency = 2412;
+        accessPoint.strength = strength;
+        return accessPoint;
+    }
+
+    // the request body, which must be valid JSON.
+    QJsonObject encode(const YandexLocationQuery &query, const QByteArray &apiKey = ApiKey)
+    {
+        QJsonParseError error;
+        const QJsonDocument document = QJsonDocument::fromJson(query.toJson(apiKey), &error);
+        if (error.error != QJsonParseError::NoError) {
+            qWarning() << "invalid request body:" << error.errorString() << query.toJson(apiKey);
+        }
+        return document.object();
+    }
+}
+
+class tst_YandexLocationQuery : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void emptyQuery();
+    void apiKeyIsEscaped();
+    void cellsAreEncoded();
+    void unusableCellsAreDropped();
+    void accessPointsAreEncoded();
+    void singleAccessPointIsDropped();
+    void observedCellsAreCarried();
+    void bssidStrings();
+};
+
+void tst_YandexLocationQuery::emptyQuery()
+{
+    const YandexLocationQuery query = YandexLocationQuery::fromObservation(Observation());
+    QVERIFY(query.isEmpty());
+
+    const QJsonObject json = encode(query);
+    QCOMPARE(json.value(QStringLiteral("common")).toObject().value(QStringLiteral("version")).toString(),
+             QStringLiteral("1.0"));
+    QCOMPARE(json.value(QStringLiteral("common")).toObject().value(QStringLiteral("api_key")).toString(),
+             QStringLiteral("test-key"));
+    QVERIFY(!json.contains(QStringLiteral("gsm_cells")));
+    QVERIFY(!json.contains(QStringLiteral("wifi_networks")));
+}
+
+void tst_YandexLocationQuery::apiKeyIsEscaped()
+{
+    const QByteArray apiKey("a\"b\\c\nd\x01");
+    const QJsonObject json = encode(YandexLocationQuery(), apiKey);
+    QCOMPARE(json.value(QStringLiteral("common")).toObject().value(QStringLiteral("api_key")).toString(),
+             QString::fromLatin1(apiKey));
+}
+
+void tst_YandexLocationQuery::cellsAreEncoded()
+{
+    QVector<ObservedCell> cells;
+    cells << observedCell(MLSDB_CELL_TYPE_LTE, 12345, 678, 244, 5, 20)
+          << observedCell(MLSDB_CELL_TYPE_GSM, 23456, 789, 250, 1, UnknownAsu)
+          << observedCell(MLSDB_CELL_TYPE_UMTS, 34567, 890, 250, 2, 0);
+    const YandexLocationQuery query = YandexLocationQuery::fromObservation(Observation(cells, QVector<ObservedAccessPoint>()));
+    QCOMPARE(query.cells.size(), 3);
+
+    const QJsonArray json = encode(query).value(QStringLiteral("gsm_cells")).toArray();
+    QCOMPARE(json.size(), 3);
+
+    const QJsonObject lte = json.at(0).toObject();
+    QCOMPARE(lte.value(QStringLiteral("countrycode")).toInt(), 244);
+    QCOMPARE(lte.value(QStringLiteral("operatorid")).toInt(), 5);
+    QCOMPARE(lte.value(QStringLiteral("cellid")).toInt(), 12345);
+    QCOMPARE(lte.value(QStringLiteral("lac")).toInt(), 678);
+    QCOMPARE(lte.value(QStringLiteral("signal_strength")).toInt(), -73); // asu 20
+
+    // an unknown strength is left out rather than sent as a made up one.
+    QVERIFY(!json.at(1).toObject().contains(QStringLiteral("signal_strength")));
+    QCOMPARE(json.at(1).toObject().value(QStringLiteral("cellid")).toInt(), 23456);
+    QCOMPARE(json.at(2).toObject().value(QStringLiteral("signal_strength")).toInt(), -113); // asu 0
+}
+
+void tst_YandexLocationQuery::unusableCellsAreDropped()
+{
+    QVector<ObservedCell> cells;
+    cells << observedCell(MLSDB_CELL_TYPE_OTHER, 12345, 678, 244, 5, 20)
+          << observedCell(MLSDB_CELL_TYPE_LTE, 12345, 678, 0, 5, 20)
+          << observedCell(MLSDB_CELL_TYPE_LTE, 12345, 678, 244, 0, 20)
+          << observedCell(MLSDB_CELL_TYPE_LTE, 12345, 0, 244, 5, 20)
+          << observedCell(MLSDB_CELL_TYPE_LTE, 0, 678, 244, 5, 20);
+    const YandexLocationQuery query = YandexLocationQuery::fromObservation(Observation(cells, QVector<ObservedAccessPoint>()));
+    QVERIFY(query.cells.isEmpty());
+    QVERIFY(!encode(query).contains(QStringLiteral("gsm_cells")));
+}
+
+void tst_YandexLocationQuery::accessPointsAreEncoded()
+{
+    QVector<ObservedAccessPoint> accessPoints;
+    accessPoints << observedAccessPoint(Q_UINT64_C(0x0123456789ab), 60)
+                 << observedAccessPoint(Q_UINT64_C(0xfedcba987654), 0);
+    const YandexLocationQuery query = YandexLocationQuery::fromObservation(Observation(QVector<ObservedCell>(), accessPoints));
+    QCOMPARE(query.accessPoints.size(), 2);
+
+    const QJsonArray json = encode(query).value(QStringLiteral("wifi_networks")).toArray();
+    QCOMPARE(json.size(), 2);
+    QCOMPARE(json.at(0).toObject().value(QStringLiteral("mac")).toString(), QStringLiteral("01:23:45:67:89:ab"));
+    QCOMPARE(json.at(0).toObject().value(QStringLiteral("signal_strength")).toInt(), -60);
+    QCOMPARE(json.at(1).toObject().value(QStringLiteral("mac")).toString(), QStringLiteral("fe:dc:ba:98:76:54"));
+    QVERIFY(!json.at(1).toObject().contains(QStringLiteral("signal_strength")));
+}
+
+void tst_YandexLocationQuery::singleAccessPointIsDropped()
+{
+    QVector<ObservedAccessPoint> accessPoints;
+    accessPoints << observedAccessPoint(Q_UINT64_C(0x0123456789ab), 60);
+    const YandexLocationQuery query = YandexLocationQuery::fromObservation(Observation(QVector<ObservedCell>(), accessPoints));
+    QVERIFY(query.accessPoints.isEmpty());
+    QVERIFY(!encode(query).contains(QStringLiteral("wifi_networks")));
+}
+
+void tst_YandexLocationQuery::observedCellsAreCarried()
+{
+    // all of them, the answer locates the unsupported ones just as well.
+    QVector<ObservedCell> cells;
+    cells << observedCell(MLSDB_CELL_TYPE_LTE, 12345, 678, 244, 5, 20)
+          << observedCell(MLSDB_CELL_TYPE_OTHER, 23456, 789, 244, 5, 20);
+    const YandexLocationQuery query = YandexLocationQuery::fromObservation(Observation(cells, QVector<ObservedAccessPoint>()));
+    QCOMPARE(query.cells.size(), 1);
+    QCOMPARE(query.observedCells.size(), 2);
+    QVERIFY(query.observedCells.at(0).uniqueCellId == cells.at(0).uniqueCellId);
+    QVERIFY(query.observedCells.at(1).uniqueCellId == cells.at(1).uniqueCellId);
+}
+
+void tst_YandexLocationQuery::bssidStrings()
+{
+    QCOMPARE(Observation::bssidToString(Q_UINT64_C(0x0123456789ab)), QByteArray("01:23:45:67:89:ab"));
+    QCOMPARE(Observation::bssidFromString(QStringLiteral("01:23:45:67:89:AB")), Q_UINT64_C(0x0123456789ab));
+    QCOMPARE(Observation::bssidFromString(QStringLiteral("01:23:45:67:89")), quint64(0));
+    QCOMPARE(Observation::bssidFromString(QStringLiteral("01-23-45-67-89-ab")), quint64(0));
+    QCOMPARE(Observation::bssidFromString(QStringLiteral("01:23:45:67:89:xy")), quint64(0));
+}
+
+QTEST_APPLESS_MAIN(tst_YandexLocationQuery)
+
+#include "tst_yandexlocationquery.moc"
@@ -0,0 +1,11 @@
+TARGET = tst_yandexlocationquery
+include (../../tests.pri)
+
+HEADERS += \
+    $$PWD/../../../plugin/yandexlocationquery.h \
+    $$PWD/../../../plugin/observation.h
+
+SOURCES += \
+    tst_yandexlocationquery.cpp \
+    $$PWD/../../../plugin/yandexlocationquery.cpp \
+    $$PWD/../../../plugin/observation.cpp
@@ -0,0 +1,27 @@
+TARGET = tst_benchmarks
+include (../tests.pri)
+
+QT += dbus
+
+HEADERS += \
+    $$PWD/../../plugin/celllocationcache.h \
+    $$PWD/../../plugin/cellestimate.h \
+    $$PWD/../../plugin/locationtypes.h \
+    $$PWD/../../plugin/mlsdbcelldatabase.h \
+    $$PWD/../../plugin/observation.h \
+    $$PWD/../../plugin/positionfilter.h \
+    $$PWD/../../plugin/providerclock.h \
+    $$PWD/../../plugin/providerstatistics.h \
+    $$PWD/../../plugin/yandexlocationquery.h
+
+SOURCES += \
+    tst_benchmarks.cpp \
+    $$PWD/../../plugin/celllocationcache.cpp \
+    $$PWD/../../plugin/cellestimate.cpp \
+    $$PWD/../../plugin/locationtypes.cpp \
+    $$PWD/../../plugin/mlsdbcelldatabase.cpp \
+    $$PWD/../../plugin/observation.cpp \
+    $$PWD/../../plugin/positionfilter.cpp \
+    $$PWD/../../plugin/providerclock.cpp \
+    $$PWD/../../plugin/providerstatistics.cpp \
+    $$PWD/../../plugin/yandexlocationquery.cpp
@@ -0,0 +1,518 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include <QtTest/QtTest>
+#include <QtCore/QDataStream>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QMap>
+#include <QtCore/QSet>
+#include <QtCore/QTemporaryDir>
+#include <QtDBus/QDBusArgument>
+
+#include "cellestimate.h"
+#include "celllocationcache.h"
+#include "locationtypes.h"
+#include "mlsdbbloomfilter.h"
+#include "mlsdbcelldatabase.h"
+#include "mlsdbcellindex.h"
+#include "mlsdbwlanindex.h"
+#include "observation.h"
+#include "positionfilter.h"
+#include "yandexlocationquery.h"
+
+/*
+ * Benchmarks of the provider's offline lookups, Bloom filter rejections,
+ * triangulation, cell de-duplication, online query encoding and the path
+ * from a fix to the PositionChanged arguments, against synthetic data
+ * written into a temporary directory.  MLSDB_BENCHMARK_CELLS sets the number of cells
+ * in each of the nine buckets.
+ */
+
+namespace {
+    const int DefaultCellsPerBucket = 10000;
+    const int AccessPointCount = 10000;
+    const int ObservedAccessPointCount = 12;
+    const QString DataFileName = QStringLiteral("mlsdb.data");
+    const QString IndexFileName = QStringLiteral("mlsdb.index");
+    const QString WlanFileName = QStringLiteral("mlsdb.wlan");
+    const QString BloomFileName = QStringLiteral("mlsdb.bloom");
+
+    // a small deterministic generator, so that the data and the inputs are the same in every run.
+    class Random
+    {
+    public:
+        explicit Random(quint32 seed) : m_state(seed ? seed : 1) {}
+        quint32 next()
+        {
+            m_state ^= m_state << 13;
+            m_state ^= m_state >> 17;
+            m_state ^= m_state << 5;
+            return m_state;
+        }
+        quint32 bounded(quint32 bound) { return bound ? next() % bound : 0; }
+        double uniform(double minimum, double maximum) { return minimum + (maximum - minimum) * (next() / 4294967296.0); }
+
+    private:
+        quint32 m_state;
+    };
+
+    MlsdbUniqueCellId randomCell(Random *random, int bucket)
+    {
+        // the data is split into buckets by the leading digit of the location code.
+        quint32 scale = 1000;
+        for (quint32 digits = random->bounded(3); digits > 0; --digits) {
+            scale *= 10;
+        }
+        const quint32 locationCode = bucket * scale + random->bounded(scale);
+        const MlsdbCellType cellType = static_cast<MlsdbCellType>(random->bounded(MLSDB_CELL_TYPE_OTHER));
+        return MlsdbUniqueCellId(cellType, 1 + random->bounded(0x0FFFFFFF), locationCode,
+                                 quint16(200 + random->bounded(600)), quint16(1 + random->bounded(99)));
+    }
+
+    quint64 randomBssid(Random *random)
+    {
+        return (quint64(random->next()) << 16 | random->bounded(0x10000)) & Q_UINT64_C(0xFFFFFFFFFFFF);
+    }
+
+    bool writeFile(const QString &fileName, const QByteArray &contents)
+    {
+        QDir().mkpath(QFileInfo(fileName).path());
+        QFile file(fileName);
+        return file.open(QIODevice::WriteOnly | QIODevice::Truncate)
+            && file.write(contents) == contents.size();
+    }
+
+    // the version 4 index of a bucket, a QMap iterates in the order the index is sorted in.
+    QByteArray cellIndex(const QMap<MlsdbUniqueCellId, MlsdbCoords> &locations)
+    {
+        quint16 minimumMcc = 0xFFFF, maximumMcc = 0;
+        QByteArray records;
+        for (QMap<MlsdbUniqueCellId, MlsdbCoords>::const_iterator it = locations.constBegin(); it != locations.constEnd(); ++it) {
+            const MlsdbCellIndexRecord record = mlsdbCellIndexRecord(it.key(), it.value());
+            records.append(reinterpret_cast<const char *>(&record), sizeof(record));
+            minimumMcc = qMin(minimumMcc, it.key().mcc());
+            maximumMcc = qMax(maximumMcc, it.key().mcc());
+        }
+        const MlsdbCellIndexHeader header = mlsdbCellIndexHeader(locations.size(), minimumMcc, maximumMcc);
+        return QByteArray(reinterpret_cast<const char *>(&header), sizeof(header)) + records;
+    }
+
+    QByteArray wlanIndex(const QMap<quint64, MlsdbCoords> &locations)
+    {
+        const MlsdbWlanIndexHeader header = mlsdbWlanIndexHeader(locations.size());
+        QByteArray result(reinterpret_cast<const char *>(&header), sizeof(header));
+        for (QMap<quint64, MlsdbCoords>::const_iterator it = locations.constBegin(); it != locations.constEnd(); ++it) {
+            const MlsdbWlanIndexRecord record = mlsdbWlanIndexRecord(it.key(), it.value());
+            result.append(reinterpret_cast<const char *>(&record), sizeof(record));
+        }
+        return result;
+    }
+}
+
+class tst_Benchmarks : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+
+    void lookupCold_data();
+    void lookupCold();
+    void lookupWarm_data();
+    void lookupWarm();
+    void lookupUnknown_data();
+    void lookupUnknown();
+    void lookupAccessPoints();
+    void bloomFilterRejection();
+    void cacheLookup();
+    void estimateFromCells_data();
+    void estimateFromCells();
+    void estimateFromAccessPoints();
+    void deduplicateCells();
+    void hashCells();
+    void encodeQuery();
+    void filterFix();
+    void marshalPositionChanged();
+
+private:
+    void addDirectories();
+    QVector<ObservedCell> observedCells(int count);
+
+    QTemporaryDir m_directory;
+    QString m_dataDirectory;  // version 3 mlsdb.data buckets
+    QString m_indexDirectory; // version 4 mlsdb.index buckets with Bloom filters, and access points
+    QVector<MlsdbUniqueCellId> m_knownCells;
+    QVector<MlsdbUniqueCellId> m_unknownCells;
+    QMap<quint64, MlsdbCoords> m_accessPoints;
+    QVector<ObservedAccessPoint> m_observedAccessPoints;
+};
+
+void tst_Benchmarks::initTestCase()
+{
+    // keep the debug output of the code under test out of the timings.
+    QLoggingCategory::setFilterRules(QStringLiteral("*.debug=false"));
+
+    QVERIFY(m_directory.isValid());
+    m_dataDirectory = QDir(m_directory.path()).filePath(QStringLiteral("data"));
+    m_indexDirectory = QDir(m_directory.path()).filePath(QStringLiteral("index"));
+
+    bool ok = false;
+    int cellsPerBucket = qgetenv("MLSDB_BENCHMARK_CELLS").toInt(&ok);
+    if (!ok || cellsPerBucket <= 0) {
+        cellsPerBucket = DefaultCellsPerBucket;
+    }
+
+    Random random(1);
+    for (int bucket = 1; bucket <= 9; ++bucket) {
+        QMap<MlsdbUniqueCellId, MlsdbCoords> locations;
+        while (locations.size() < cellsPerBucket) {
+            MlsdbCoords coords;
+            coords.lat = random.uniform(-60.0, 70.0);
+            coords.lon = random.uniform(-180.0, 180.0);
+            locations.insert(randomCell(&random, bucket), coords);
+        }
+
+        // in the stream format MlsdbCellDatabase::searchDataFile() expects.
+        QByteArray data;
+        QDataStream stream(&data, QIODevice::WriteOnly);
+        stream << (quint32)MLSDB_DATA_MAGIC << (qint32)MLSDB_DATA_VERSION << locations;
+        const QString bucketName = QString::number(bucket);
+        QVERIFY(writeFile(QDir(m_dataDirectory).filePath(bucketName + QLatin1Char('/') + DataFileName), data));
+
+        QVector<quint64> keys;
+        keys.reserve(locations.size());
+        int taken = 0;
+        for (QMap<MlsdbUniqueCellId, MlsdbCoords>::const_iterator it = locations.constBegin(); it != locations.constEnd(); ++it) {
+            keys.append(MlsdbBloomFilter::cellKey(it.key()));
+            if (taken++ % 97 == 0) {
+                m_knownCells.append(it.key());
+            }
+        }
+        const QDir bucketDirectory(QDir(m_indexDirectory).filePath(bucketName));
+        const QByteArray index = cellIndex(locations);
+        QVERIFY(writeFile(bucketDirectory.filePath(IndexFileName), index));
+        QVERIFY(writeFile(bucketDirectory.filePath(BloomFileName), MlsdbBloomFilter::build(keys, quint32(index.size()))));
+    }
+
+    // cells missing from every bucket, such as those of a network added after the data was packaged.
+    for (int i = 0; i < 8; ++i) {
+        m_unknownCells.append(randomCell(&random, 1 + random.bounded(9)));
+    }
+
+    // clustered, a building's worth of access points within about a hundred metres.
+    QVector<quint64> firstCluster;
+    MlsdbCoords cluster;
+    while (m_accessPoints.size() < AccessPointCount) {
+        if (m_accessPoints.size() % 16 == 0) {
+            cluster.lat = random.uniform(-60.0, 70.0);
+            cluster.lon = random.uniform(-180.0, 180.0);
+        }
+        const quint64 bssid = randomBssid(&random);
+        if (m_accessPoints.contains(bssid)) {
+            continue;
+        }
+        MlsdbCoords coords;
+        coords.lat = cluster.lat + random.uniform(-0.001, 0.001);
+        coords.lon = cluster.lon + random.uniform(-0.001, 0.001);
+        m_accessPoints.insert(bssid, coords);
+        if (firstCluster.size() < 16) {
+            firstCluster.append(bssid);
+        }
+    }
+    QVector<quint64> keys;
+    Q_FOREACH (quint64 bssid, m_accessPoints.keys()) {
+        keys.append(MlsdbBloomFilter::accessPointKey(bssid));
+    }
+    const QByteArray index = wlanIndex(m_accessPoints);
+    QVERIFY(writeFile(QDir(m_indexDirectory).filePath(WlanFileName), index));
+    QVERIFY(writeFile(QDir(m_indexDirectory).filePath(BloomFileName), MlsdbBloomFilter::build(keys, quint32(index.size()))));
+
+    // neighbours in the data as they would be in a scan, plus one which is not there.
+    for (int i = 0; i < ObservedAccessPointCount; ++i) {
+        ObservedAccessPoint accessPoint;
+        accessPoint.bssid = i < ObservedAccessPointCount - 1 ? firstCluster.at(i) : randomBssid(&random);
+        accessPoint.frequency = i % 2 ? 2437 : 5180;
+        accessPoint.strength = quint16(random.bounded(101));
+        m_observedAccessPoints.append(accessPoint);
+    }
+}
+
+void tst_Benchmarks::addDirectories()
+{
+    QTest::addColumn<QString>("directory");
+    QTest::newRow("data") << m_dataDirectory;
+    QTest::newRow("index") << m_indexDirectory;
+}
+
+QVector<ObservedCell> tst_Benchmarks::observedCells(int count)
+{
+    // cells which exist in the data, spread over the buckets.
+    Random random(2);
+    QVector<ObservedCell> cells;
+    for (int i = 0; i < count; ++i) {
+        ObservedCell cell;
+        cell.uniqueCellId = m_knownCells.at(random.bounded(m_knownCells.size()));
+        cell.signalStrength = 1 + random.bounded(31);
+        cells.append(cell);
+    }
+    return cells;
+}
+
+void tst_Benchmarks::lookupCold_data()
+{
+    addDirectories();
+}
+
+void tst_Benchmarks::lookupCold()
+{
+    QFETCH(QString, directory);
+    QVector<MlsdbUniqueCellId> uniqueCellIds;
+    Q_FOREACH (const ObservedCell &cell, observedCells(7)) {
+        uniqueCellIds.append(cell.uniqueCellId);
+    }
+    uniqueCellIds.append(m_unknownCells.first());
+
+    QBENCHMARK {
+        // as after a restart of the provider: no manifest yet, and no bucket open.
+        MlsdbCellDatabase database;
+        database.setDataDirectory(directory);
+        MlsdbCellLocations found;
+        QVector<MlsdbUniqueCellId> unknown;
+        database.lookup(uniqueCellIds, &found, &unknown);
+        QCOMPARE(unknown.size(), 1);
+    }
+}
+
+void tst_Benchmarks::lookupWarm_data()
+{
+    addDirectories();
+}
+
+void tst_Benchmarks::lookupWarm()
+{
+    QFETCH(QString, directory);
+    QVector<MlsdbUniqueCellId> uniqueCellIds;
+    Q_FOREACH (const ObservedCell &cell, observedCells(7)) {
+        uniqueCellIds.append(cell.uniqueCellId);
+    }
+    uniqueCellIds.append(m_unknownCells.first());
+
+    MlsdbCellDatabase database;
+    database.setDataDirectory(directory);
+    database.prepare();
+    QBENCHMARK {
+        MlsdbCellLocations found;
+        QVector<MlsdbUniqueCellId> unknown;
+        database.lookup(uniqueCellIds, &found, &unknown);
+        QCOMPARE(unknown.size(), 1);
+    }
+}
+
+void tst_Benchmarks::lookupUnknown_data()
+{
+    addDirectories();
+}
+
+void tst_Benchmarks::lookupUnknown()
+{
+    QFETCH(QString, directory);
+    MlsdbCellDatabase database;
+    database.setDataDirectory(directory);
+    database.prepare();
+    QBENCHMARK {
+        MlsdbCellLocations found;
+        QVector<MlsdbUniqueCellId> unknown;
+        database.lookup(m_unknownCells, &found, &unknown);
+        QCOMPARE(unknown.size(), m_unknownCells.size());
+    }
+}
+
+void tst_Benchmarks::lookupAccessPoints()
+{
+    QVector<quint64> bssids;
+    Q_FOREACH (const ObservedAccessPoint &accessPoint, m_observedAccessPoints) {
+        bssids.append(accessPoint.bssid);
+    }
+
+    MlsdbCellDatabase database;
+    database.setDataDirectory(m_indexDirectory);
+    database.prepare();
+    QBENCHMARK {
+        MlsdbAccessPointLocations found;
+        QVector<quint64> unknown;
+        database.lookupAccessPoints(bssids, &found, &unknown);
+        QCOMPARE(found.size(), ObservedAccessPointCount - 1);
+    }
+}
+
+void tst_Benchmarks::bloomFilterRejection()
+{
+    // a cell the filter rules out costs a few hashes rather than a binary search of the index.
+    MlsdbBloomFilter bloom;
+    QVERIFY(bloom.open(QDir(m_indexDirectory).filePath(QStringLiteral("1/") + BloomFileName)));
+    int rejected = 0;
+    QBENCHMARK {
+        Q_FOREACH (const MlsdbUniqueCellId &uniqueCellId, m_unknownCells) {
+            rejected += !bloom.mayContain(MlsdbBloomFilter::cellKey(uniqueCellId));
+        }
+    }
+    QVERIFY(rejected > 0);
+}
+
+void tst_Benchmarks::cacheLookup()
+{
+    CellLocationCache cache;
+    const QVector<ObservedCell> cells = observedCells(7);
+    Q_FOREACH (const ObservedCell &cell, cells) {
+        MlsdbCoords coords;
+        coords.lat = 60.17;
+        coords.lon = 24.94;
+        cache.insertLocation(cell.uniqueCellId, coords, CellLocationCache::OfflineSource);
+    }
+    QBENCHMARK {
+        Q_FOREACH (const ObservedCell &cell, cells) {
+            MlsdbCoords coords;
+            QCOMPARE(cache.lookup(cell.uniqueCellId, &coords), CellLocationCache::Located);
+        }
+    }
+}
+
+void tst_Benchmarks::estimateFromCells_data()
+{
+    QTest::addColumn<int>("cellCount");
+    QTest::newRow("1 cell") << 1;
+    QTest::newRow("7 cells") << 7;
+    QTest::newRow("32 cells") << 32;
+}
+
+void tst_Benchmarks::estimateFromCells()
+{
+    QFETCH(int, cellCount);
+    const QVector<ObservedCell> cells = observedCells(cellCount);
+
+    MlsdbCellDatabase database;
+    database.setDataDirectory(m_indexDirectory);
+    QVector<MlsdbUniqueCellId> uniqueCellIds;
+    Q_FOREACH (const ObservedCell &cell, cells) {
+        uniqueCellIds.append(cell.uniqueCellId);
+    }
+    MlsdbCellLocations found;
+    QVector<MlsdbUniqueCellId> unknown;
+    database.lookup(uniqueCellIds, &found, &unknown);
+    CellLocationCache cache;
+    for (MlsdbCellLocations::const_iterator it = found.constBegin(); it != found.constEnd(); ++it) {
+        cache.insertLocation(it.key(), it.value(), CellLocationCache::OfflineSource);
+    }
+
+    QBENCHMARK {
+        QVERIFY(estimateLocationFromCells(cells, cache).timestamp() != 0);
+    }
+}
+
+void tst_Benchmarks::estimateFromAccessPoints()
+{
+    QHash<quint64, MlsdbCoords> locations;
+    Q_FOREACH (const ObservedAccessPoint &accessPoint, m_observedAccessPoints) {
+        if (m_accessPoints.contains(accessPoint.bssid)) {
+            locations.insert(accessPoint.bssid, m_accessPoints.value(accessPoint.bssid));
+        }
+    }
+    QBENCHMARK {
+        QVERIFY(estimateLocationFromAccessPoints(m_observedAccessPoints, locations).timestamp() != 0);
+    }
+}
+
+void tst_Benchmarks::deduplicateCells()
+{
+    // a scan lists the serving cell among its neighbours, and may list one neighbour twice.
+    const QVector<ObservedCell> cells = observedCells(7);
+    const QVector<ObservedCell> reportedCells = cells + cells;
+    QBENCHMARK {
+        QVector<ObservedCell> deduplicated;
+        deduplicated.reserve(reportedCells.size());
+        QSet<MlsdbUniqueCellId> seenCellIds;
+        Q_FOREACH (const ObservedCell &cell, reportedCells) {
+            if (!seenCellIds.contains(cell.uniqueCellId)) {
+                deduplicated.append(cell);
+                seenCellIds.insert(cell.uniqueCellId);
+            }
+        }
+        QVERIFY(deduplicated.size() <= cells.size());
+    }
+}
+
+void tst_Benchmarks::hashCells()
+{
+    // qHash(MlsdbUniqueCellId) over the cells of a bucket, as the cell location cache sees them.
+    QBENCHMARK {
+        QSet<MlsdbUniqueCellId> cells;
+        cells.reserve(m_knownCells.size());
+        Q_FOREACH (const MlsdbUniqueCellId &uniqueCellId, m_knownCells) {
+            cells.insert(uniqueCellId);
+        }
+        QCOMPARE(cells.size(), m_knownCells.size());
+    }
+}
+
+void tst_Benchmarks::encodeQuery()
+{
+    const Observation observation(observedCells(7), m_observedAccessPoints);
+    QBENCHMARK {
+        const YandexLocationQuery query = YandexLocationQuery::fromObservation(observation);
+        QVERIFY(!query.toJson(QByteArrayLiteral("benchmark-key")).isEmpty());
+    }
+}
+
+void tst_Benchmarks::filterFix()
+{
+    // filtering a fix and keeping it with the one before, which is what setLocation() does with it.
+    PositionFilter filter;
+    Location currentLocation;
+    Location lastLocation;
+    qint64 timestamp = Q_INT64_C(1500000000000);
+    QBENCHMARK {
+        timestamp += 1000;
+        Location fix;
+        fix.setTimestamp(timestamp);
+        fix.setLatitude(60.17 + (timestamp / 1000 % 7) * 0.00001);
+        fix.setLongitude(24.94);
+        Accuracy accuracy;
+        accuracy.setHorizontal(50 + timestamp / 1000 % 3);
+        fix.setAccuracy(accuracy);
+        filter.update(fix);
+        lastLocation = currentLocation;
+        currentLocation = filter.location();
+    }
+    QVERIFY(currentLocation.timestamp() != 0);
+}
+
+void tst_Benchmarks::marshalPositionChanged()
+{
+    // marshalling a fix into the PositionChanged arguments, the last step before D-Bus.
+    Location location;
+    location.setTimestamp(Q_INT64_C(1500000000000));
+    location.setLatitude(60.17);
+    location.setLongitude(24.94);
+    Accuracy accuracy;
+    accuracy.setHorizontal(50);
+    location.setAccuracy(accuracy);
+    QBENCHMARK {
+        QDBusArgument argument;
+        argument << int(3) << int(location.timestamp() / 1000)
+                 << location.latitude() << location.longitude()
+                 << location.altitude() << location.accuracy();
+    }
+}
+
+QTEST_GUILESS_MAIN(tst_Benchmarks)
+
+#include "tst_benchmarks.moc"
@@ -0,0 +1,33 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#ifndef TESTFIXTURES_H
+#define TESTFIXTURES_H
+
+#include "mlsdbserialisation.h"
+
+/*
+ * Fixtures shared by the unit tests: distinct cells spread over a few
+ * location areas of one network, and coordinates built in one call.
+ */
+
+inline MlsdbUniqueCellId cell(quint32 cellId)
+{
+    return MlsdbUniqueCellId(MLSDB_CELL_TYPE_LTE, cellId, 1000 + cellId % 7, 244, 5);
+}
+
+inline MlsdbCoords coords(double lat, double lon)
+{
+    MlsdbCoords result;
+    result.lat = lat;
+    result.lon = lon;
+    return result;
+}
+
+#endif // TESTFIXTURES_H
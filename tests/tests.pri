@@ -0,0 +1,10 @@
+# the tests build the sources they exercise directly, and share testfixtures.h.
+QT = core testlib
+CONFIG += console testcase
+CONFIG -= app_bundle
+TEMPLATE = app
+
+include ($$PWD/../common/common.pri)
+INCLUDEPATH += $$PWD/../plugin
+INCLUDEPATH += $$PWD
+HEADERS += $$PWD/testfixtures.h
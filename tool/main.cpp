@@ -0,0 +1,535 @@
+/*
+    This file is part of geoclue-yandex based on geoclue-mlsdb.
+
+    Geoclue-yandex is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QDataStream>
+#include <QtCore/QDir>
+#include <QtCore/QDirIterator>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSaveFile>
+#include <QtCore/QSet>
+#include <QtCore/QStringList>
+#include <QtCore/QTextStream>
+
+#include <algorithm>
+#include <string.h>
+
+#include "mlsdbserialisation.h"
+#include "mlsdbcellindex.h"
+#include "mlsdbbloomfilter.h"
+#include "mlsdbwlanindex.h"
+
+/*
+ * Packaging-time helper for the mlsdb data shipped with the provider.
+ *
+ * "convert" compiles version 3 mlsdb.data buckets into the version 4
+ * mlsdb.index format which the provider maps and searches in place.
+ * Buckets are converted one at a time, and records are streamed from
+ * the input straight into the mapped output file, so memory use does
+ * not depend on the size of the data.  An mlsdb.bloom filter over the
+ * cells is written next to each index.
+ *
+ * "wlan" compiles a CSV file of "bssid,latitude,longitude" lines into
+ * the sorted mlsdb.wlan access point index, with its own mlsdb.bloom.
+ *
+ * "hashstats" measures how well qHash(MlsdbUniqueCellId) spreads the
+ * cells of a real data dump over the buckets of a hash table.
+ */
+
+namespace {
+    const QString DefaultDataDirectory = QStringLiteral("/usr/share/geoclue-provider-mlsdb/");
+    const QString DataFileName = QStringLiteral("mlsdb.data");
+    const QString IndexFileName = QStringLiteral("mlsdb.index");
+    const QString WlanFileName = QStringLiteral("mlsdb.wlan");
+    const QString BloomFileName = QStringLiteral("mlsdb.bloom");
+
+    QTextStream &out()
+    {
+        static QTextStream stream(stdout);
+        return stream;
+    }
+
+    QTextStream &err()
+    {
+        static QTextStream stream(stderr);
+        return stream;
+    }
+
+    struct ConversionResult {
+        ConversionResult() : records(0), inputBytes(0), outputBytes(0) {}
+        quint32 records;
+        qint64 inputBytes;
+        qint64 outputBytes;
+    };
+
+    bool convertBucket(const QString &inputName, const QString &outputName, ConversionResult *result)
+    {
+        QFile input(inputName);
+        if (!input.open(QIODevice::ReadOnly)) {
+            err() << inputName << ": cannot open: " << input.errorString() << endl;
+            return false;
+        }
+
+        QDataStream in(&input);
+        quint32 magic = 0;
+        qint32 version = 0;
+        in >> magic >> version;
+        if (magic != (quint32)MLSDB_DATA_MAGIC) {
+            err() << inputName << ": format unknown: " << magic << endl;
+            return false;
+        }
+        if (version != MLSDB_DATA_VERSION) {
+            err() << inputName << ": version unknown: " << version << endl;
+            return false;
+        }
+
+        // the bucket is a serialised QMap<MlsdbUniqueCellId, MlsdbCoords>:
+        // a record count followed by the key/value pairs, which QMap writes
+        // in descending key order.
+        quint32 count = 0;
+        in >> count;
+        if (in.status() != QDataStream::Ok) {
+            err() << inputName << ": truncated header" << endl;
+            return false;
+        }
+
+        const QString temporaryName = outputName + QStringLiteral(".tmp");
+        QFile output(temporaryName);
+        if (!output.open(QIODevice::ReadWrite | QIODevice::Truncate)) {
+            err() << temporaryName << ": cannot open: " << output.errorString() << endl;
+            return false;
+        }
+
+        const qint64 outputSize = qint64(sizeof(MlsdbCellIndexHeader)) + qint64(count) * qint64(sizeof(MlsdbCellIndexRecord));
+        uchar *data = 0;
+        if (!output.resize(outputSize) || !(data = output.map(0, outputSize))) {
+            err() << temporaryName << ": cannot allocate " << outputSize << " bytes: " << output.errorString() << endl;
+            output.remove();
+            return false;
+        }
+
+        MlsdbCellIndexRecord *records = reinterpret_cast<MlsdbCellIndexRecord *>(data + sizeof(MlsdbCellIndexHeader));
+        MlsdbCellIndexRecord previous;
+        bool descending = true;
+        quint16 minimumMcc = 0xFFFF;
+        quint16 maximumMcc = 0;
+        for (quint32 i = 0; i < count; ++i) {
+            MlsdbUniqueCellId uniqueCellId;
+            MlsdbCoords coords;
+            in >> uniqueCellId >> coords;
+            if (in.status() != QDataStream::Ok) {
+                err() << inputName << ": truncated after " << i << " of " << count << " records" << endl;
+                output.unmap(data);
+                output.remove();
+                return false;
+            }
+
+            // place the records from the back, so that the expected descending
+            // input order produces an ascending index without any buffering.
+            const MlsdbCellIndexRecord record = mlsdbCellIndexRecord(uniqueCellId, coords);
+            if (i > 0 && !mlsdbCellIndexRecordLessThan(record, previous)) {
+                descending = false;
+            }
+            records[count - 1 - i] = record;
+            previous = record;
+            minimumMcc = qMin(minimumMcc, uniqueCellId.mcc());
+            maximumMcc = qMax(maximumMcc, uniqueCellId.mcc());
+        }
+
+        if (!descending) {
+            // not written by QMap.  sort the mapped records in place.
+            std::sort(records, records + count, mlsdbCellIndexRecordLessThan);
+        }
+
+        if (count == 0) {
+            minimumMcc = maximumMcc = 0;
+        }
+        const MlsdbCellIndexHeader header = mlsdbCellIndexHeader(count, minimumMcc, maximumMcc);
+        memcpy(data, &header, sizeof(header));
+
+        output.unmap(data);
+        output.close();
+        QFile::remove(outputName);
+        if (!QFile::rename(temporaryName, outputName)) {
+            err() << outputName << ": cannot replace with " << temporaryName << endl;
+            QFile::remove(temporaryName);
+            return false;
+        }
+
+        result->records = count;
+        result->inputBytes = input.size();
+        result->outputBytes = outputSize;
+        return true;
+    }
+
+    // calls function(uniqueCellId, coords) for every cell of a version 3 or version 4 bucket file.
+    template <typename Function>
+    bool forEachCell(const QString &fname, Function function)
+    {
+        if (fname.endsWith(IndexFileName)) {
+            MlsdbCellIndex index;
+            if (!index.open(fname)) {
+                return false;
+            }
+            for (quint32 i = 0; i < index.recordCount(); ++i) {
+                function(mlsdbCellIndexRecordCellId(index.records()[i]), mlsdbCellIndexRecordCoords(index.records()[i]));
+            }
+            return true;
+        }
+
+        QFile file(fname);
+        if (!file.open(QIODevice::ReadOnly)) {
+            return false;
+        }
+        QDataStream in(&file);
+        quint32 magic = 0, count = 0;
+        qint32 version = 0;
+        in >> magic >> version >> count;
+        if (magic != (quint32)MLSDB_DATA_MAGIC || version != MLSDB_DATA_VERSION) {
+            return false;
+        }
+        for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+            MlsdbUniqueCellId uniqueCellId;
+            MlsdbCoords coords;
+            in >> uniqueCellId >> coords;
+            function(uniqueCellId, coords);
+        }
+        return in.status() == QDataStream::Ok;
+    }
+
+    // calls function(bssid, coords) for every access point of an mlsdb.wlan index.
+    template <typename Function>
+    bool forEachAccessPoint(const QString &fname, Function function)
+    {
+        MlsdbWlanIndex index;
+        if (!index.open(fname)) {
+            return false;
+        }
+        for (quint32 i = 0; i < index.recordCount(); ++i) {
+            function(mlsdbWlanIndexRecordBssid(index.records()[i]), mlsdbWlanIndexRecordCoords(index.records()[i]));
+        }
+        return true;
+    }
+
+    // (re)writes the mlsdb.bloom filter of a directory, over the keys of all of its data files.
+    bool writeBloomFilter(const QDir &directory)
+    {
+        QVector<quint64> keys;
+        QStringList sourceFiles; // the files the keys are read from
+        const QString indexName = directory.filePath(IndexFileName);
+        const QString dataName = directory.filePath(DataFileName);
+        const QString wlanName = directory.filePath(WlanFileName);
+        if (QFile::exists(indexName) || QFile::exists(dataName)) {
+            const QString cellsName = QFile::exists(indexName) ? indexName : dataName;
+            sourceFiles.append(cellsName);
+            if (!forEachCell(cellsName, [&keys](const MlsdbUniqueCellId &uniqueCellId, const MlsdbCoords &) {
+                    keys.append(MlsdbBloomFilter::cellKey(uniqueCellId));
+                })) {
+                err() << cellsName << ": cannot read" << endl;
+                return false;
+            }
+        }
+        if (QFile::exists(wlanName)) {
+            sourceFiles.append(wlanName);
+            if (!forEachAccessPoint(wlanName, [&keys](quint64 bssid, const MlsdbCoords &) {
+                    keys.append(MlsdbBloomFilter::accessPointKey(bssid));
+                })) {
+                err() << wlanName << ": cannot read" << endl;
+                return false;
+            }
+        }
+
+        const QString fname = directory.filePath(BloomFileName);
+        QSaveFile file(fname);
+        if (!file.open(QIODevice::WriteOnly) || file.write(MlsdbBloomFilter::build(keys, MlsdbBloomFilter::sourceSize(sourceFiles))) < 0 || !file.commit()) {
+            err() << fname << ": cannot write: " << file.errorString() << endl;
+            return false;
+        }
+        return true;
+    }
+
+    // writes the records, in any order, as a sorted mlsdb.wlan index.
+    bool writeWlanIndex(QVector<MlsdbWlanIndexRecord> records, const QString &fname)
+    {
+        std::sort(records.begin(), records.end(), mlsdbWlanIndexRecordLessThan);
+        const MlsdbWlanIndexHeader header = mlsdbWlanIndexHeader(quint32(records.size()));
+
+        QSaveFile file(fname);
+        if (!file.open(QIODevice::WriteOnly)
+                || file.write(reinterpret_cast<const char *>(&header), sizeof(header)) != qint64(sizeof(header))
+                || file.write(reinterpret_cast<const char *>(records.constData()), records.size() * sizeof(MlsdbWlanIndexRecord))
+                        != qint64(records.size() * sizeof(MlsdbWlanIndexRecord))
+                || !file.commit()) {
+            err() << fname << ": cannot write: " << file.errorString() << endl;
+            return false;
+        }
+        return true;
+    }
+
+    int convert(const QStringList &arguments)
+    {
+        QCommandLineParser parser;
+        parser.setApplicationDescription(QStringLiteral("Convert version 3 mlsdb.data buckets into mapped version 4 mlsdb.index files and their Bloom filters."));
+        parser.addHelpOption();
+        parser.addPositionalArgument(QStringLiteral("convert"), QStringLiteral("The command."));
+        parser.addPositionalArgument(QStringLiteral("directory"), QStringLiteral("Directories to scan for mlsdb.data buckets."), QStringLiteral("[directory...]"));
+        QCommandLineOption outputOption(QStringList() << QStringLiteral("o") << QStringLiteral("output"),
+                                        QStringLiteral("Write the index files below <dir> instead of next to the data files."),
+                                        QStringLiteral("dir"));
+        parser.addOption(outputOption);
+        parser.process(arguments);
+
+        QStringList directories = parser.positionalArguments().mid(1);
+        if (directories.isEmpty()) {
+            directories.append(DefaultDataDirectory);
+        }
+
+        ConversionResult total;
+        int buckets = 0;
+        int failures = 0;
+        Q_FOREACH (const QString &directory, directories) {
+            const QDir root(directory);
+            QDirIterator it(directory, QStringList() << DataFileName, QDir::Files, QDirIterator::Subdirectories);
+            while (it.hasNext()) {
+                const QString inputName(it.next());
+                QString outputName = QFileInfo(inputName).dir().filePath(IndexFileName);
+                if (parser.isSet(outputOption)) {
+                    outputName = QDir(parser.value(outputOption)).filePath(root.relativeFilePath(outputName));
+                    QDir().mkpath(QFileInfo(outputName).path());
+                }
+
+                ConversionResult result;
+                if (!convertBucket(inputName, outputName, &result)
+                        || !writeBloomFilter(QFileInfo(outputName).dir())) {
+                    ++failures;
+                    continue;
+                }
+
+                out() << inputName << ": " << result.records << " records, "
+                      << result.inputBytes << " -> " << result.outputBytes << " bytes ("
+                      << QString::number(result.inputBytes ? 100.0 * result.outputBytes / result.inputBytes : 0.0, 'f', 1)
+                      << "%) " << outputName << endl;
+                ++buckets;
+                total.records += result.records;
+                total.inputBytes += result.inputBytes;
+                total.outputBytes += result.outputBytes;
+            }
+        }
+
+        out() << "converted " << buckets << " buckets, " << total.records << " records, "
+              << total.inputBytes << " -> " << total.outputBytes << " bytes";
+        if (failures) {
+            out() << ", " << failures << " failed";
+        }
+        out() << endl;
+        return failures ? 1 : 0;
+    }
+
+    bool parseBssid(QString text, quint64 *bssid)
+    {
+        // either "01:23:45:67:89:ab" or "0123456789ab".
+        text.remove(QLatin1Char(':'));
+        text.remove(QLatin1Char('-'));
+        bool ok = false;
+        *bssid = text.toULongLong(&ok, 16);
+        return ok && text.size() == 12;
+    }
+
+    int wlan(const QStringList &arguments)
+    {
+        QCommandLineParser parser;
+        parser.setApplicationDescription(QStringLiteral("Compile \"bssid,latitude,longitude\" lines into an mlsdb.wlan index and its Bloom filter."));
+        parser.addHelpOption();
+        parser.addPositionalArgument(QStringLiteral("wlan"), QStringLiteral("The command."));
+        parser.addPositionalArgument(QStringLiteral("csv"), QStringLiteral("The access point locations, \"-\" for standard input."));
+        parser.addPositionalArgument(QStringLiteral("directory"), QStringLiteral("The directory to write the index into."), QStringLiteral("[directory]"));
+        parser.process(arguments);
+
+        const QString inputName = parser.positionalArguments().value(1);
+        if (inputName.isEmpty()) {
+            parser.showHelp(1);
+        }
+        const QDir directory(parser.positionalArguments().value(2, DefaultDataDirectory));
+
+        QFile input;
+        if (inputName == QLatin1String("-")) {
+            input.open(stdin, QIODevice::ReadOnly | QIODevice::Text);
+        } else {
+            input.setFileName(inputName);
+            if (!input.open(QIODevice::ReadOnly | QIODevice::Text)) {
+                err() << inputName << ": cannot open: " << input.errorString() << endl;
+                return 1;
+            }
+        }
+
+        QVector<MlsdbWlanIndexRecord> records;
+        QSet<quint64> seen;
+        int lineNumber = 0;
+        int skipped = 0;
+        QTextStream in(&input);
+        while (!in.atEnd()) {
+            const QString line = in.readLine().trimmed();
+            ++lineNumber;
+            if (line.isEmpty() || line.startsWith(QLatin1Char('#'))) {
+                continue;
+            }
+            const QStringList fields = line.split(QLatin1Char(','));
+            quint64 bssid = 0;
+            MlsdbCoords coords;
+            bool latitudeOk = false, longitudeOk = false;
+            if (fields.size() >= 3) {
+                coords.lat = fields.at(1).trimmed().toDouble(&latitudeOk);
+                coords.lon = fields.at(2).trimmed().toDouble(&longitudeOk);
+            }
+            if (fields.size() < 3 || !parseBssid(fields.at(0).trimmed(), &bssid) || !latitudeOk || !longitudeOk
+                    || qAbs(coords.lat) > 90.0 || qAbs(coords.lon) > 180.0) {
+                if (lineNumber > 1) { // the first line may be a header.
+                    err() << inputName << ":" << lineNumber << ": cannot parse, skipping" << endl;
+                }
+                ++skipped;
+                continue;
+            }
+            if (seen.contains(bssid)) {
+                ++skipped; // the first location wins.
+                continue;
+            }
+            seen.insert(bssid);
+            records.append(mlsdbWlanIndexRecord(bssid, coords));
+        }
+
+        QDir().mkpath(directory.path());
+        const QString outputName = directory.filePath(WlanFileName);
+        if (!writeWlanIndex(records, outputName) || !writeBloomFilter(directory)) {
+            return 1;
+        }
+        out() << outputName << ": " << records.size() << " access points, " << skipped << " lines skipped" << endl;
+        return 0;
+    }
+
+    uint legacyHash(const MlsdbUniqueCellId &key, uint)
+    {
+        return key.m_cellId;
+    }
+
+    uint mixingHash(const MlsdbUniqueCellId &key, uint seed)
+    {
+        return qHash(key, seed);
+    }
+
+    void reportHashStatistics(const char *name, uint (*hash)(const MlsdbUniqueCellId &, uint),
+                              const QVector<MlsdbUniqueCellId> &keys)
+    {
+        // a power-of-two table as used by CellLocationCache, and a prime-sized one as used by QHash.
+        int bits = 4;
+        while ((1 << bits) < 2 * keys.size()) {
+            ++bits;
+        }
+        const uint maskedBuckets = 1u << bits;
+        const uint primeBuckets = maskedBuckets - 3; // odd-sized, close enough to QHash's prime bucket counts
+
+        QVector<int> masked(maskedBuckets, 0);
+        QVector<int> prime(primeBuckets, 0);
+        int maskedCollisions = 0;
+        int primeCollisions = 0;
+        uint checksum = 0;
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < keys.size(); ++i) {
+            const uint h = hash(keys.at(i), 0);
+            checksum ^= h;
+            if (masked[h & (maskedBuckets - 1)]++) {
+                ++maskedCollisions;
+            }
+            if (prime[h % primeBuckets]++) {
+                ++primeCollisions;
+            }
+        }
+        const qint64 elapsed = timer.nsecsElapsed();
+
+        int longestChain = 0;
+        for (uint i = 0; i < maskedBuckets; ++i) {
+            longestChain = qMax(longestChain, masked.at(i));
+        }
+
+        out() << name << ": " << keys.size() << " keys, "
+              << QString::number(keys.isEmpty() ? 0.0 : 100.0 * maskedCollisions / keys.size(), 'f', 2) << "% collisions in "
+              << maskedBuckets << " power-of-two buckets (longest chain " << longestChain << "), "
+              << QString::number(keys.isEmpty() ? 0.0 : 100.0 * primeCollisions / keys.size(), 'f', 2) << "% in "
+              << primeBuckets << " odd-sized buckets, "
+              << QString::number(keys.isEmpty() ? 0.0 : double(elapsed) / keys.size(), 'f', 1) << " ns/key"
+              << " (checksum " << checksum << ")" << endl;
+    }
+
+    int hashStatistics(const QStringList &arguments)
+    {
+        QCommandLineParser parser;
+        parser.setApplicationDescription(QStringLiteral("Measure the distribution of qHash(MlsdbUniqueCellId) over the cells of a data dump."));
+        parser.addHelpOption();
+        parser.addPositionalArgument(QStringLiteral("hashstats"), QStringLiteral("The command."));
+        parser.addPositionalArgument(QStringLiteral("directory"), QStringLiteral("Directories to scan for mlsdb.data and mlsdb.index buckets."), QStringLiteral("[directory...]"));
+        parser.process(arguments);
+
+        QStringList directories = parser.positionalArguments().mid(1);
+        if (directories.isEmpty()) {
+            directories.append(DefaultDataDirectory);
+        }
+
+        QVector<MlsdbUniqueCellId> keys;
+        Q_FOREACH (const QString &directory, directories) {
+            QDirIterator it(directory, QStringList() << DataFileName << IndexFileName, QDir::Files, QDirIterator::Subdirectories);
+            while (it.hasNext()) {
+                const QString fname(it.next());
+                if (fname.endsWith(DataFileName) && QFile::exists(QFileInfo(fname).dir().filePath(IndexFileName))) {
+                    continue; // the same cells are read from the index.
+                }
+                if (!forEachCell(fname, [&keys](const MlsdbUniqueCellId &uniqueCellId, const MlsdbCoords &) {
+                        keys.append(uniqueCellId);
+                    })) {
+                    err() << fname << ": cannot read" << endl;
+                }
+            }
+        }
+
+        reportHashStatistics("cell id only", legacyHash, keys);
+        reportHashStatistics("mixing", mixingHash, keys);
+        return 0;
+    }
+
+    void usage()
+    {
+        err() << "usage: " << QCoreApplication::applicationName() << " <command> [options]" << endl
+              << endl
+              << "commands:" << endl
+              << "  convert    compile version 3 mlsdb.data buckets into mlsdb.index files" << endl
+              << "  wlan       compile access point locations into an mlsdb.wlan file" << endl
+              << "  hashstats  measure the hash distribution of the cells of a data dump" << endl;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("geoclue-yandex-mlsdb-tool"));
+
+    const QStringList arguments = app.arguments();
+    const QString command = arguments.value(1);
+    if (command == QLatin1String("convert")) {
+        return convert(arguments);
+    } else if (command == QLatin1String("wlan")) {
+        return wlan(arguments);
+    } else if (command == QLatin1String("hashstats")) {
+        return hashStatistics(arguments);
+    }
+
+    usage();
+    return command.isEmpty() || command == QLatin1String("--help") ? 0 : 1;
+}
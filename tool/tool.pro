@@ -0,0 +1,14 @@
+TARGET = geoclue-yandex-mlsdb-tool
+CONFIG   += console
+CONFIG   -= app_bundle
+TEMPLATE = app
+
+target.path = /usr/bin
+
+QT = core
+
+include (../common/common.pri)
+SOURCES += \
+    main.cpp
+
+INSTALLS += target